@@ -5,6 +5,12 @@ build() {
     make -C build -s
 }
 
+# Optimized build for the benchmarks: ./runbuild.sh release [RelWithDebInfo]
+release_build() {
+    cmake . -B build-release -DCMAKE_BUILD_TYPE="${1:-Release}"
+    make -C build-release -s benchmarks
+}
+
 clean_build() {
     make -C build clean >/dev/null
 }
@@ -18,6 +24,8 @@ if [ "$1" == "erase" ]; then
     erase_build
 elif [ "$1" == "clean" ]; then
     clean_build
+elif [ "$1" == "release" ]; then
+    release_build "$2"
 else
     build
 fi
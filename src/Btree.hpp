@@ -0,0 +1,1034 @@
+#pragma once
+
+#include <algorithm>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "RBtreeChecks.hpp"
+#include "RBtreeKeySearch.hpp"
+
+/*
+ * Cache-conscious sibling of RBtree with the same interface: a B+ tree whose
+ * leaves hold the elements in contiguous arrays, 8 to 32 per node depending
+ * on their size, linked into a list for iteration. Inner nodes hold copies
+ * of separator keys and the child pointers.
+ *
+ * Unlike RBtree, insert and erase invalidate every iterator, since elements
+ * move between the slots of a node.
+ */
+template <class Key, class T, class Compare = std::less<Key>,
+          class Allocator = std::allocator<std::pair<const Key, T>>>
+class Btree {
+  static constexpr const char* kOutOfRange = "Missing element";
+
+  template <bool IsConst>
+  class Iterator;
+
+ public:
+  using key_type = Key;
+  using mapped_type = T;
+  using value_type = std::pair<const Key, T>;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+  using key_compare = Compare;
+  using allocator_type = Allocator;
+  using reference = value_type&;
+  using const_reference = const value_type&;
+  using allocator_traits = std::allocator_traits<allocator_type>;
+  using pointer = typename allocator_traits::pointer;
+  using const_pointer = typename allocator_traits::const_pointer;
+  using iterator = Iterator<false>;
+  using const_iterator = Iterator<true>;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  template <typename K, typename V, typename C, typename A>
+  friend class BtreeValidator;
+
+ private:
+  struct InnerNode;
+
+  struct BasicNode {
+    InnerNode* parent{};
+    /* Elements of a leaf, separator keys of an inner node. */
+    std::uint32_t count{};
+    bool leaf{};
+  };
+
+  static constexpr bool kSimdSearch = simd_searchable_key<Compare, Key>;
+
+  static constexpr std::size_t kCacheLine = 64;
+  static constexpr std::size_t kNodeBytes = 4 * kCacheLine;
+  static constexpr std::size_t kMinSlots = 8;
+  static constexpr std::size_t kMaxSlots = 32;
+
+  static constexpr std::size_t slots_for(std::size_t header,
+                                         std::size_t slot) noexcept {
+    return std::clamp((kNodeBytes - header) / slot, kMinSlots, kMaxSlots);
+  }
+
+  static constexpr std::size_t kLeafSlots =
+      slots_for(sizeof(BasicNode) + 2 * sizeof(void*), sizeof(value_type));
+  static constexpr std::size_t kInnerSlots = slots_for(
+      sizeof(BasicNode) + sizeof(void*), sizeof(key_type) + sizeof(void*));
+  /*
+   * Fewer elements or separators than this make a node underfull. A full
+   * inner node splits into two halves and the middle key, hence the - 1.
+   */
+  static constexpr std::size_t kMinLeafSlots = kLeafSlots / 2;
+  static constexpr std::size_t kMinInnerSlots = (kInnerSlots - 1) / 2;
+
+  struct alignas(kCacheLine) LeafNode : BasicNode {
+    value_type* slot(std::size_t index) noexcept {
+      return std::launder(reinterpret_cast<value_type*>(storage)) + index;
+    }
+
+    LeafNode* prev{};
+    LeafNode* next{};
+    alignas(value_type) std::byte storage[kLeafSlots * sizeof(value_type)];
+  };
+
+  /* Child i holds the keys in [key(i - 1), key(i)). */
+  struct alignas(kCacheLine) InnerNode : BasicNode {
+    key_type* key(std::size_t index) noexcept {
+      return std::launder(reinterpret_cast<key_type*>(storage)) + index;
+    }
+
+    BasicNode* children[kInnerSlots + 1];
+    alignas(key_type) std::byte storage[kInnerSlots * sizeof(key_type)];
+  };
+
+  using basic_node_type = BasicNode;
+  using leaf_node_type = LeafNode;
+  using inner_node_type = InnerNode;
+  using leaf_allocator_type = typename std::allocator_traits<
+      allocator_type>::template rebind_alloc<leaf_node_type>;
+  using leaf_allocator_traits = std::allocator_traits<leaf_allocator_type>;
+  using inner_allocator_type = typename std::allocator_traits<
+      allocator_type>::template rebind_alloc<inner_node_type>;
+  using inner_allocator_traits = std::allocator_traits<inner_allocator_type>;
+
+ public:
+  /*========================= Member functions ========================*/
+  Btree() = default;
+
+  explicit Btree(const allocator_type& alloc) noexcept
+      : alloc_(alloc), leaf_alloc_(alloc), inner_alloc_(alloc) {}
+
+  explicit Btree(const key_compare& compare,
+                 const allocator_type& alloc = allocator_type())
+      : alloc_(alloc),
+        leaf_alloc_(alloc),
+        inner_alloc_(alloc),
+        compare_(compare) {}
+
+  Btree(const Btree& other)
+      : Btree(other, allocator_traits::select_on_container_copy_construction(
+                         other.alloc_)) {}
+
+  Btree(const Btree& other, const allocator_type& alloc)
+      : Btree(other.compare_, alloc) {
+    for (const auto& value : other) {
+      emplace_hint_end(value.first, value);
+    }
+  }
+
+  Btree(Btree&& other) noexcept
+      : alloc_(other.alloc_),
+        leaf_alloc_(other.leaf_alloc_),
+        inner_alloc_(other.inner_alloc_),
+        compare_(std::move(other.compare_)),
+        root_(std::exchange(other.root_, nullptr)),
+        leftmost_(std::exchange(other.leftmost_, nullptr)),
+        rightmost_(std::exchange(other.rightmost_, nullptr)),
+        size_(std::exchange(other.size_, 0)) {}
+
+  /* The nodes of this allocator are freed only after the copy succeeds. */
+  Btree& operator=(const Btree& other) {
+    if (this == &other) {
+      return *this;
+    }
+    Btree copy(other,
+               allocator_traits::propagate_on_container_copy_assignment::value
+                   ? other.alloc_
+                   : alloc_);
+    clear();
+    compare_ = copy.compare_;
+    if constexpr (allocator_traits::propagate_on_container_copy_assignment::
+                      value) {
+      take_allocators(copy);
+    }
+    take(copy);
+    return *this;
+  }
+
+  /*
+   * The nodes change hands when the allocators allow it, otherwise the
+   * values are moved into nodes of this allocator.
+   */
+  Btree& operator=(Btree&& other) noexcept(
+      allocator_traits::propagate_on_container_move_assignment::value ||
+      allocator_traits::is_always_equal::value) {
+    if (this == &other) {
+      return *this;
+    }
+    clear();
+    compare_ = other.compare_;
+    if constexpr (allocator_traits::propagate_on_container_move_assignment::
+                      value) {
+      take_allocators(other);
+    } else if (alloc_ != other.alloc_) {
+      for (auto& value : other) {
+        emplace_hint_end(value.first, std::move(value));
+      }
+      other.clear();
+      return *this;
+    }
+    take(other);
+    return *this;
+  }
+
+  ~Btree() { clear(); }
+
+  allocator_type get_allocator() const noexcept { return alloc_; }
+
+  /*========================== Element access =========================*/
+  mapped_type& operator[](const key_type& key) {
+    return try_emplace(key).first->second;
+  }
+
+  mapped_type& at(const key_type& key) {
+    auto found = find(key);
+    if (found == end()) {
+      throw std::out_of_range(kOutOfRange);
+    }
+    return found->second;
+  }
+
+  const mapped_type& at(const key_type& key) const {
+    return const_cast<Btree*>(this)->at(key);
+  }
+
+  /*============================ Iterators ============================*/
+  iterator begin() noexcept { return {leftmost_, 0}; }
+
+  const_iterator begin() const noexcept {
+    return const_cast<Btree*>(this)->begin();
+  }
+
+  const_iterator cbegin() const noexcept { return begin(); }
+
+  iterator end() noexcept {
+    return {rightmost_, rightmost_ == nullptr ? 0 : rightmost_->count};
+  }
+
+  const_iterator end() const noexcept {
+    return const_cast<Btree*>(this)->end();
+  }
+
+  const_iterator cend() const noexcept { return end(); }
+
+  reverse_iterator rbegin() noexcept { return reverse_iterator(end()); }
+
+  const_reverse_iterator rbegin() const noexcept {
+    return const_reverse_iterator(end());
+  }
+
+  const_reverse_iterator crbegin() const noexcept { return rbegin(); }
+
+  reverse_iterator rend() noexcept { return reverse_iterator(begin()); }
+
+  const_reverse_iterator rend() const noexcept {
+    return const_reverse_iterator(begin());
+  }
+
+  const_reverse_iterator crend() const noexcept { return rend(); }
+
+  /*============================ Capacity =============================*/
+  bool empty() const noexcept { return size_ == 0; }
+
+  size_type size() const noexcept { return size_; }
+
+  size_type max_size() const noexcept {
+    return std::numeric_limits<size_type>::max();
+  }
+
+  /*============================ Modifiers ============================*/
+  void clear() noexcept {
+    if (root_ != nullptr) {
+      destroy_subtree(root_);
+    }
+    root_ = nullptr;
+    leftmost_ = rightmost_ = nullptr;
+    size_ = 0;
+  }
+
+  iterator erase(const_iterator pos) { return erase_at(pos.leaf_, pos.index_); }
+
+  iterator erase(const_iterator first, const_iterator last) {
+    if (last == end()) {
+      while (first != end()) {
+        first = erase(first);
+      }
+      return end();
+    }
+    const key_type last_key = last->first;
+    while (less(first->first, last_key)) {
+      first = erase(first);
+    }
+    return first;
+  }
+
+  size_type erase(const key_type& key) {
+    auto pos = find(key);
+    if (pos == end()) {
+      return 0;
+    }
+    erase(pos);
+    return 1;
+  }
+
+  std::pair<iterator, bool> insert(const value_type& value) {
+    return emplace_unique(value.first, value);
+  }
+
+  template <class P>
+  std::pair<iterator, bool> insert(P&& value) {
+    return emplace(std::forward<P>(value));
+  }
+
+  std::pair<iterator, bool> insert(value_type&& value) {
+    return emplace_unique(value.first,
+                          std::move(const_cast<key_type&>(value.first)),
+                          std::move(value.second));
+  }
+
+  template <class... Args>
+  std::pair<iterator, bool> emplace(Args&&... args) {
+    value_type value(std::forward<Args>(args)...);
+    return insert(std::move(value));
+  }
+
+  template <class... Args>
+  std::pair<iterator, bool> try_emplace(const key_type& k, Args&&... args) {
+    return emplace_unique(k, std::piecewise_construct, std::forward_as_tuple(k),
+                          std::forward_as_tuple(std::forward<Args>(args)...));
+  }
+
+  /*============================== Lookup =============================*/
+  iterator lower_bound(const key_type& key) {
+    if (root_ == nullptr) {
+      return end();
+    }
+    leaf_node_type* leaf = descend(key);
+    return normalize(leaf, lower_index(leaf, key));
+  }
+
+  iterator upper_bound(const key_type& key) {
+    if (root_ == nullptr) {
+      return end();
+    }
+    leaf_node_type* leaf = descend(key);
+    return normalize(leaf, upper_index(leaf, key));
+  }
+
+  iterator find(const key_type& key) {
+    if (root_ == nullptr) {
+      return end();
+    }
+    leaf_node_type* leaf = descend(key);
+    const std::size_t index = lower_index(leaf, key);
+    if (index == leaf->count || less(key, leaf->slot(index)->first)) {
+      return end();
+    }
+    return {leaf, index};
+  }
+
+  const_iterator upper_bound(const key_type& key) const {
+    return const_cast<Btree*>(this)->upper_bound(key);
+  }
+
+  const_iterator lower_bound(const key_type& key) const {
+    return const_cast<Btree*>(this)->lower_bound(key);
+  }
+
+  const_iterator find(const key_type& key) const {
+    return const_cast<Btree*>(this)->find(key);
+  }
+
+  bool contains(const key_type& key) const { return find(key) != end(); }
+
+  size_type count(const key_type& key) const {
+    return static_cast<size_type>(contains(key));
+  }
+
+  std::pair<iterator, iterator> equal_range(const key_type& key) {
+    return {lower_bound(key), upper_bound(key)};
+  }
+
+  std::pair<const_iterator, const_iterator> equal_range(
+      const key_type& key) const {
+    return const_cast<Btree*>(this)->equal_range(key);
+  }
+
+  /*============================ Observers ============================*/
+  key_compare key_comp() const noexcept { return compare_; }
+
+  /*====================== Non-member functions =======================*/
+  /* Keys by equivalence and mapped values by ==, as RBtree does. */
+  friend bool operator==(const Btree& lhs, const Btree& rhs) {
+    if (lhs.size() != rhs.size()) {
+      return false;
+    }
+    return std::equal(
+        lhs.begin(), lhs.end(), rhs.begin(),
+        [&](const auto& l, const auto& r) {
+          if (lhs.less(l.first, r.first) ||
+              lhs.less(r.first, l.first)) {
+            return false;
+          }
+          return l.second == r.second;
+        });
+  }
+
+  /* Keys first, mapped values break the ties as in std::map. */
+  friend auto operator<=>(const Btree& lhs, const Btree& rhs) {
+    const auto compare_pred = [&](const auto& l,
+                                  const auto& r) -> std::weak_ordering {
+      if (lhs.less(l.first, r.first)) {
+        return std::weak_ordering::less;
+      }
+      if (lhs.less(r.first, l.first)) {
+        return std::weak_ordering::greater;
+      }
+      return std::compare_weak_order_fallback(l.second, r.second);
+    };
+    return std::lexicographical_compare_three_way(
+        lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), compare_pred);
+  }
+
+  /* As for the standard containers, unequal allocators must propagate. */
+  friend void swap(Btree& lhs, Btree& rhs) noexcept {
+    using std::swap;
+    if constexpr (allocator_traits::propagate_on_container_swap::value) {
+      swap(lhs.alloc_, rhs.alloc_);
+      swap(lhs.leaf_alloc_, rhs.leaf_alloc_);
+      swap(lhs.inner_alloc_, rhs.inner_alloc_);
+    } else {
+      RBTREE_CHECK(lhs.alloc_ == rhs.alloc_);
+    }
+    swap(lhs.compare_, rhs.compare_);
+    swap(lhs.root_, rhs.root_);
+    swap(lhs.leftmost_, rhs.leftmost_);
+    swap(lhs.rightmost_, rhs.rightmost_);
+    swap(lhs.size_, rhs.size_);
+  }
+
+  template <typename Pred>
+  requires std::is_nothrow_invocable_r_v<bool, Pred,
+                                         typename Btree::value_type>
+      size_type erase_if(Pred pred) {
+    Btree::size_type result = 0;
+    iterator current = begin();
+    while (current != end()) {
+      if (pred(*current)) {
+        current = erase(current);
+        ++result;
+      } else {
+        ++current;
+      }
+    }
+    return result;
+  }
+
+ private:
+  /*============================= Lookup ==============================*/
+  leaf_node_type* descend(const key_type& key) const noexcept {
+    basic_node_type* node = root_;
+    while (!node->leaf) {
+      auto* inner = static_cast<inner_node_type*>(node);
+      node = inner->children[upper_index(inner, key)];
+    }
+    return static_cast<leaf_node_type*>(node);
+  }
+
+  /* Binary search over the keys of a node, first index where pred fails. */
+  template <typename Node, typename Pred>
+  static std::size_t partition_index(Node* node, Pred pred) {
+    std::size_t first = 0;
+    std::size_t length = node->count;
+    while (length > 0) {
+      const std::size_t half = length / 2;
+      if (pred(node_key(node, first + half))) {
+        first += half + 1;
+        length -= half + 1;
+      } else {
+        length = half;
+      }
+    }
+    return first;
+  }
+
+  template <typename Node>
+  std::size_t lower_index(Node* node, const key_type& key) const {
+    if constexpr (kSimdSearch) {
+      return count_below<false>(node, key);
+    } else {
+      return partition_index(
+          node, [&](const key_type& other) { return less(other, key); });
+    }
+  }
+
+  template <typename Node>
+  std::size_t upper_index(Node* node, const key_type& key) const {
+    if constexpr (kSimdSearch) {
+      return count_below<true>(node, key);
+    } else {
+      return partition_index(
+          node, [&](const key_type& other) { return !less(key, other); });
+    }
+  }
+
+  /*
+   * Arithmetic keys: separators are contiguous and get vector compares, the
+   * keys of a leaf are interleaved with the mapped values and get a
+   * branchless scan.
+   */
+  template <bool Inclusive>
+  static std::size_t count_below(inner_node_type* inner, key_type key) {
+    return count_keys_below<Inclusive>(inner->key(0), inner->count, key);
+  }
+
+  template <bool Inclusive>
+  static std::size_t count_below(leaf_node_type* leaf, key_type key) {
+    std::size_t result = 0;
+    for (std::size_t i = 0; i < leaf->count; ++i) {
+      if constexpr (Inclusive) {
+        result += !(key < leaf->slot(i)->first) ? 1U : 0U;
+      } else {
+        result += leaf->slot(i)->first < key ? 1U : 0U;
+      }
+    }
+    return result;
+  }
+
+  static const key_type& node_key(leaf_node_type* leaf, std::size_t index) {
+    return leaf->slot(index)->first;
+  }
+
+  static const key_type& node_key(inner_node_type* inner, std::size_t index) {
+    return *inner->key(index);
+  }
+
+  /* The end of a leaf is the beginning of the next one. */
+  static iterator normalize(leaf_node_type* leaf, std::size_t index) noexcept {
+    if (index == leaf->count && leaf->next != nullptr) {
+      return {leaf->next, 0};
+    }
+    return {leaf, index};
+  }
+
+  /*============================= Insert ==============================*/
+  template <class... Args>
+  std::pair<iterator, bool> emplace_unique(const key_type& key,
+                                           Args&&... args) {
+    if (root_ == nullptr) {
+      root_ = leftmost_ = rightmost_ = create_leaf();
+    }
+    leaf_node_type* leaf = descend(key);
+    std::size_t index = lower_index(leaf, key);
+    if (index != leaf->count && !less(key, leaf->slot(index)->first)) {
+      return {iterator(leaf, index), false};
+    }
+    return {insert_at(leaf, index, key, std::forward<Args>(args)...), true};
+  }
+
+  /* Appends a value known to be greater than every element. */
+  template <class... Args>
+  void emplace_hint_end(const key_type& key, Args&&... args) {
+    if (root_ == nullptr) {
+      root_ = leftmost_ = rightmost_ = create_leaf();
+    }
+    RBTREE_CHECK(empty() || less(std::prev(end())->first, key));
+    insert_at(rightmost_, rightmost_->count, key, std::forward<Args>(args)...);
+  }
+
+  template <class... Args>
+  iterator insert_at(leaf_node_type* leaf, std::size_t index,
+                     const key_type& key, Args&&... args) {
+    if (leaf->count == kLeafSlots) {
+      leaf_node_type* right = split_leaf(leaf, index, key);
+      if (index > leaf->count || leaf->count == kLeafSlots) {
+        index -= leaf->count;
+        leaf = right;
+      }
+    }
+    relocate(leaf->slot(index + 1), leaf->slot(index), leaf->count - index);
+    try {
+      allocator_traits::construct(alloc_, leaf->slot(index),
+                                  std::forward<Args>(args)...);
+    } catch (...) {
+      relocate(leaf->slot(index), leaf->slot(index + 1), leaf->count - index);
+      throw;
+    }
+    ++leaf->count;
+    ++size_;
+    return {leaf, index};
+  }
+
+  /*
+   * Splits in half, except when appending at the right edge: then the new
+   * right node starts empty and the key being appended separates the two, so
+   * ascending inserts leave full nodes behind.
+   */
+  leaf_node_type* split_leaf(leaf_node_type* leaf, std::size_t index,
+                             const key_type& key) {
+    const bool append = leaf == rightmost_ && index == kLeafSlots;
+    const std::size_t keep = append ? kLeafSlots : kLeafSlots / 2;
+    leaf_node_type* right = create_leaf();
+    relocate(right->slot(0), leaf->slot(keep), leaf->count - keep);
+    right->count = static_cast<std::uint32_t>(leaf->count - keep);
+    leaf->count = static_cast<std::uint32_t>(keep);
+
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next != nullptr) {
+      leaf->next->prev = right;
+    } else {
+      rightmost_ = right;
+    }
+    leaf->next = right;
+
+    insert_into_parent(leaf, append ? key : right->slot(0)->first, right);
+    return right;
+  }
+
+  /* Links right after left under a separator, splitting full parents. */
+  void insert_into_parent(basic_node_type* left, const key_type& separator,
+                          basic_node_type* right) {
+    inner_node_type* parent = left->parent;
+    if (parent == nullptr) {
+      parent = create_inner();
+      parent->children[0] = left;
+      left->parent = parent;
+      root_ = parent;
+    }
+    std::size_t index = child_index(parent, left);
+    if (parent->count == kInnerSlots) {
+      inner_node_type* sibling = split_inner(parent, index);
+      if (index > parent->count) {
+        index -= parent->count + 1;
+        parent = sibling;
+      }
+    }
+    relocate(parent->key(index + 1), parent->key(index), parent->count - index);
+    std::copy_backward(parent->children + index + 1,
+                       parent->children + parent->count + 1,
+                       parent->children + parent->count + 2);
+    std::construct_at(parent->key(index), separator);
+    parent->children[index + 1] = right;
+    right->parent = parent;
+    ++parent->count;
+  }
+
+  /*
+   * Moves the upper half out and hands the middle key to the parent. Biased
+   * like split_leaf when the new child goes to the end of the right spine.
+   */
+  inner_node_type* split_inner(inner_node_type* node, std::size_t index) {
+    const std::size_t keep = index == kInnerSlots && is_right_spine(node)
+                                 ? kInnerSlots - 1
+                                 : kInnerSlots / 2;
+    inner_node_type* right = create_inner();
+    const std::size_t moved = node->count - keep - 1;
+    relocate(right->key(0), node->key(keep + 1), moved);
+    std::copy(node->children + keep + 1, node->children + node->count + 1,
+              right->children);
+    for (std::size_t i = 0; i <= moved; ++i) {
+      right->children[i]->parent = right;
+    }
+    right->count = static_cast<std::uint32_t>(moved);
+    node->count = static_cast<std::uint32_t>(keep);
+
+    const key_type separator = std::move(*node->key(keep));
+    std::destroy_at(node->key(keep));
+    insert_into_parent(node, separator, right);
+    return right;
+  }
+
+  bool is_right_spine(basic_node_type* node) const noexcept {
+    for (basic_node_type* current = rightmost_; current != nullptr;
+         current = current->parent) {
+      if (current == node) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static std::size_t child_index(inner_node_type* parent,
+                                 basic_node_type* child) noexcept {
+    std::size_t index = 0;
+    while (parent->children[index] != child) {
+      ++index;
+    }
+    return index;
+  }
+
+  /*============================== Erase ==============================*/
+  iterator erase_at(leaf_node_type* leaf, std::size_t index) {
+    allocator_traits::destroy(alloc_, leaf->slot(index));
+    relocate(leaf->slot(index), leaf->slot(index + 1),
+             leaf->count - index - 1);
+    --leaf->count;
+    --size_;
+
+    if (leaf == root_) {
+      if (leaf->count == 0) {
+        destroy_leaf(leaf);
+        root_ = leftmost_ = rightmost_ = nullptr;
+        return end();
+      }
+      return {leaf, index};
+    }
+    if (leaf->count >= kMinLeafSlots) {
+      return normalize(leaf, index);
+    }
+    /* Rebalancing moves elements, so find the next one again by its key. */
+    if (index == leaf->count && leaf->next == nullptr) {
+      rebalance_leaf(leaf);
+      return end();
+    }
+    const iterator next = normalize(leaf, index);
+    const key_type next_key = next->first;
+    rebalance_leaf(leaf);
+    return lower_bound(next_key);
+  }
+
+  void rebalance_leaf(leaf_node_type* leaf) {
+    inner_node_type* parent = leaf->parent;
+    const std::size_t index = child_index(parent, leaf);
+    auto* left = index > 0 ? static_cast<leaf_node_type*>(
+                                 parent->children[index - 1])
+                           : nullptr;
+    auto* right = index < parent->count ? static_cast<leaf_node_type*>(
+                                              parent->children[index + 1])
+                                        : nullptr;
+
+    if (left != nullptr && left->count > kMinLeafSlots) {
+      relocate(leaf->slot(1), leaf->slot(0), leaf->count);
+      relocate(leaf->slot(0), left->slot(left->count - 1), 1);
+      --left->count;
+      ++leaf->count;
+      *parent->key(index - 1) = leaf->slot(0)->first;
+      return;
+    }
+    if (right != nullptr && right->count > kMinLeafSlots) {
+      relocate(leaf->slot(leaf->count), right->slot(0), 1);
+      relocate(right->slot(0), right->slot(1), right->count - 1U);
+      --right->count;
+      ++leaf->count;
+      *parent->key(index) = right->slot(0)->first;
+      return;
+    }
+    if (left != nullptr) {
+      merge_leaves(left, leaf, index - 1);
+    } else {
+      merge_leaves(leaf, right, index);
+    }
+  }
+
+  void merge_leaves(leaf_node_type* left, leaf_node_type* right,
+                    std::size_t separator) {
+    relocate(left->slot(left->count), right->slot(0), right->count);
+    left->count = static_cast<std::uint32_t>(left->count + right->count);
+    left->next = right->next;
+    if (right->next != nullptr) {
+      right->next->prev = left;
+    } else {
+      rightmost_ = left;
+    }
+    right->count = 0;
+    destroy_leaf(right);
+    remove_from_inner(left->parent, separator);
+  }
+
+  /* Removes the separator and the child to its right. */
+  void remove_from_inner(inner_node_type* node, std::size_t separator) {
+    std::destroy_at(node->key(separator));
+    relocate(node->key(separator), node->key(separator + 1),
+             node->count - separator - 1);
+    std::copy(node->children + separator + 2,
+              node->children + node->count + 1,
+              node->children + separator + 1);
+    --node->count;
+
+    if (node == root_) {
+      if (node->count == 0) {
+        root_ = node->children[0];
+        root_->parent = nullptr;
+        destroy_inner(node);
+      }
+      return;
+    }
+    if (node->count < kMinInnerSlots) {
+      rebalance_inner(node);
+    }
+  }
+
+  void rebalance_inner(inner_node_type* node) {
+    inner_node_type* parent = node->parent;
+    const std::size_t index = child_index(parent, node);
+    auto* left = index > 0 ? static_cast<inner_node_type*>(
+                                 parent->children[index - 1])
+                           : nullptr;
+    auto* right = index < parent->count ? static_cast<inner_node_type*>(
+                                              parent->children[index + 1])
+                                        : nullptr;
+
+    if (left != nullptr && left->count > kMinInnerSlots) {
+      relocate(node->key(1), node->key(0), node->count);
+      std::copy_backward(node->children, node->children + node->count + 1,
+                         node->children + node->count + 2);
+      relocate(node->key(0), parent->key(index - 1), 1);
+      relocate(parent->key(index - 1), left->key(left->count - 1), 1);
+      node->children[0] = left->children[left->count];
+      node->children[0]->parent = node;
+      --left->count;
+      ++node->count;
+      return;
+    }
+    if (right != nullptr && right->count > kMinInnerSlots) {
+      relocate(node->key(node->count), parent->key(index), 1);
+      relocate(parent->key(index), right->key(0), 1);
+      node->children[node->count + 1] = right->children[0];
+      node->children[node->count + 1]->parent = node;
+      relocate(right->key(0), right->key(1), right->count - 1U);
+      std::copy(right->children + 1, right->children + right->count + 1,
+                right->children);
+      --right->count;
+      ++node->count;
+      return;
+    }
+    if (left != nullptr) {
+      merge_inner(left, node, index - 1);
+    } else {
+      merge_inner(node, right, index);
+    }
+  }
+
+  void merge_inner(inner_node_type* left, inner_node_type* right,
+                   std::size_t separator) {
+    inner_node_type* parent = left->parent;
+    std::construct_at(left->key(left->count),
+                      std::move(*parent->key(separator)));
+    relocate(left->key(left->count + 1), right->key(0), right->count);
+    std::copy(right->children, right->children + right->count + 1,
+              left->children + left->count + 1);
+    for (std::size_t i = 0; i <= right->count; ++i) {
+      right->children[i]->parent = left;
+    }
+    left->count = static_cast<std::uint32_t>(left->count + right->count + 1);
+    right->count = 0;
+    destroy_inner(right);
+    remove_from_inner(parent, separator);
+  }
+
+  /*=========================== Memory ================================*/
+  /*
+   * Moves count objects from src into the uninitialized dst, which may
+   * overlap it, leaving src uninitialized.
+   */
+  template <typename Object>
+  void relocate(Object* dst, Object* src, std::size_t count) noexcept {
+    if (count == 0 || dst == src) {
+      return;
+    }
+    if constexpr (is_trivially_relocatable<Object>()) {
+      std::memmove(static_cast<void*>(dst), static_cast<const void*>(src),
+                   count * sizeof(Object));
+    } else if (dst < src) {
+      for (std::size_t i = 0; i < count; ++i) {
+        relocate_one(dst + i, src + i);
+      }
+    } else {
+      for (std::size_t i = count; i > 0; --i) {
+        relocate_one(dst + i - 1, src + i - 1);
+      }
+    }
+  }
+
+  template <typename Object>
+  static constexpr bool is_trivially_relocatable() noexcept {
+    if constexpr (std::is_same_v<Object, value_type>) {
+      return std::is_trivially_copyable_v<key_type> &&
+             std::is_trivially_copyable_v<mapped_type>;
+    } else {
+      return std::is_trivially_copyable_v<Object>;
+    }
+  }
+
+  void relocate_one(value_type* dst, value_type* src) noexcept {
+    allocator_traits::construct(alloc_, dst,
+                                std::move(const_cast<key_type&>(src->first)),
+                                std::move(src->second));
+    allocator_traits::destroy(alloc_, src);
+  }
+
+  void relocate_one(key_type* dst, key_type* src) noexcept {
+    std::construct_at(dst, std::move(*src));
+    std::destroy_at(src);
+  }
+
+  leaf_node_type* create_leaf() {
+    leaf_node_type* leaf = leaf_allocator_traits::allocate(leaf_alloc_, 1);
+    std::construct_at(leaf);
+    leaf->leaf = true;
+    return leaf;
+  }
+
+  inner_node_type* create_inner() {
+    inner_node_type* inner = inner_allocator_traits::allocate(inner_alloc_, 1);
+    std::construct_at(inner);
+    return inner;
+  }
+
+  void destroy_leaf(leaf_node_type* leaf) noexcept {
+    std::destroy_at(leaf);
+    leaf_allocator_traits::deallocate(leaf_alloc_, leaf, 1);
+  }
+
+  void destroy_inner(inner_node_type* inner) noexcept {
+    std::destroy_at(inner);
+    inner_allocator_traits::deallocate(inner_alloc_, inner, 1);
+  }
+
+  void destroy_subtree(basic_node_type* node) noexcept {
+    if (node->leaf) {
+      auto* leaf = static_cast<leaf_node_type*>(node);
+      for (std::size_t i = 0; i < leaf->count; ++i) {
+        allocator_traits::destroy(alloc_, leaf->slot(i));
+      }
+      destroy_leaf(leaf);
+      return;
+    }
+    auto* inner = static_cast<inner_node_type*>(node);
+    for (std::size_t i = 0; i <= inner->count; ++i) {
+      destroy_subtree(inner->children[i]);
+    }
+    std::destroy_n(inner->key(0), inner->count);
+    destroy_inner(inner);
+  }
+
+  bool less(const key_type& lhs, const key_type& rhs) const {
+    return compare_(lhs, rhs);
+  }
+
+  /* Adopts the nodes of other, this tree must be empty. */
+  void take(Btree& other) noexcept {
+    RBTREE_CHECK(root_ == nullptr);
+    root_ = std::exchange(other.root_, nullptr);
+    leftmost_ = std::exchange(other.leftmost_, nullptr);
+    rightmost_ = std::exchange(other.rightmost_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+  }
+
+  void take_allocators(Btree& other) noexcept {
+    alloc_ = std::move(other.alloc_);
+    leaf_alloc_ = std::move(other.leaf_alloc_);
+    inner_alloc_ = std::move(other.inner_alloc_);
+  }
+
+  [[no_unique_address]] allocator_type alloc_{};
+  [[no_unique_address]] leaf_allocator_type leaf_alloc_{};
+  [[no_unique_address]] inner_allocator_type inner_alloc_{};
+
+  key_compare compare_{};
+  basic_node_type* root_{};
+  leaf_node_type* leftmost_{};
+  leaf_node_type* rightmost_{};
+  size_type size_{};
+};
+
+template <class Key, class T, class Compare, class Allocator>
+template <bool IsConst>
+class Btree<Key, T, Compare, Allocator>::Iterator {
+  /*======================== Usings and Structures =========================*/
+  using btree = Btree<Key, T, Compare, Allocator>;
+  using leaf_node_type = btree::leaf_node_type;
+
+ public:
+  using difference_type = ptrdiff_t;
+  using iterator_category = std::bidirectional_iterator_tag;
+  using value_type = btree::value_type;
+  using pointer = std::conditional_t<IsConst, const value_type*, value_type*>;
+  using reference = std::conditional_t<IsConst, const value_type&, value_type&>;
+
+  /*============================ Constructors ==============================*/
+  Iterator() = default;
+
+  Iterator(leaf_node_type* leaf, std::size_t index)
+      : leaf_(leaf), index_(index) {}
+
+  /*============================== Operators ===============================*/
+  Iterator& operator++() {
+    if (++index_ == leaf_->count && leaf_->next != nullptr) {
+      leaf_ = leaf_->next;
+      index_ = 0;
+    }
+    return *this;
+  }
+
+  Iterator& operator--() {
+    if (index_ == 0) {
+      leaf_ = leaf_->prev;
+      index_ = leaf_->count;
+    }
+    --index_;
+    return *this;
+  }
+
+  Iterator operator++(int) {
+    Iterator result = *this;
+    ++*this;
+    return result;
+  }
+
+  Iterator operator--(int) {
+    Iterator result = *this;
+    --*this;
+    return result;
+  }
+
+  reference operator*() const { return *leaf_->slot(index_); }
+
+  pointer operator->() const { return leaf_->slot(index_); }
+
+  bool operator==(const Iterator& other) const {
+    return leaf_ == other.leaf_ && index_ == other.index_;
+  }
+
+  bool operator!=(const Iterator& other) const { return !(*this == other); }
+
+  operator Iterator<true>() const { return Iterator<true>(leaf_, index_); }
+
+ private:
+  friend Btree;
+
+  operator Iterator<false>() const { return Iterator<false>(leaf_, index_); }
+
+  /*================================ Fields ================================*/
+  leaf_node_type* leaf_{nullptr};
+  std::size_t index_{0};
+};
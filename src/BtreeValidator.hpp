@@ -0,0 +1,109 @@
+#pragma once
+#include <cstddef>
+
+#include "Btree.hpp"
+
+/*
+ * Checks every invariant of a Btree in a single O(n) pass: parent links,
+ * key order inside nodes and against the separators, equal leaf depth,
+ * occupancy, the leaf list with both ends, and the cached size. Nodes on
+ * the right spine may be underfull, see Btree::split_leaf.
+ */
+template <class Key, class T, class Compare, class Allocator>
+class BtreeValidator {
+ public:
+  using tree_type = Btree<Key, T, Compare, Allocator>;
+
+  explicit BtreeValidator(tree_type& tree) : tree_(tree) {}
+
+  bool is_valid() {
+    if (tree_.root_ == nullptr) {
+      return tree_.size_ == 0 && tree_.leftmost_ == nullptr &&
+             tree_.rightmost_ == nullptr;
+    }
+    if (tree_.root_->parent != nullptr) {
+      return false;
+    }
+    leaf_depth_ = kUnknownDepth;
+    previous_leaf_ = nullptr;
+    elements_ = 0;
+    return check_subtree(tree_.root_, nullptr, nullptr, 0, true) &&
+           previous_leaf_ == tree_.rightmost_ &&
+           previous_leaf_->next == nullptr && elements_ == tree_.size_;
+  }
+
+ private:
+  using key_type = tree_type::key_type;
+  using basic_node_type = tree_type::basic_node_type;
+  using leaf_node_type = tree_type::leaf_node_type;
+  using inner_node_type = tree_type::inner_node_type;
+
+  static constexpr std::size_t kUnknownDepth = ~std::size_t{0};
+
+  /* Keys of the subtree must lie in [low, high). */
+  bool check_subtree(basic_node_type* node, const key_type* low,
+                     const key_type* high, std::size_t depth,
+                     bool right_spine) {
+    const bool is_root = node == tree_.root_;
+    if (node->leaf) {
+      auto* leaf = static_cast<leaf_node_type*>(node);
+      const bool occupied =
+          is_root ? leaf->count > 0
+                  : right_spine || leaf->count >= tree_type::kMinLeafSlots;
+      if (!occupied || leaf->count > tree_type::kLeafSlots ||
+          !is_sorted(leaf, low, high) || leaf->prev != previous_leaf_ ||
+          (previous_leaf_ == nullptr && leaf != tree_.leftmost_) ||
+          (previous_leaf_ != nullptr && previous_leaf_->next != leaf)) {
+        return false;
+      }
+      if (leaf_depth_ == kUnknownDepth) {
+        leaf_depth_ = depth;
+      }
+      previous_leaf_ = leaf;
+      elements_ += leaf->count;
+      return depth == leaf_depth_;
+    }
+
+    auto* inner = static_cast<inner_node_type*>(node);
+    const bool occupied =
+        is_root ? inner->count > 0
+                : right_spine || inner->count >= tree_type::kMinInnerSlots;
+    if (!occupied || inner->count > tree_type::kInnerSlots ||
+        !is_sorted(inner, low, high)) {
+      return false;
+    }
+    for (std::size_t i = 0; i <= inner->count; ++i) {
+      basic_node_type* child = inner->children[i];
+      const key_type* child_low = i == 0 ? low : inner->key(i - 1);
+      const key_type* child_high = i == inner->count ? high : inner->key(i);
+      if (child->parent != inner ||
+          !check_subtree(child, child_low, child_high, depth + 1,
+                         right_spine && i == inner->count)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  template <typename Node>
+  bool is_sorted(Node* node, const key_type* low, const key_type* high) {
+    for (std::size_t i = 0; i < node->count; ++i) {
+      const key_type& key = tree_type::node_key(node, i);
+      if ((low != nullptr && tree_.less(key, *low)) ||
+          (high != nullptr && !tree_.less(key, *high)) ||
+          (i > 0 && !tree_.less(tree_type::node_key(node, i - 1), key))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  tree_type& tree_;
+  std::size_t leaf_depth_{kUnknownDepth};
+  leaf_node_type* previous_leaf_{};
+  std::size_t elements_{};
+};
+
+template <class Key, class T, class Compare, class Allocator>
+BtreeValidator(Btree<Key, T, Compare, Allocator>&)
+    -> BtreeValidator<Key, T, Compare, Allocator>;
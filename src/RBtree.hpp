@@ -1,24 +1,102 @@
 #pragma once
 
-#define DEBUG_
-
 #include <algorithm>
-#include <cassert>
+#include <bit>
+#include <compare>
+#include <concepts>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <istream>
 #include <iterator>
 #include <limits>
 #include <memory>
+#include <memory_resource>
+#include <ostream>
+#include <span>
+#include <stdexcept>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "PropagateAssignmentTraits.hpp"
+#include "RBtreeChecks.hpp"
+#include "RBtreePolicies.hpp"
+#include "RBtreeKeySearch.hpp"
+#include "RBtreeSerialization.hpp"
+#include "RBtreeStats.hpp"
+
+/* Comparators that return an ordering instead of a bool. */
+template <typename Compare, typename Key>
+concept three_way_key_compare =
+    requires(const Compare& compare, const Key& lhs, const Key& rhs) {
+  { compare(lhs, rhs) } -> std::convertible_to<std::weak_ordering>;
+};
+
+/*
+ * std::less over a class type with a consistent operator<=>, e.g.
+ * std::string: one three-way call costs as much as one operator<.
+ */
+template <typename Compare, typename Key>
+concept less_over_three_way =
+    (std::same_as<Compare, std::less<Key>> ||
+     std::same_as<Compare, std::less<>>)&&!std::is_scalar_v<Key> &&
+    std::three_way_comparable<Key, std::weak_ordering>;
+
+/*
+ * Whether deallocate() of the allocator does nothing, as with a monotonic
+ * buffer, so that a dying tree may leave its nodes where they are. Other
+ * allocators can overload it next to their type.
+ */
+template <typename Alloc>
+bool rbtree_deallocation_is_noop(const Alloc& /*unused*/) noexcept {
+  return false;
+}
+
+template <typename Value>
+bool rbtree_deallocation_is_noop(
+    const std::pmr::polymorphic_allocator<Value>& alloc) noexcept {
+  return dynamic_cast<std::pmr::monotonic_buffer_resource*>(
+             alloc.resource()) != nullptr;
+}
+
+/* Node placement left behind by RBtree::compact. */
+enum class rbtree_layout {
+  /* Neighbours in key order are neighbours in memory: the fastest scans. */
+  kInOrder,
+  /*
+   * van Emde Boas: the top half of the levels first, then every subtree
+   * below it, recursively, so a lookup reads O(log_B n) cache lines for any
+   * line size B.
+   */
+  kVanEmdeBoas,
+};
 
+template <class Key, class T, class Compare, class Allocator, class Policy>
+class RBtreeValidator;
+
+/*
+ * With T = void the tree is a set, see RBset: a node holds the key alone,
+ * iterators are const and the element access by key is gone. Under
+ * rbtree_multi_policy equal keys are kept, see RBMultimap.
+ */
 template <class Key, class T, class Compare = std::less<Key>,
-          class Allocator = std::allocator<std::pair<const Key, T>>>
+          class Allocator = std::allocator<std::pair<const Key, T>>,
+          class Policy = rbtree_default_policy>
 class RBtree {
+  static_assert(!std::is_same_v<Policy, rbtree_arena_policy>,
+                "rbtree_arena_policy needs RBtreeArena.hpp");
+
+  static constexpr bool kSetMode = std::is_void_v<T>;
+  static constexpr bool kMultiKeys = Policy::kMultiKeys;
+
   static constexpr const char* kBadEmplaceMessage = "Bad Emplace";
   static constexpr const char* kOutOfRange = "Missing element";
+  static constexpr const char* kBadStream = "Bad serialized stream";
+  static constexpr const char* kUnsortedStream = "Unsorted serialized stream";
+
+  /* insert_sorted_batch merges batches this many times the tree's size. */
+  static constexpr std::size_t kMergeBatchRatio = 1;
 
   template <bool IsConst>
   class Iterator;
@@ -26,7 +104,8 @@ class RBtree {
  public:
   using key_type = Key;
   using mapped_type = T;
-  using value_type = std::pair<const Key, T>;
+  using value_type =
+      std::conditional_t<kSetMode, Key, std::pair<const Key, T>>;
   using size_type = std::size_t;
   using difference_type = std::ptrdiff_t;
   using key_compare = Compare;
@@ -40,16 +119,74 @@ class RBtree {
   using const_iterator = Iterator<true>;
   using reverse_iterator = std::reverse_iterator<iterator>;
   using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+  using policy_type = Policy;
+  /* Multi trees always insert, so they return the iterator alone. */
+  using insert_result =
+      std::conditional_t<kMultiKeys, iterator, std::pair<iterator, bool>>;
 
-#ifdef DEBUG_
-  template <typename K, typename V, typename C, typename A>
+  template <typename K, typename V, typename C, typename A, typename P>
   friend class RBtreeFriendMediator;
-#endif
 
  private:
+  static constexpr bool kThreadedLinks = policy_type::kThreadedLinks;
+  static constexpr bool kKeyPrefixCache = policy_type::kKeyPrefixCache;
+  static constexpr bool kTopDown =
+      policy_type::kBalancing == rbtree_balancing::kTopDown;
+  static constexpr bool kAvl = policy_type::kBalancing == rbtree_balancing::kAvl;
+  static constexpr bool kWeightBalanced =
+      policy_type::kBalancing == rbtree_balancing::kWeightBalanced;
+  static constexpr bool kRedBlack = !kAvl && !kWeightBalanced;
+
+  struct NoBalance {};
+
+  /* The subtree height of an AVL node, the subtree size otherwise. */
+  using balance_type = std::conditional_t<
+      kAvl, std::uint8_t,
+      std::conditional_t<kWeightBalanced, size_type, NoBalance>>;
+
+  static_assert(!kKeyPrefixCache || prefix_cacheable_key<Compare, Key>,
+                "kKeyPrefixCache needs std::string keys under std::less");
+
+  struct NoKeyPrefix {};
+
+  using interval_end_type = typename policy_type::interval_end;
+  static constexpr bool kIntervalTree = !std::is_void_v<interval_end_type>;
+
+  struct NoMaxEnd {};
+
+  using max_end_type = std::conditional_t<kIntervalTree, key_type, NoMaxEnd>;
+
+  using content_hash_type = typename policy_type::content_hash;
+  static constexpr bool kContentDigest = !std::is_void_v<content_hash_type>;
+
+  struct NoDigest {};
+
+  using digest_type =
+      std::conditional_t<kContentDigest, std::uint64_t, NoDigest>;
+
+  using key_prefix_type =
+      std::conditional_t<kKeyPrefixCache, std::uint64_t, NoKeyPrefix>;
+
+  static key_prefix_type make_prefix(const key_type& key) noexcept {
+    if constexpr (kKeyPrefixCache) {
+      return make_key_prefix(key);
+    } else {
+      return {};
+    }
+  }
+
   struct Node;
+  struct BasicNode;
+
+  struct ThreadLinks {
+    BasicNode* prev{};
+    BasicNode* next{};
+  };
 
-  struct BasicNode {
+  struct NoThreadLinks {};
+
+  struct BasicNode
+      : std::conditional_t<kThreadedLinks, ThreadLinks, NoThreadLinks> {
     enum class Color : bool { Red, Black };
 
     static constexpr BasicNode* BasicNode::*another_direction(
@@ -61,12 +198,21 @@ class RBtree {
     BasicNode() = delete;
 
     BasicNode(BasicNode* left, BasicNode* right, BasicNode* parent, Color color,
-              bool nil_flag = true)
+              bool nil_flag = true) noexcept
         : left(left),
           right(right),
           parent(parent),
           color(color),
-          nil_flag(nil_flag) {}
+          nil_flag(nil_flag) {
+      if constexpr (!kRedBlack) {
+        balance = nil_flag ? 0U : 1U;
+      }
+      if constexpr (kThreadedLinks) {
+        if (nil_flag) {
+          this->prev = this->next = this;
+        }
+      }
+    }
 
     bool is_left() const noexcept { return parent->left == this; }
 
@@ -80,11 +226,17 @@ class RBtree {
 
     bool is_not_nil() const noexcept { return !nil_flag; }
 
-    const key_type& get_key() const noexcept { return get_value().first; }
+    const key_type& get_key() const noexcept { return key_of(get_value()); }
 
-    mapped_type& get_mapped() noexcept { return get_value().second; }
+    auto& get_mapped() noexcept
+      requires(!kSetMode)
+    {
+      return get_value().second;
+    }
 
-    const mapped_type& get_mapped() const noexcept {
+    const auto& get_mapped() const noexcept
+      requires(!kSetMode)
+    {
       return const_cast<BasicNode*>(this)->get_mapped();
     }
 
@@ -127,66 +279,133 @@ class RBtree {
     BasicNode* parent;
     Color color;
     bool nil_flag;
+    /* AVL and weight-balanced trees, 0 in the sentinel; colors go unused. */
+    [[no_unique_address]] balance_type balance;
   };
 
+  /*
+   * The value is constructed and destroyed on its own through the
+   * allocator, see construct(), so a polymorphic_allocator passes its
+   * resource on to it as std::pmr::map does.
+   */
   struct Node : BasicNode {
-    template <typename... Args>
     Node(BasicNode* left, BasicNode* right, BasicNode* parent,
-         typename BasicNode::Color color, bool nil_flag = false, Args&&... args)
-        : BasicNode(left, right, parent, color, nil_flag),
-          val(std::forward<Args>(args)...) {}
-    value_type val;
+         typename BasicNode::Color color, bool nil_flag = false)
+        : BasicNode(left, right, parent, color, nil_flag) {}
+
+    ~Node() {}
+
+    /* Next to the links, so a descent finds it on the line it reads anyway. */
+    [[no_unique_address]] key_prefix_type prefix;
+    /* Interval trees: the largest end point in the subtree. */
+    [[no_unique_address]] max_end_type max_end;
+    union {
+      value_type val;
+    };
   };
 
   using basic_node_type = BasicNode;
-  using basic_node_allocator_type = typename std::allocator_traits<
-      allocator_type>::template rebind_alloc<basic_node_type>;
-  using basic_node_allocator_traits =
-      std::allocator_traits<basic_node_allocator_type>;
 
   using node_type = Node;
   using node_allocator_type = typename std::allocator_traits<
       allocator_type>::template rebind_alloc<node_type>;
   using node_allocator_traits = std::allocator_traits<node_allocator_type>;
 
+  using value_allocator_type = typename std::allocator_traits<
+      allocator_type>::template rebind_alloc<value_type>;
+  using value_allocator_traits = std::allocator_traits<value_allocator_type>;
+
   using node_pat = propagate_assignment_traits<node_allocator_type>;
-  using basic_node_pat = propagate_assignment_traits<basic_node_allocator_type>;
 
   using Color = typename basic_node_type::Color;
 
  public:
   /*========================= Member functions ========================*/
-  RBtree() { construct_nil(); };
+  /* The sentinel is a member, so an empty tree allocates nothing. */
+  RBtree() = default;
+
+  explicit RBtree(const allocator_type& alloc) noexcept : alloc_(alloc) {}
+
+  explicit RBtree(const key_compare& compare,
+                  const allocator_type& alloc = allocator_type())
+      : alloc_(alloc), compare_(compare) {}
 
   ~RBtree() {
+    if (rbtree_deallocation_is_noop(alloc_)) {
+      /* The buffer goes away at once, only the values need to die. */
+      destroy_values(root_);
+      return;
+    }
     clear();
-    destroy_nil();
   }
 
-  /*TODO tests*/
-  RBtree(RBtree&& /*unused*/) = default;
+  /*
+   * Unlike std::map, linear in the size of other: the links to its
+   * sentinel are redirected to this one, see take().
+   */
+  RBtree(RBtree&& other) noexcept
+      : alloc_(std::move(other.alloc_)), compare_(other.compare_) {
+    take(other);
+  }
 
-  /*TODO code*/
-  RBtree(const RBtree& other);
+  /* Rebuilt from the values in order, perfectly balanced, in O(n). */
+  RBtree(const RBtree& other)
+      : alloc_(node_allocator_traits::select_on_container_copy_construction(
+            other.alloc_)),
+        compare_(other.compare_) {
+    auto next = other.begin();
+    build_sorted(other.size(),
+                 [&next]() -> const value_type& { return *next++; });
+  }
 
-  /*TODO code*/
-  RBtree& operator=(RBtree&& other);
+  /*
+   * The nodes change hands when the allocators allow it, in time linear in
+   * both sizes as for the move constructor; otherwise the values are moved
+   * into nodes of this allocator.
+   */
+  RBtree& operator=(RBtree&& other) noexcept(
+      node_allocator_traits::propagate_on_container_move_assignment::value ||
+      node_allocator_traits::is_always_equal::value) {
+    if (this == &other) {
+      return *this;
+    }
+    clear();
+    compare_ = other.compare_;
+    if constexpr (node_allocator_traits::propagate_on_container_move_assignment::
+                      value) {
+      alloc_ = std::move(other.alloc_);
+    } else if (alloc_ != other.alloc_) {
+      insert_sorted_batch(std::make_move_iterator(other.begin()),
+                          std::make_move_iterator(other.end()));
+      other.clear();
+      return *this;
+    }
+    take(other);
+    return *this;
+  }
 
  public:
-  allocator_type get_allocator() const noexcept { return allocator_type(); }
+  allocator_type get_allocator() const noexcept {
+    return allocator_type(alloc_);
+  }
 
   /*========================== Element access =========================*/
-  mapped_type& operator[](const key_type& key) {
+  /* Under kContentDigest mapped values are written by insert_or_assign. */
+  auto& operator[](const key_type& key)
+    requires(!kSetMode && !kMultiKeys && !kContentDigest)
+  {
     auto found = find(key);
     if (found != end()) {
       return found->second;
     }
     auto [emplaced, empalce_status] = emplace(key, mapped_type{});
-    assert(empalce_status == true);
+    RBTREE_CHECK(empalce_status);
     return emplaced->second;
   }
 
-  mapped_type& at(const key_type& key) {
+  auto& at(const key_type& key)
+    requires(!kSetMode && !kMultiKeys && !kContentDigest)
+  {
     auto found = find(key);
     if (found == end()) {
       throw std::out_of_range(kOutOfRange);
@@ -194,12 +413,18 @@ class RBtree {
     return found->second;
   }
 
-  const mapped_type& at(const key_type& key) const {
-    return const_cast<RBtree*>(this)->at(key);
+  const auto& at(const key_type& key) const
+    requires(!kSetMode && !kMultiKeys)
+  {
+    auto found = find(key);
+    if (found == end()) {
+      throw std::out_of_range(kOutOfRange);
+    }
+    return found->second;
   }
 
   /*============================ Iterators ============================*/
-  iterator begin() noexcept { return NIL_->right; }
+  iterator begin() noexcept { return nil()->right; }
 
   const_iterator begin() const noexcept {
     return const_cast<RBtree*>(this)->begin();
@@ -207,7 +432,7 @@ class RBtree {
 
   const_iterator cbegin() const noexcept { return begin(); }
 
-  iterator end() noexcept { return NIL_; }
+  iterator end() noexcept { return nil(); }
 
   const_iterator end() const noexcept {
     return const_cast<RBtree*>(this)->end();
@@ -216,19 +441,21 @@ class RBtree {
   const_iterator cend() const noexcept { return end(); }
 
   reverse_iterator rbegin() noexcept {
-    return std::make_reverse_iterator(begin());
+    return std::make_reverse_iterator(end());
   }
 
   const_reverse_iterator rbegin() const noexcept {
-    return std::make_reverse_iterator(begin());
+    return std::make_reverse_iterator(end());
   }
 
   const_reverse_iterator crbegin() const noexcept { return rbegin(); }
 
-  reverse_iterator rend() noexcept { return std::make_reverse_iterator(end()); }
+  reverse_iterator rend() noexcept {
+    return std::make_reverse_iterator(begin());
+  }
 
   const_reverse_iterator rend() const noexcept {
-    return std::make_reverse_iterator(end());
+    return std::make_reverse_iterator(begin());
   }
 
   const_reverse_iterator crend() const noexcept { return rend(); }
@@ -238,28 +465,54 @@ class RBtree {
 
   size_type size() const noexcept { return size_; }
 
+  /*
+   * Order-independent digest of the elements, see content_hash: equal
+   * trees have equal digests, and unequal ones almost surely do not.
+   */
+  std::uint64_t digest() const noexcept
+    requires(kContentDigest)
+  {
+    return digest_;
+  }
+
   size_type max_size() const noexcept {
     return std::numeric_limits<size_type>::max();
   }
 
   /*============================ Modifiers ============================*/
-  void clear() noexcept { erase(begin(), end()); }
+  void clear() noexcept {
+    erase(begin(), end());
+    /* Ends a running compact pass, its block is empty by now. */
+    compact_cursor_ = nullptr;
+    release_slab(slab_);
+  }
 
   iterator erase(const_iterator pos) noexcept {
     iterator next = std::next(pos);
     erase(pos.current_node_);
+    check_invariants();
     return next;
   }
 
   iterator erase(const_iterator first, const_iterator last) noexcept {
     const_iterator current = first;
     while (current != last) {
-      current = erase(current);
+      erase(std::exchange(current, std::next(current)).current_node_);
     }
+    check_invariants();
     return current;
   }
 
   size_type erase(const key_type& key) {
+    if constexpr (kMultiKeys) {
+      const size_type before = size_;
+      const auto [first, last] = equal_range(key);
+      erase(first, last);
+      return before - size_;
+    }
+    if constexpr (kTopDown) {
+      return erase_top_down(key);
+    }
     auto pos = find(key);
     if (pos == end()) {
       return 0;
@@ -268,30 +521,66 @@ class RBtree {
     return 1;
   }
 
-  std::pair<iterator, bool> insert(const value_type& value) {
-    return emplace(value);
-  }
+  insert_result insert(const value_type& value) { return emplace(value); }
 
   template <class P>
-  std::pair<iterator, bool> insert(P&& value) {
+  insert_result insert(P&& value) {
     return emplace(std::move(value));
   }
 
-  std::pair<iterator, bool> insert(value_type&& value) {
-    return emplace(std::move(const_cast<key_type&>(value.first)),
-                   std::move(value.second));
+  insert_result insert(value_type&& value) {
+    if constexpr (kSetMode) {
+      return emplace(std::move(value));
+    } else {
+      return emplace(std::move(const_cast<key_type&>(value.first)),
+                     std::move(value.second));
+    }
+  }
+
+  /*
+   * Inserts the ascending values of [first, last). Each search starts
+   * from the node the previous value went to, see lower_bound(hint, key),
+   * and each insert fixes the balance once, right there. A batch of known
+   * size at least kMergeBatchRatio times the tree's is merged with it
+   * instead, and all nodes are relinked into a balanced tree in
+   * O(n + m). With unique keys the first of equal values is kept. Returns
+   * the number of values inserted.
+   */
+  template <std::input_iterator InputIt, std::sentinel_for<InputIt> Sentinel>
+  size_type insert_sorted_batch(InputIt first, Sentinel last) {
+    if constexpr (std::forward_iterator<InputIt>) {
+      const auto count =
+          static_cast<size_type>(std::ranges::distance(first, last));
+      if (count != 0 && count >= kMergeBatchRatio * size_) {
+        return merge_sorted_batch(first, last, count);
+      }
+    }
+    const size_type before = size_;
+    basic_node_type* hint = nil();
+    for (; first != last; ++first) {
+      hint = insert_after_finger(
+          hint, create_node(nil(), nil(), nil(), Color::Red, false, *first));
+    }
+    check_invariants();
+    return size_ - before;
   }
 
   template <class... Args>
-  std::pair<iterator, bool> emplace(Args&&... args) {
-    node_type* new_node = allocate();
-    construct(new_node, NIL_, NIL_, NIL_, Color::Red, false,
-              std::forward<Args>(args)...);
-    return insert(static_cast<basic_node_type*>(new_node));
+  insert_result emplace(Args&&... args) {
+    node_type* new_node = create_node(nil(), nil(), nil(), Color::Red, false,
+                                      std::forward<Args>(args)...);
+    const auto result = insert(static_cast<basic_node_type*>(new_node));
+    if constexpr (kMultiKeys) {
+      return result.first;
+    } else {
+      return result;
+    }
   }
 
   template <class... Args>
-  std::pair<iterator, bool> try_emplace(const key_type& k, Args&&... args) {
+  std::pair<iterator, bool> try_emplace(const key_type& k, Args&&... args)
+    requires(!kSetMode && !kMultiKeys)
+  {
     auto found = find(k);
     if (found == end()) {
       return {found, false};
@@ -299,22 +588,51 @@ class RBtree {
     return emplace(k, std::forward<Args>(args)...);
   }
 
+  template <class M>
+  std::pair<iterator, bool> insert_or_assign(const key_type& key, M&& mapped)
+    requires(!kSetMode && !kMultiKeys)
+  {
+    auto found = find(key);
+    if (found == end()) {
+      return emplace(key, std::forward<M>(mapped));
+    }
+    update(found, [&](mapped_type& value) { value = std::forward<M>(mapped); });
+    return {found, false};
+  }
+
+  /*
+   * Calls updater on the mapped value at pos, and keeps the digest and the
+   * interval maxima in step with it. Should updater throw, they follow
+   * whatever it left behind.
+   */
+  template <typename Updater>
+  void update(const_iterator pos, Updater updater)
+    requires(!kSetMode)
+  {
+    basic_node_type* node = pos.current_node_;
+    remove_digest(node);
+    try {
+      updater(node->get_value().second);
+    } catch (...) {
+      add_digest(node);
+      update_max_end_upward(node);
+      throw;
+    }
+    add_digest(node);
+    update_max_end_upward(node);
+  }
+
   /*============================== Lookup =============================*/
   iterator lower_bound(const key_type& key) {
-    return bound_impl<&RBtree::compare_greater_equal>(key);
+    return bound_impl<&RBtree::compare_greater_equal>(key, root_, nil());
   }
 
   iterator upper_bound(const key_type& key) {
-    return bound_impl<&RBtree::compare_greater>(key);
+    return bound_impl<&RBtree::compare_greater>(key, root_, nil());
   }
 
-  iterator find(const key_type& key) {
-    auto found = lower_bound(key);
-    if (found == end() || !compare_equal(key, found->first)) {
-      return end();
-    }
-    return found;
-  }
+  /* With equal keys, any of them: the first one the descent meets. */
+  iterator find(const key_type& key) { return find_equal(key); }
 
   const_iterator upper_bound(const key_type& key) const {
     return const_cast<RBtree*>(this)->upper_bound(key);
@@ -328,14 +646,99 @@ class RBtree {
     return const_cast<RBtree*>(this)->find(key);
   }
 
+  /*
+   * Finger search: the descent starts at the lowest ancestor of hint whose
+   * subtree holds the result, reached by climbing from hint. That is
+   * O(log d) for a result d elements away unless the two lie on either
+   * side of a tall subtree, and never worse than O(log n). end() as the
+   * hint searches from the root.
+   */
+  iterator lower_bound(const_iterator hint, const key_type& key) {
+    return finger_lower_bound(hint.current_node_, key);
+  }
+
+  const_iterator lower_bound(const_iterator hint, const key_type& key) const {
+    return const_cast<RBtree*>(this)->lower_bound(hint, key);
+  }
+
+  /* With equal keys, the first of them. */
+  iterator find(const_iterator hint, const key_type& key) {
+    basic_node_type* found = lower_bound(hint, key).current_node_;
+    return found->is_nil() || compare_less(key, found->get_key()) ? end()
+                                                                   : found;
+  }
+
+  const_iterator find(const_iterator hint, const key_type& key) const {
+    return const_cast<RBtree*>(this)->find(hint, key);
+  }
+
+  /*
+   * Writes find(key) for each of the ascending keys to out, every search
+   * starting from the previous result: about O(k log(n / k)) for k keys
+   * spread over the tree, and a single pass when they are dense.
+   */
+  template <std::output_iterator<iterator> Out>
+  Out find_sorted(std::span<const key_type> keys, Out out) {
+    return find_sorted_impl<iterator>(keys, out);
+  }
+
+  template <std::output_iterator<const_iterator> Out>
+  Out find_sorted(std::span<const key_type> keys, Out out) const {
+    return const_cast<RBtree*>(this)->template find_sorted_impl<
+        const_iterator>(keys, out);
+  }
+
   bool contains(const key_type& key) const { return find(key) != end(); }
 
+  /* O(log n + count) with equal keys. */
   size_type count(const key_type& key) const {
-    return static_cast<size_type>(contains(key));
+    if constexpr (kMultiKeys) {
+      const auto [first, last] = equal_range(key);
+      return static_cast<size_type>(std::distance(first, last));
+    } else {
+      return static_cast<size_type>(contains(key));
+    }
   }
 
+  /*
+   * One descent to the first equal node; below it the lower bound is in the
+   * left subtree and the upper bound in the right one.
+   */
   std::pair<iterator, iterator> equal_range(const key_type& key) {
-    return {lower_bound(key), upper_bound(key)};
+    basic_node_type* current = root_;
+    basic_node_type* upper = nil();
+    const key_prefix_type prefix = make_prefix(key);
+    while (current->is_not_nil()) {
+      const std::weak_ordering order = compare_with_node(key, prefix, current);
+      if (order < 0) {
+        upper = current;
+        current = current->left;
+      } else if (order > 0) {
+        current = current->right;
+      } else if constexpr (!kMultiKeys) {
+        return {current, std::next(iterator(current))};
+      } else {
+        basic_node_type* lower = current;
+        for (basic_node_type* node = current->left; node->is_not_nil();) {
+          if (compare_less(node->get_key(), key)) {
+            node = node->right;
+          } else {
+            lower = node;
+            node = node->left;
+          }
+        }
+        for (basic_node_type* node = current->right; node->is_not_nil();) {
+          if (compare_greater(node->get_key(), key)) {
+            upper = node;
+            node = node->left;
+          } else {
+            node = node->right;
+          }
+        }
+        return {lower, upper};
+      }
+    }
+    return {upper, upper};
   }
 
   std::pair<const_iterator, const_iterator> equal_range(
@@ -343,31 +746,294 @@ class RBtree {
     return const_cast<RBtree*>(this)->equal_range(key);
   }
 
+  /*============================ Visitors =============================*/
+  /*
+   * Internal iteration: call f(value) for every element in key order, or for
+   * the elements in [lo, hi), with no iterator stepping. Subtrees outside the
+   * range are never entered and those inside it are walked without
+   * comparisons. If f returns a bool, false stops the walk; the functions
+   * return false in that case and true otherwise.
+   */
+  template <typename Visitor>
+  bool visit(Visitor&& visitor) {
+    return visit_impl<false, false>(root_, nullptr, nullptr, visitor);
+  }
+
+  template <typename Visitor>
+  bool visit(Visitor&& visitor) const {
+    return const_cast<RBtree*>(this)->visit(make_const_visitor(visitor));
+  }
+
+  template <typename Visitor>
+  bool for_each_in_range(const key_type& lo, const key_type& hi,
+                         Visitor&& visitor) {
+    return visit_impl<true, true>(root_, &lo, &hi, visitor);
+  }
+
+  template <typename Visitor>
+  bool for_each_in_range(const key_type& lo, const key_type& hi,
+                         Visitor&& visitor) const {
+    return const_cast<RBtree*>(this)->for_each_in_range(
+        lo, hi, make_const_visitor(visitor));
+  }
+
+  /*============================ Intervals ============================*/
+  /*
+   * Interval trees, see RBIntervalMap: an element is the closed interval
+   * [key, end]. find_overlapping gives the first interval in key order that
+   * contains point, or end(), in O(log n).
+   */
+  iterator find_overlapping(const key_type& point)
+    requires(kIntervalTree)
+  {
+    basic_node_type* current = root_;
+    while (current->is_not_nil()) {
+      if (current->left->is_not_nil() &&
+          !less(max_end_of(current->left), point)) {
+        current = current->left;
+      } else if (less(point, current->get_key())) {
+        return end();
+      } else if (!less(end_point(current->get_value()), point)) {
+        return current;
+      } else {
+        current = current->right;
+      }
+    }
+    return end();
+  }
+
+  const_iterator find_overlapping(const key_type& point) const
+    requires(kIntervalTree)
+  {
+    return const_cast<RBtree*>(this)->find_overlapping(point);
+  }
+
+  /*
+   * Calls f(value) in key order for every interval that meets [lo, hi];
+   * false from f stops the walk, as in visit. O(min(n, (k + 1) log n)) for
+   * k reported intervals.
+   */
+  template <typename Visitor>
+  bool for_each_overlapping(const key_type& lo, const key_type& hi,
+                            Visitor&& visitor)
+    requires(kIntervalTree)
+  {
+    return overlapping_impl(root_, lo, hi, visitor);
+  }
+
+  template <typename Visitor>
+  bool for_each_overlapping(const key_type& lo, const key_type& hi,
+                            Visitor&& visitor) const
+    requires(kIntervalTree)
+  {
+    return const_cast<RBtree*>(this)->for_each_overlapping(
+        lo, hi, make_const_visitor(visitor));
+  }
+
   /*============================ Observers ============================*/
   key_compare key_comp() const noexcept { return compare_; }
 
+  /* All zeros unless the policy has kCollectStats, see RBtreeStats.hpp. */
+  RBtreeStats stats() const noexcept { return stats_.snapshot(); }
+
+  void reset_stats() noexcept { stats_.reset(); }
+
+  /*============================= Layout ==============================*/
+  /*
+   * Moves every element into one freshly allocated block laid out in the
+   * given order, after hours of churn have spread the nodes over the heap.
+   * Values are moved unless their move may throw. Invalidates every
+   * iterator; the block is freed once its last element is erased.
+   */
+  void compact(rbtree_layout layout = rbtree_layout::kInOrder) {
+    finish_compact_pass();
+    if (empty()) {
+      return;
+    }
+    if (layout == rbtree_layout::kInOrder) {
+      start_compact_pass();
+      finish_compact_pass();
+      return;
+    }
+    const std::vector<basic_node_type*> sequence = van_emde_boas_sequence();
+    /* Should a move throw, a later pass drains the retired block. */
+    start_compact_pass();
+    for (basic_node_type* node : sequence) {
+      relocate(node, take_slab_node());
+    }
+    compact_cursor_ = nullptr;
+    check_invariants();
+  }
+
+  /*
+   * Incremental in-order compact(): visits at most max_nodes elements per
+   * call and returns true once the pass is over, the next call starting a
+   * new one. The tree may be modified between the calls. Invalidates the
+   * iterators to the moved elements only.
+   */
+  bool compact_step(size_type max_nodes) {
+    if (compact_cursor_ == nullptr) {
+      if (empty()) {
+        return true;
+      }
+      start_compact_pass();
+    }
+    for (; max_nodes != 0 && compact_cursor_->is_not_nil(); --max_nodes) {
+      basic_node_type* node = compact_cursor_;
+      if (!slab_.owns(node)) {
+        if (slab_.used != slab_.capacity) {
+          node = relocate(node, take_slab_node());
+        } else if (retired_slab_.owns(node)) {
+          /* Inserts outran the block: the retired one must drain anyway. */
+          node = relocate(node, allocate());
+        }
+      }
+      compact_cursor_ = successor(node);
+    }
+    check_invariants();
+    if (compact_cursor_->is_not_nil()) {
+      return false;
+    }
+    compact_cursor_ = nullptr;
+    RBTREE_CHECK(retired_slab_.nodes == nullptr);
+    if (slab_.live == 0) {
+      release_slab(slab_);
+    }
+    return true;
+  }
+
+  /*========================== Serialization ==========================*/
+  /* Writes the entries in key order, see RBtreeSerialization.hpp. */
+  void serialize(std::ostream& stream) const {
+    const rbtree_file_header header = make_file_header();
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    rbtree_payload_writer writer(stream);
+    if constexpr (kFlatSerializable) {
+      for (const auto& value : *this) {
+        writer.write(std::addressof(key_of(value)), sizeof(key_type));
+      }
+      writer.pad_to(flat_mapped_section(size_));
+      if constexpr (!kSetMode) {
+        for (const auto& [key, mapped] : *this) {
+          writer.write(std::addressof(mapped), sizeof(mapped_type));
+        }
+      }
+      writer.pad_to(header.payload_bytes);
+    } else {
+      for (const auto& value : *this) {
+        writer.write_record(key_of(value));
+        if constexpr (!kSetMode) {
+          writer.write_record(value.second);
+        }
+      }
+    }
+    writer.finish();
+  }
+
+  /*
+   * Replaces the contents with a stream produced by serialize(). The payload
+   * is verified before the tree is touched and then linked in one linear
+   * pass, without a single rebalancing step.
+   */
+  void deserialize(std::istream& stream) {
+    rbtree_file_header header{};
+    stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!stream || !is_compatible_file_header(header)) {
+      throw std::runtime_error(kBadStream);
+    }
+    const auto count = static_cast<size_type>(header.count);
+    rbtree_payload_reader reader(stream, header.payload_bytes);
+    if constexpr (kFlatSerializable) {
+      const char* keys = reader.data();
+      const char* mapped = keys + flat_mapped_section(count);
+      size_type index = 0;
+      build_sorted(count, [&] {
+        const size_type current = index++;
+        auto key = serialization_traits<key_type>::read(
+            keys + current * sizeof(key_type), sizeof(key_type));
+        if constexpr (kSetMode) {
+          return key;
+        } else {
+          return std::pair<key_type, mapped_type>(
+              std::move(key),
+              serialization_traits<mapped_type>::read(
+                  mapped + current * kMappedSize, kMappedSize));
+        }
+      });
+    } else {
+      build_sorted(count, [&] {
+        auto key = reader.template read_record<key_type>();
+        if constexpr (kSetMode) {
+          return key;
+        } else {
+          return std::pair<key_type, mapped_type>(
+              std::move(key), reader.template read_record<mapped_type>());
+        }
+      });
+    }
+  }
+
   /*====================== Non-member functions =======================*/
+  /*
+   * Keys by equivalence and mapped values by ==. Trees of different sizes,
+   * or under kContentDigest of different digests, are told apart in O(1);
+   * the others are compared element by element.
+   */
   friend bool operator==(const RBtree& lhs, const RBtree& rhs) {
-    return (lhs <=> rhs) == 0;
+    if (lhs.size_ != rhs.size_) {
+      return false;
+    }
+    if constexpr (kContentDigest) {
+      if (lhs.digest_ != rhs.digest_) {
+        return false;
+      }
+    }
+    if (&lhs == &rhs) {
+      return true;
+    }
+    return std::equal(
+        lhs.begin(), lhs.end(), rhs.begin(),
+        [&](const auto& l, const auto& r) {
+          if (lhs.compare_less(key_of(l), key_of(r)) ||
+              lhs.compare_less(key_of(r), key_of(l))) {
+            return false;
+          }
+          if constexpr (kSetMode) {
+            return true;
+          } else {
+            return l.second == r.second;
+          }
+        });
   }
 
+  /* Keys first, mapped values break the ties as in std::map. */
   friend auto operator<=>(const RBtree& lhs, const RBtree& rhs) {
-    const auto compare_pred = [&](const auto& l, const auto& r) {
-      if (lhs.compare_less(l.first, r.first)) {
-        return std::strong_ordering::less;
+    const auto compare_pred = [&](const auto& l,
+                                  const auto& r) -> std::weak_ordering {
+      if (lhs.compare_less(key_of(l), key_of(r))) {
+        return std::weak_ordering::less;
       }
-      if (lhs.compare_less(r.first, l.first)) {
-        return std::strong_ordering::greater;
+      if (lhs.compare_less(key_of(r), key_of(l))) {
+        return std::weak_ordering::greater;
+      }
+      if constexpr (kSetMode) {
+        return std::weak_ordering::equivalent;
+      } else {
+        return std::compare_weak_order_fallback(l.second, r.second);
       }
-      return std::strong_ordering::equal;
     };
     return std::lexicographical_compare_three_way(
         lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), compare_pred);
   }
 
-  /*TODO code*/
-  friend void swap(const RBtree& lhs, const RBtree& rhs) {
-    (void)lhs, (void)rhs;
+  /* Linear in both sizes, see the move constructor. */
+  friend void swap(RBtree& lhs, RBtree& rhs) noexcept {
+    using std::swap;
+    RBtree temp(std::move(lhs));
+    lhs.take(rhs);
+    rhs.take(temp);
+    swap(lhs.alloc_, rhs.alloc_);
+    swap(lhs.compare_, rhs.compare_);
   }
 
   template <typename Pred>
@@ -382,22 +1048,37 @@ class RBtree {
     while (current != last) {
       next = std::next(current);
       if (pred(*current)) {
-        erase(current);
+        erase(current.current_node_);
         ++result;
       }
       current = next;
     }
+    check_invariants();
     return result;
   }
 
  private:
+  /* A descent from current, found being the bound above its subtree. */
   template <bool (RBtree::*compare)(const key_type&, const key_type&) const>
-  iterator bound_impl(const key_type& key) {
-    basic_node_type* found = NIL_;
-    basic_node_type* current = root_;
+  iterator bound_impl(const key_type& key, basic_node_type* current,
+                      basic_node_type* found) {
+    const key_prefix_type prefix = make_prefix(key);
+    std::uint64_t depth = 0;
 
     while (current->is_not_nil()) {
-      if ((this->*compare)(current->get_key(), key)) {
+      ++depth;
+      bool go_left = false;
+      if constexpr (kKeyPrefixCache) {
+        const std::weak_ordering order =
+            compare_with_node(key, prefix, current);
+        go_left = compare == &RBtree::compare_greater ? order < 0 : order <= 0;
+      } else {
+        go_left = (this->*compare)(current->get_key(), key);
+      }
+      if constexpr (kBranchlessDescent) {
+        found = go_left ? current : found;
+        current = go_left ? current->left : current->right;
+      } else if (go_left) {
         found = current;
         current = current->left;
       } else {
@@ -405,110 +1086,503 @@ class RBtree {
       }
     }
 
+    stats_.on_lookup(depth);
     return found;
   }
 
-  /*TODO: improve codestyle*/
-  std::pair<iterator, bool> insert(basic_node_type* new_node) {
-    assert(NIL_->right == root_->get_most_left());
-    basic_node_type* prev = NIL_;
-    basic_node_type* current = root_;
-
-    while (current->is_not_nil()) {
-      prev = current;
-      if (compare_less(current->get_key(), new_node->get_key())) {
-        current = current->right;
-      } else {
-        current = current->left;
+  /*
+   * A hint before the bound has its left subtree there too, and the climb
+   * goes on until a parent is not before it. Otherwise hint has its right
+   * subtree after the bound, and the climb stops below a parent before it.
+   */
+  template <bool (RBtree::*compare)(const key_type&, const key_type&) const>
+  iterator finger_bound_impl(basic_node_type* hint, const key_type& key) {
+    if (hint->is_nil()) {
+      return bound_impl<compare>(key, root_, nil());
+    }
+    basic_node_type* node = hint;
+    if (!(this->*compare)(node->get_key(), key)) {
+      for (; node->parent->is_not_nil(); node = node->parent) {
+        if (node->is_left() && (this->*compare)(node->parent->get_key(), key)) {
+          return bound_impl<compare>(key, node->right, node->parent);
+        }
       }
+      return bound_impl<compare>(key, node->right, nil());
+    }
+    while (node->parent->is_not_nil() &&
+           !(node->is_right() &&
+             !(this->*compare)(node->parent->get_key(), key))) {
+      node = node->parent;
     }
+    return bound_impl<compare>(key, node->left, node);
+  }
 
-    new_node->parent = prev;
+  iterator finger_lower_bound(basic_node_type* hint, const key_type& key) {
+    return finger_bound_impl<&RBtree::compare_greater_equal>(hint, key);
+  }
 
-    if (prev->is_nil()) {
-      update_begin_on_insert(new_node);
-      update_root(new_node);
-    } else {
-      if (compare_less(prev->get_key(), new_node->get_key())) {
-        update_begin_on_insert(new_node);
-        prev->right = new_node;
-      } else if (compare_greater(prev->get_key(), new_node->get_key())) {
-        update_begin_on_insert(new_node);
-        prev->left = new_node;
-      } else {
-        annihilate(new_node);
-        return {end(), false};
+  /*
+   * The previous result is the lower bound of a smaller key, so it stays
+   * the result while it is not less than the key. Once a key is past the
+   * last element, so are all that follow.
+   */
+  template <typename Iter, typename Out>
+  Out find_sorted_impl(std::span<const key_type> keys, Out out) {
+    basic_node_type* hint = nil()->right;
+    for (std::size_t index = 0; index < keys.size(); ++index) {
+      const key_type& key = keys[index];
+      RBTREE_CHECK(index == 0 || !compare_less(key, keys[index - 1]));
+      if (index == 0 || compare_less(hint->get_key(), key)) {
+        hint = finger_lower_bound(hint, key).current_node_;
+      }
+      if (hint->is_nil()) {
+        return std::fill_n(out, keys.size() - index, Iter(nil()));
       }
+      *out++ = compare_less(key, hint->get_key()) ? Iter(nil()) : Iter(hint);
     }
-
-    increase_size(1);
-    insert_fixup(new_node);
-    return {new_node, true};
+    return out;
   }
 
-  void update_begin_on_insert(basic_node_type* insert_node) {
-    if (NIL_->right->is_nil() ||
-        compare_less(insert_node->get_key(), NIL_->right->get_key())) {
-      NIL_->right = insert_node;
+  /*
+   * With a three-way comparator one call per level settles the order, so
+   * the descent stops at the first node with an equal key. A less-than
+   * comparator would need two calls per level for that: it takes the lower
+   * bound with one per level and checks that node once at the end.
+   */
+  iterator find_equal(const key_type& key) {
+    if constexpr (!kThreeWayCompare) {
+      basic_node_type* found =
+          bound_impl<&RBtree::compare_greater_equal>(key, root_, nil())
+              .current_node_;
+      return found->is_nil() || compare_less(key, found->get_key()) ? nil()
+                                                                     : found;
+    } else {
+      basic_node_type* current = root_;
+      const key_prefix_type prefix = make_prefix(key);
+      std::uint64_t depth = 0;
+
+      while (current->is_not_nil()) {
+        ++depth;
+        const std::weak_ordering order =
+            compare_with_node(key, prefix, current);
+        if (order == 0) {
+          break;
+        }
+        current = order < 0 ? current->left : current->right;
+      }
+
+      stats_.on_lookup(depth);
+      return current;
     }
   }
 
-  void insert_fixup(basic_node_type* current) noexcept {
-    while (current->parent->is_red()) {
-      if (current->parent->is_left()) {
-        current = insert_fixup_impl<&basic_node_type::left>(current);
-      } else /*if (current->parent->is_right())*/ {
-        current = insert_fixup_impl<&basic_node_type::right>(current);
+  /*
+   * The low and high bounds hold until the walk first enters a subtree that
+   * lies inside them, so each in-range node drops the bound on one side.
+   * Right children are followed in a loop rather than recursively.
+   */
+  template <bool kLowBound, bool kHighBound, typename Visitor>
+  bool visit_impl(basic_node_type* node, const key_type* lo,
+                  const key_type* hi, Visitor& visitor) {
+    while (node->is_not_nil()) {
+      if constexpr (kLowBound) {
+        if (less(node->get_key(), *lo)) {
+          node = node->right;
+          continue;
+        }
+      }
+      if constexpr (kHighBound) {
+        if (!less(node->get_key(), *hi)) {
+          node = node->left;
+          continue;
+        }
+      }
+      /* Through the iterator, which makes the elements of a set const. */
+      if (!visit_impl<kLowBound, false>(node->left, lo, hi, visitor) ||
+          !call_visitor(visitor, *iterator(node))) {
+        return false;
+      }
+      if constexpr (kLowBound) {
+        return visit_impl<false, kHighBound>(node->right, lo, hi, visitor);
+      } else {
+        node = node->right;
       }
     }
-    root_->color = Color::Black;
+    return true;
   }
 
-  template <basic_node_type* basic_node_type::*direction,
-            basic_node_type* basic_node_type::*another_direction =
-                basic_node_type::another_direction(direction)>
-  basic_node_type* insert_fixup_impl(basic_node_type* current) noexcept {
-    basic_node_type* parent = current->parent;
-    basic_node_type* grandparent = parent->parent;
-    basic_node_type* uncle = grandparent->*another_direction;
-    if (uncle->is_red()) {
-      parent->color = Color::Black;
-      uncle->color = Color::Black;
-      grandparent->color = Color::Red;
-      current = grandparent;
+  template <typename Visitor, typename Value>
+  static bool call_visitor(Visitor& visitor, Value& value) {
+    if constexpr (std::is_void_v<std::invoke_result_t<Visitor&, Value&>>) {
+      std::invoke(visitor, value);
+      return true;
     } else {
-      if (current == parent->*another_direction) {
-        rotate_impl<direction>(parent);
-        std::swap(parent, current);
-      }
-      parent->color = Color::Black;
-      grandparent->color = Color::Red;
-      rotate_impl<another_direction>(grandparent);
+      return static_cast<bool>(std::invoke(visitor, value));
     }
-    return current;
   }
 
-  void erase(basic_node_type* delete_node) noexcept {
-    basic_node_type* instead_node = nullptr;
-    basic_node_type* restored_node = nullptr;
+  template <typename Visitor>
+  static auto make_const_visitor(Visitor& visitor) {
+    return [&visitor](const value_type& value) {
+      return call_visitor(visitor, value);
+    };
+  }
 
-    if (delete_node->left->is_nil() || delete_node->right->is_nil()) {
-      instead_node = delete_node;
-    } else {
-      instead_node = delete_node->right->get_most_left();
+  /*
+   * The descent remembers the side it took and whether it ever turned right,
+   * so linking the node and updating begin() need no further comparisons.
+   */
+  std::pair<iterator, bool> insert(basic_node_type* new_node) {
+    const key_type& key = new_node->get_key();
+    const key_prefix_type prefix = static_cast<node_type*>(new_node)->prefix;
+    basic_node_type* parent = nil();
+    basic_node_type* basic_node_type::*side = &basic_node_type::left;
+    basic_node_type* not_less = nil();
+    bool leftmost = true;
+
+    for (basic_node_type* current = root_; current->is_not_nil();
+         current = current->*side) {
+      if constexpr (kTopDown) {
+        split_on_descent(current);
+      }
+      parent = current;
+      if constexpr (kMultiKeys) {
+        /* Equal keys turn right: the new one lands at the upper bound. */
+        bool go_left = false;
+        if constexpr (kThreeWayCompare) {
+          go_left = compare_with_node(key, prefix, current) < 0;
+        } else {
+          go_left = compare_greater(current->get_key(), key);
+        }
+        side = go_left ? &basic_node_type::left : &basic_node_type::right;
+      } else if constexpr (kThreeWayCompare) {
+        const std::weak_ordering order =
+            compare_with_node(key, prefix, current);
+        if (order == 0) {
+          annihilate(new_node);
+          return {current, false};
+        }
+        side = order < 0 ? &basic_node_type::left : &basic_node_type::right;
+      } else if (compare_less(current->get_key(), key)) {
+        side = &basic_node_type::right;
+      } else {
+        not_less = current;
+        side = &basic_node_type::left;
+      }
+      leftmost = leftmost && side == &basic_node_type::left;
     }
 
-    Color instead_color = instead_node->color;
+    /* An equal key is the last node the descent turned left at. */
+    if (!kMultiKeys && not_less->is_not_nil() &&
+        !compare_greater(not_less->get_key(), key)) {
+      annihilate(new_node);
+      return {not_less, false};
+    }
 
-    if (instead_node->left->is_not_nil()) {
-      restored_node = instead_node->left;
+    link_leaf(new_node, parent, side, leftmost);
+    if constexpr (kTopDown) {
+      if (parent->is_red()) {
+        insert_fixup_step(new_node);
+      }
+      paint(root_, Color::Black);
     } else {
-      restored_node = instead_node->right;
+      restore_balance_after_insert(new_node);
     }
+    check_invariants();
+    return {new_node, true};
+  }
 
-    restored_node->parent = instead_node->parent;
-
-    if (delete_node->parent->is_nil()) {
+  /* Hangs a new leaf under parent; leftmost tells it is the new begin(). */
+  void link_leaf(basic_node_type* new_node, basic_node_type* parent,
+                 basic_node_type* basic_node_type::*side,
+                 bool leftmost) noexcept {
+    new_node->parent = parent;
+    if constexpr (kThreadedLinks) {
+      link_thread(new_node, parent, side);
+    }
+    if (leftmost) {
+      nil()->right = new_node;
+    }
+    if (parent->is_nil()) {
+      update_root(new_node);
+    } else {
+      parent->*side = new_node;
+    }
+    extend_max_end_upward(new_node);
+    increase_size(1);
+    add_digest(new_node);
+  }
+
+  void restore_balance_after_insert(basic_node_type* new_node) noexcept {
+    if constexpr (kRedBlack) {
+      insert_fixup(new_node);
+    } else {
+      rebalance_upward(new_node->parent);
+    }
+  }
+
+  /*
+   * Inserts new_node just before the bound of its key, the lower one or,
+   * with multi keys, the upper one. That is the successor of hint when
+   * the batch is dense, and a finger search from hint otherwise. Returns
+   * new_node, or the element with an equal key that kept it out.
+   */
+  basic_node_type* insert_after_finger(basic_node_type* hint,
+                                       basic_node_type* new_node) noexcept {
+    static constexpr auto kBoundCompare = kMultiKeys
+                                              ? &RBtree::compare_greater
+                                              : &RBtree::compare_greater_equal;
+    const key_type& key = new_node->get_key();
+    RBTREE_CHECK(hint->is_nil() || !compare_less(key, hint->get_key()));
+    basic_node_type* bound = nil();
+    if (hint->is_not_nil() && !(this->*kBoundCompare)(hint->get_key(), key)) {
+      bound = successor(hint);
+      if (bound->is_not_nil() && !(this->*kBoundCompare)(bound->get_key(), key)) {
+        bound = finger_bound_impl<kBoundCompare>(bound, key).current_node_;
+      }
+    } else {
+      bound = finger_bound_impl<kBoundCompare>(hint, key).current_node_;
+    }
+    if (!kMultiKeys && bound->is_not_nil() &&
+        !compare_less(key, bound->get_key())) {
+      annihilate(new_node);
+      return bound;
+    }
+    basic_node_type* parent = nil();
+    basic_node_type* basic_node_type::*side = &basic_node_type::right;
+    if (bound->is_nil()) {
+      parent = root_->get_most_right();
+    } else if (bound->left->is_nil()) {
+      parent = bound;
+      side = &basic_node_type::left;
+    } else {
+      parent = bound->left->get_most_right();
+    }
+    link_leaf(new_node, parent, side,
+              parent->is_nil() || (bound == nil()->right &&
+                                   side == &basic_node_type::left));
+    restore_balance_after_insert(new_node);
+    return new_node;
+  }
+
+  /*
+   * Creates the nodes of the batch first, so that an exception leaves the
+   * tree as it was, then relinks them with the existing ones.
+   */
+  template <typename ForwardIt, typename Sentinel>
+  size_type merge_sorted_batch(ForwardIt first, Sentinel last,
+                               size_type count) {
+    std::vector<basic_node_type*> fresh;
+    std::vector<basic_node_type*> nodes;
+    fresh.reserve(count);
+    nodes.reserve(size_ + count);
+    try {
+      for (; first != last; ++first) {
+        basic_node_type* node =
+            create_node(nil(), nil(), nil(), Color::Red, false, *first);
+        RBTREE_CHECK(fresh.empty() ||
+                     !compare_less(node->get_key(), fresh.back()->get_key()));
+        if (!kMultiKeys && !fresh.empty() &&
+            !compare_less(fresh.back()->get_key(), node->get_key())) {
+          annihilate(node);
+        } else {
+          fresh.push_back(node);
+        }
+      }
+    } catch (...) {
+      for (basic_node_type* node : fresh) {
+        annihilate(node);
+      }
+      throw;
+    }
+
+    basic_node_type* existing = nil()->right;
+    for (basic_node_type* node : fresh) {
+      const key_type& key = node->get_key();
+      while (existing->is_not_nil() &&
+             (kMultiKeys ? !compare_less(key, existing->get_key())
+                         : compare_less(existing->get_key(), key))) {
+        nodes.push_back(std::exchange(existing, successor(existing)));
+      }
+      if (!kMultiKeys && existing->is_not_nil() &&
+          !compare_less(key, existing->get_key())) {
+        annihilate(node);
+      } else {
+        nodes.push_back(node);
+        add_digest(node);
+      }
+    }
+    for (; existing->is_not_nil(); existing = successor(existing)) {
+      nodes.push_back(existing);
+    }
+
+    const size_type inserted = nodes.size() - size_;
+    relink_sorted(nodes);
+    increase_size(inserted);
+    check_invariants();
+    return inserted;
+  }
+
+  /* Makes the ascending nodes into a tree shaped as build_sorted does. */
+  void relink_sorted(const std::vector<basic_node_type*>& nodes) noexcept {
+    basic_node_type* new_root = relink_sorted_impl(
+        nodes.data(), nodes.size(), 0, red_depth_for(nodes.size()));
+    new_root->parent = nil();
+    update_root(new_root);
+    nil()->right = nodes.front();
+    if constexpr (kThreadedLinks) {
+      basic_node_type* previous = nil();
+      for (basic_node_type* node : nodes) {
+        node->prev = previous;
+        previous->next = node;
+        previous = node;
+      }
+      previous->next = nil();
+      nil()->prev = previous;
+    }
+  }
+
+  basic_node_type* relink_sorted_impl(basic_node_type* const* nodes,
+                                      size_type count, size_type depth,
+                                      size_type red_depth) noexcept {
+    if (count == 0) {
+      return nil();
+    }
+    const size_type left_count = (count - 1) / 2;
+    basic_node_type* node = nodes[left_count];
+    node->color = depth == red_depth ? Color::Red : Color::Black;
+    attach(node, &basic_node_type::left,
+           relink_sorted_impl(nodes, left_count, depth + 1, red_depth));
+    attach(node, &basic_node_type::right,
+           relink_sorted_impl(nodes + left_count + 1, count - left_count - 1,
+                              depth + 1, red_depth));
+    update_max_end(node);
+    update_balance(node);
+    return node;
+  }
+
+  /* A new leaf is the in-order neighbour of its parent on its side. */
+  static void link_thread(basic_node_type* node, basic_node_type* parent,
+                          basic_node_type* basic_node_type::*side) noexcept {
+    if (side == &basic_node_type::left) {
+      node->prev = parent->prev;
+      node->next = parent;
+    } else {
+      node->prev = parent;
+      node->next = parent->next;
+    }
+    node->prev->next = node;
+    node->next->prev = node;
+  }
+
+  static void unlink_thread(basic_node_type* node) noexcept {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+  }
+
+  void insert_fixup(basic_node_type* current) noexcept {
+    while (current->parent->is_red()) {
+      stats_.on_insert_fixup();
+      if (current->parent->is_left()) {
+        current = insert_fixup_impl<&basic_node_type::left>(current);
+      } else /*if (current->parent->is_right())*/ {
+        current = insert_fixup_impl<&basic_node_type::right>(current);
+      }
+    }
+    paint(root_, Color::Black);
+  }
+
+  void insert_fixup_step(basic_node_type* current) noexcept {
+    stats_.on_insert_fixup();
+    if (current->parent->is_left()) {
+      insert_fixup_impl<&basic_node_type::left>(current);
+    } else {
+      insert_fixup_impl<&basic_node_type::right>(current);
+    }
+  }
+
+  /*
+   * Top-down insert: a node with two red children takes the red itself.
+   * Its new parent was split on the way down too, so a red parent has a
+   * black sibling and one fixup step, a rotation, settles it. The root
+   * stays black throughout.
+   */
+  void split_on_descent(basic_node_type* current) noexcept {
+    if (current->left->is_red() && current->right->is_red()) {
+      paint(current->left, Color::Black);
+      paint(current->right, Color::Black);
+      if (current->parent->is_not_nil()) {
+        paint(current, Color::Red);
+        if (current->parent->is_red()) {
+          insert_fixup_step(current);
+        }
+      }
+    }
+  }
+
+  template <basic_node_type* basic_node_type::*direction,
+            basic_node_type* basic_node_type::*another_direction =
+                basic_node_type::another_direction(direction)>
+  basic_node_type* insert_fixup_impl(basic_node_type* current) noexcept {
+    basic_node_type* parent = current->parent;
+    basic_node_type* grandparent = parent->parent;
+    basic_node_type* uncle = grandparent->*another_direction;
+    if (uncle->is_red()) {
+      paint(parent, Color::Black);
+      paint(uncle, Color::Black);
+      paint(grandparent, Color::Red);
+      current = grandparent;
+    } else {
+      if (current == parent->*another_direction) {
+        rotate_impl<direction>(parent);
+        std::swap(parent, current);
+      }
+      paint(parent, Color::Black);
+      paint(grandparent, Color::Red);
+      rotate_impl<another_direction>(grandparent);
+    }
+    return current;
+  }
+
+  void erase(basic_node_type* delete_node) noexcept {
+    basic_node_type* instead_node = nullptr;
+    if (delete_node->left->is_nil() || delete_node->right->is_nil()) {
+      instead_node = delete_node;
+    } else {
+      instead_node = delete_node->right->get_most_left();
+    }
+
+    const Color instead_color = instead_node->color;
+    basic_node_type* restored_node = unlink(delete_node, instead_node);
+    if constexpr (!kRedBlack) {
+      rebalance_upward(restored_node->parent);
+    } else if (instead_color == Color::Black) {
+      erase_fixup(restored_node);
+    }
+  }
+
+  /*
+   * Frees delete_node, putting instead_node in its place: delete_node
+   * itself or a node of at most one child next to it in key order. Returns
+   * the node now where instead_node was, which is one black short if
+   * instead_node was black.
+   */
+  basic_node_type* unlink(basic_node_type* delete_node,
+                          basic_node_type* instead_node) noexcept {
+    if (delete_node == compact_cursor_) {
+      compact_cursor_ = successor(delete_node);
+    }
+    basic_node_type* restored_node = nullptr;
+
+    if (instead_node->left->is_not_nil()) {
+      restored_node = instead_node->left;
+    } else {
+      restored_node = instead_node->right;
+    }
+
+    restored_node->parent = instead_node->parent;
+
+    if (delete_node->parent->is_nil()) {
       update_root(instead_node);
     }
 
@@ -528,35 +1602,122 @@ class RBtree {
       instead_node->left->parent = instead_node;
       instead_node->right->parent = instead_node;
       instead_node->color = delete_node->color;
+      instead_node->balance = delete_node->balance;
     }
 
-    if (instead_color == Color::Black) {
-      erase_fixup(restored_node);
-    }
-
+    update_max_end_upward(restored_node->parent);
     update_begin_on_erase(delete_node, instead_node, restored_node);
+    if constexpr (kThreadedLinks) {
+      unlink_thread(delete_node);
+    }
+    remove_digest(delete_node);
     annihilate(delete_node);
     decrease_size(1);
+    return restored_node;
+  }
+
+  /*
+   * Top-down erase: every node the descent steps into is made red, by a
+   * colour flip with its sibling or a rotation, unless the next one is red
+   * already. Past the key the descent goes on to its predecessor, so the
+   * node finally unlinked is a red leaf and needs no fixup.
+   */
+  size_type erase_top_down(const key_type& key) noexcept {
+    const key_prefix_type prefix = make_prefix(key);
+    basic_node_type* found = nil();
+    basic_node_type* current = root_;
+    while (current->is_not_nil()) {
+      basic_node_type* basic_node_type::*side = &basic_node_type::right;
+      if (found->is_nil()) {
+        const std::weak_ordering order =
+            compare_with_node(key, prefix, current);
+        if (order == 0) {
+          found = current;
+        }
+        side = order <= 0 ? &basic_node_type::left : &basic_node_type::right;
+      }
+      push_red_down(current, side);
+      if ((current->*side)->is_nil()) {
+        break;
+      }
+      current = current->*side;
+    }
+
+    size_type erased = 0;
+    if (found->is_not_nil()) {
+      unlink(found, current);
+      erased = 1;
+    }
+    paint(root_, Color::Black);
+    check_invariants();
+    return erased;
+  }
+
+  /*
+   * Makes current or its child on side red. The parent of current is red
+   * unless it is the root, which erase_top_down repaints black in the end.
+   */
+  void push_red_down(basic_node_type* current,
+                     basic_node_type* basic_node_type::*side) noexcept {
+    if (current->is_red() || (current->*side)->is_red()) {
+      return;
+    }
+    basic_node_type* basic_node_type::*other_side =
+        basic_node_type::another_direction(side);
+    stats_.on_erase_fixup();
+    if ((current->*other_side)->is_red()) {
+      paint(current->*other_side, Color::Black);
+      paint(current, Color::Red);
+      rotate(current, side);
+      return;
+    }
+    basic_node_type* parent = current->parent;
+    if (parent->is_nil()) {
+      return;
+    }
+    basic_node_type* basic_node_type::*last = current->is_left()
+                                                  ? &basic_node_type::left
+                                                  : &basic_node_type::right;
+    basic_node_type* basic_node_type::*other_last =
+        basic_node_type::another_direction(last);
+    basic_node_type* brother = parent->*other_last;
+    if (brother->left->is_black() && brother->right->is_black()) {
+      paint(parent, Color::Black);
+      paint(brother, Color::Red);
+      paint(current, Color::Red);
+      return;
+    }
+    if ((brother->*last)->is_red()) {
+      rotate(brother, other_last);
+    }
+    rotate(parent, last);
+    basic_node_type* top = parent->parent;
+    paint(current, Color::Red);
+    paint(top, Color::Red);
+    paint(top->left, Color::Black);
+    paint(top->right, Color::Black);
   }
 
   void update_begin_on_erase(basic_node_type* delete_node,
                              basic_node_type* instead_node,
                              basic_node_type* restored_node) noexcept {
-    if (NIL_->right == delete_node) {
+    if (nil()->right == delete_node) {
       if (instead_node == delete_node) {
         if (restored_node->is_nil()) {
-          NIL_->right = delete_node->parent;
+          nil()->right = delete_node->parent;
         } else {
-          NIL_->right = restored_node;
+          /* A single leaf but in weight-balanced trees. */
+          nil()->right = restored_node->get_most_left();
         }
       } else {
-        NIL_->right = instead_node;
+        nil()->right = instead_node;
       }
     }
   }
 
   void erase_fixup(basic_node_type* restored_node) noexcept {
     while (restored_node != root_ && restored_node->is_black()) {
+      stats_.on_erase_fixup();
       if (restored_node->is_left()) {
         restored_node = erase_fixup_impl<&basic_node_type::left>(restored_node);
       } else {
@@ -564,7 +1725,7 @@ class RBtree {
             erase_fixup_impl<&basic_node_type::right>(restored_node);
       }
     }
-    restored_node->color = Color::Black;
+    paint(restored_node, Color::Black);
   }
 
   template <basic_node_type* basic_node_type::*direction,
@@ -574,35 +1735,46 @@ class RBtree {
     basic_node_type* parent = current->parent;
     basic_node_type* brother = parent->*another_direction;
     if (brother->is_red()) {
-      brother->color = Color::Black;
-      parent->color = Color::Red;
+      paint(brother, Color::Black);
+      paint(parent, Color::Red);
       rotate_impl<direction>(parent);
       brother = parent->*another_direction;
     }
     if ((brother->*direction)->is_black() &&
         (brother->*another_direction)->is_black()) {
-      brother->color = Color::Red;
+      paint(brother, Color::Red);
       current = parent;
     } else {
       if ((brother->*another_direction)->is_black()) {
-        (brother->*direction)->color = Color::Black;
-        brother->color = Color::Red;
+        paint(brother->*direction, Color::Black);
+        paint(brother, Color::Red);
         rotate_impl<another_direction>(brother);
         brother = parent->*another_direction;
       }
-      brother->color = parent->color;
-      parent->color = Color::Black;
-      (brother->*another_direction)->color = Color::Black;
+      paint(brother, parent->color);
+      paint(parent, Color::Black);
+      paint(brother->*another_direction, Color::Black);
       rotate_impl<direction>(parent);
       current = root_;
     }
     return current;
   }
 
+  /* Moves node down to its child's place on direction. */
+  void rotate(basic_node_type* node,
+              basic_node_type* basic_node_type::*direction) noexcept {
+    if (direction == &basic_node_type::left) {
+      rotate_impl<&basic_node_type::left>(node);
+    } else {
+      rotate_impl<&basic_node_type::right>(node);
+    }
+  }
+
   template <basic_node_type* basic_node_type::*direction,
             basic_node_type* basic_node_type::*another_direction =
                 basic_node_type::another_direction(direction)>
   void rotate_impl(basic_node_type* node) noexcept {
+    stats_.on_rotation();
     basic_node_type* child = node->*another_direction;
 
     if (node->parent->is_nil()) {
@@ -619,86 +1791,755 @@ class RBtree {
       (node->*another_direction)->parent = node;
     }
     child->*direction = node;
+    update_max_end(node);
+    update_max_end(child);
+    update_balance(node);
+    update_balance(child);
+  }
+
+  /*====================== AVL and weight balance =====================*/
+  void update_balance(basic_node_type* node) noexcept {
+    if constexpr (kAvl) {
+      node->balance = static_cast<balance_type>(
+          std::max(node->left->balance, node->right->balance) + 1);
+    } else if constexpr (kWeightBalanced) {
+      node->balance = node->left->balance + node->right->balance + 1;
+    }
+  }
+
+  /*
+   * Refreshes the balance of node and its ancestors, rotating wherever a
+   * child has grown too heavy. An AVL tree stops at the first subtree that
+   * keeps its height; sizes change all the way up.
+   */
+  void rebalance_upward(basic_node_type* node) noexcept {
+    while (node->is_not_nil()) {
+      const balance_type before = node->balance;
+      update_balance(node);
+      if (is_too_heavy(node->left, node->right)) {
+        node = rebalance_impl<&basic_node_type::left>(node);
+      } else if (is_too_heavy(node->right, node->left)) {
+        node = rebalance_impl<&basic_node_type::right>(node);
+      }
+      if (kAvl && node->balance == before) {
+        return;
+      }
+      node = node->parent;
+    }
+  }
+
+  static bool is_too_heavy(basic_node_type* heavy,
+                           basic_node_type* light) noexcept {
+    if constexpr (kAvl) {
+      return heavy->balance > light->balance + 1;
+    } else {
+      return kRBtreeWeightDelta * (light->balance + 1) < heavy->balance + 1;
+    }
+  }
+
+  /* Lifts the heavy child on direction, or its inner child; returns it. */
+  template <basic_node_type* basic_node_type::*direction,
+            basic_node_type* basic_node_type::*another_direction =
+                basic_node_type::another_direction(direction)>
+  basic_node_type* rebalance_impl(basic_node_type* node) noexcept {
+    basic_node_type* child = node->*direction;
+    basic_node_type* inner = child->*another_direction;
+    basic_node_type* outer = child->*direction;
+    bool double_rotation = false;
+    if constexpr (kAvl) {
+      double_rotation = inner->balance > outer->balance;
+    } else {
+      double_rotation =
+          inner->balance + 1 >= kRBtreeWeightRatio * (outer->balance + 1);
+    }
+    if (double_rotation) {
+      rotate_impl<direction>(child);
+    }
+    rotate_impl<another_direction>(node);
+    return node->parent;
+  }
+
+  /*=========================== Intervals =============================*/
+  static decltype(auto) end_point(const value_type& value) noexcept {
+    return interval_end_type{}(value);
+  }
+
+  static const key_type& max_end_of(basic_node_type* node) noexcept {
+    return static_cast<node_type*>(node)->max_end;
+  }
+
+  /* From the end of node and the maxima of its children. */
+  void update_max_end(basic_node_type* node) noexcept {
+    if constexpr (kIntervalTree) {
+      auto* current = static_cast<node_type*>(node);
+      current->max_end = end_point(current->get_value());
+      for (basic_node_type* child : {node->left, node->right}) {
+        if (child->is_not_nil() && less(current->max_end, max_end_of(child))) {
+          current->max_end = max_end_of(child);
+        }
+      }
+    }
+  }
+
+  /* After an insert: maxima only grow, up to the first that holds already. */
+  void extend_max_end_upward(basic_node_type* node) noexcept {
+    if constexpr (kIntervalTree) {
+      const key_type& end = max_end_of(node);
+      for (node = node->parent;
+           node->is_not_nil() && less(max_end_of(node), end);
+           node = node->parent) {
+        static_cast<node_type*>(node)->max_end = end;
+      }
+    }
+  }
+
+  void update_max_end_upward(basic_node_type* node) noexcept {
+    if constexpr (kIntervalTree) {
+      for (; node->is_not_nil(); node = node->parent) {
+        update_max_end(node);
+      }
+    }
+  }
+
+  /*
+   * Subtrees that end before lo are skipped whole, and the walk stops at
+   * the first start after hi. Right children are followed in a loop.
+   */
+  template <typename Visitor>
+  bool overlapping_impl(basic_node_type* node, const key_type& lo,
+                        const key_type& hi, Visitor& visitor) {
+    while (node->is_not_nil() && !less(max_end_of(node), lo)) {
+      if (!overlapping_impl(node->left, lo, hi, visitor)) {
+        return false;
+      }
+      if (less(hi, node->get_key())) {
+        return true;
+      }
+      if (!less(end_point(node->get_value()), lo) &&
+          !call_visitor(visitor, *iterator(node))) {
+        return false;
+      }
+      node = node->right;
+    }
+    return true;
+  }
+
+  static constexpr bool kThreeWayCompare =
+      three_way_key_compare<key_compare, key_type> ||
+      less_over_three_way<key_compare, key_type>;
+
+  /*
+   * With single-instruction comparisons, a descent that selects the child
+   * with conditional moves cannot mispredict, so it runs at load latency.
+   */
+  static constexpr bool kBranchlessDescent =
+      simd_searchable_key<key_compare, key_type>;
+
+  static constexpr bool kFlatSerializable =
+      std::is_trivially_copyable_v<key_type> &&
+      (kSetMode || std::is_trivially_copyable_v<mapped_type>);
+
+  /* A set writes no mapped section and one record per element. */
+  static constexpr size_type kMappedSize = [] {
+    if constexpr (kSetMode) {
+      return size_type{0};
+    } else {
+      return sizeof(mapped_type);
+    }
+  }();
+  static constexpr size_type kRecordsPerElement = kSetMode ? 1 : 2;
+
+  static const key_type& key_of(const value_type& value) noexcept {
+    if constexpr (kSetMode) {
+      return value;
+    } else {
+      return value.first;
+    }
+  }
+
+  /* Offset of the mapped values inside a flat payload. */
+  static size_type flat_mapped_section(size_type count) noexcept {
+    return rbtree_file_header::mapped_offset(count, sizeof(key_type)) -
+           rbtree_file_header::keys_offset();
+  }
+
+  rbtree_file_header make_file_header() const noexcept {
+    rbtree_file_header header{};
+    header.magic = rbtree_file_header::kMagic;
+    header.version = rbtree_file_header::kVersion;
+    header.count = size_;
+    if constexpr (kFlatSerializable) {
+      header.flags = rbtree_file_header::kFlatFlag;
+      header.key_size = sizeof(key_type);
+      header.mapped_size = kMappedSize;
+      header.payload_bytes = rbtree_file_header::flat_payload_bytes(
+          size_, sizeof(key_type), kMappedSize);
+    } else {
+      for (const auto& value : *this) {
+        header.payload_bytes += kRecordsPerElement * sizeof(std::uint64_t) +
+                                serialization_traits<key_type>::size(
+                                    key_of(value));
+        if constexpr (!kSetMode) {
+          header.payload_bytes +=
+              serialization_traits<mapped_type>::size(value.second);
+        }
+      }
+    }
+    return header;
+  }
+
+  static bool is_compatible_file_header(
+      const rbtree_file_header& header) noexcept {
+    if (header.magic != rbtree_file_header::kMagic ||
+        header.version != rbtree_file_header::kVersion) {
+      return false;
+    }
+    if constexpr (kFlatSerializable) {
+      return header.is_flat() && header.key_size == sizeof(key_type) &&
+             header.mapped_size == kMappedSize &&
+             rbtree_file_header::is_flat_count_valid(
+                 header.count, sizeof(key_type), kMappedSize) &&
+             header.payload_bytes ==
+                 rbtree_file_header::flat_payload_bytes(
+                     header.count, sizeof(key_type), kMappedSize);
+    } else {
+      return !header.is_flat() &&
+             header.count <= header.payload_bytes /
+                                 (kRecordsPerElement * sizeof(std::uint64_t));
+    }
+  }
+
+  /*
+   * Replaces the contents with count strictly increasing values taken from
+   * produce() in O(n): the tree is built perfectly balanced, all levels are
+   * black except an incomplete last one, which is red.
+   */
+  template <typename Producer>
+  void build_sorted(size_type count, Producer produce) {
+    clear();
+    if (count == 0) {
+      return;
+    }
+    const size_type red_depth = red_depth_for(count);
+    basic_node_type* previous = nil();
+    basic_node_type* new_root = nil();
+    try {
+      new_root = build_sorted_impl(count, 0, red_depth, produce, previous);
+    } catch (...) {
+      if constexpr (kThreadedLinks) {
+        nil()->prev = nil()->next = nil();
+      }
+      digest_ = digest_type{};
+      throw;
+    }
+    update_root(new_root);
+    nil()->right = new_root->get_most_left();
+    increase_size(count);
+    check_invariants();
+  }
+
+  /* Red is the incomplete last level of a perfectly balanced tree, if any. */
+  static size_type red_depth_for(size_type count) noexcept {
+    return std::has_single_bit(count + 1)
+               ? std::numeric_limits<size_type>::max()
+               : std::bit_width(count) - 1;
+  }
+
+  template <typename Producer>
+  basic_node_type* build_sorted_impl(size_type count, size_type depth,
+                                     size_type red_depth, Producer& produce,
+                                     basic_node_type*& previous) {
+    if (count == 0) {
+      return nil();
+    }
+    const size_type left_count = (count - 1) / 2;
+    basic_node_type* left =
+        build_sorted_impl(left_count, depth + 1, red_depth, produce, previous);
+    basic_node_type* node = nil();
+    try {
+      node = create_node(nil(), nil(), nil(),
+                         depth == red_depth ? Color::Red : Color::Black, false,
+                         produce());
+      attach(node, &basic_node_type::left, left);
+      if (previous->is_not_nil() &&
+          (kMultiKeys ? compare_less(node->get_key(), previous->get_key())
+                      : !compare_less(previous->get_key(), node->get_key()))) {
+        throw std::runtime_error(kUnsortedStream);
+      }
+      if constexpr (kThreadedLinks) {
+        link_thread(node, previous, &basic_node_type::right);
+      }
+      previous = node;
+      add_digest(node);
+      attach(node, &basic_node_type::right,
+             build_sorted_impl(count - left_count - 1, depth + 1, red_depth,
+                               produce, previous));
+      update_max_end(node);
+      update_balance(node);
+    } catch (...) {
+      destroy_subtree(node->is_nil() ? left : node);
+      throw;
+    }
+    return node;
+  }
+
+  static void attach(basic_node_type* parent,
+                     basic_node_type* basic_node_type::*direction,
+                     basic_node_type* child) noexcept {
+    parent->*direction = child;
+    if (child->is_not_nil()) {
+      child->parent = parent;
+    }
+  }
+
+  void destroy_subtree(basic_node_type* node) noexcept {
+    if (node->is_nil()) {
+      return;
+    }
+    destroy_subtree(node->left);
+    destroy_subtree(node->right);
+    annihilate(node);
   }
 
   void update_root(basic_node_type* new_root) noexcept {
     root_ = new_root;
-    NIL_->left = new_root;
+    nil()->left = new_root;
+  }
+
+  void paint(basic_node_type* node, Color color) noexcept {
+    stats_.on_recolor(node->color != color);
+    node->color = color;
   }
 
   void annihilate(basic_node_type* object) noexcept {
-    assert(object->is_not_nil());
+    RBTREE_CHECK(object->is_not_nil());
     node_type* currect_pointer = static_cast<node_type*>(object);
     destroy(currect_pointer);
-    deallocate(currect_pointer);
+    if (slab_.owns(currect_pointer)) {
+      /* The block of a running pass stays until the pass is over. */
+      if (--slab_.live == 0 && compact_cursor_ == nullptr) {
+        release_slab(slab_);
+      }
+    } else if (retired_slab_.owns(currect_pointer)) {
+      if (--retired_slab_.live == 0) {
+        release_slab(retired_slab_);
+      }
+    } else {
+      deallocate(currect_pointer);
+    }
   }
 
-  node_type* allocate() { return node_allocator_traits::allocate(alloc_, 1); }
+  template <typename... Args>
+  node_type* create_node(Args&&... args) {
+    node_type* new_node = allocate();
+    try {
+      construct(new_node, std::forward<Args>(args)...);
+    } catch (...) {
+      deallocate(new_node);
+      throw;
+    }
+    return new_node;
+  }
+
+  node_type* allocate() {
+    node_type* object = node_allocator_traits::allocate(alloc_, 1);
+    stats_.on_allocation();
+    return object;
+  }
 
   void deallocate(node_type* object) noexcept {
+    stats_.on_deallocation();
     node_allocator_traits::deallocate(alloc_, object, 1);
   }
 
   template <typename... Args>
-  void construct(node_type* object, Args&&... args) {
-    node_allocator_traits::construct(alloc_, object,
-                                     std::forward<Args>(args)...);
+  void construct(node_type* object, basic_node_type* left,
+                 basic_node_type* right, basic_node_type* parent, Color color,
+                 bool nil_flag, Args&&... args) {
+    node_allocator_traits::construct(alloc_, object, left, right, parent,
+                                     color, nil_flag);
+    value_allocator_type value_alloc(alloc_);
+    value_allocator_traits::construct(value_alloc, std::addressof(object->val),
+                                      std::forward<Args>(args)...);
+    object->prefix = make_prefix(key_of(object->val));
+    if constexpr (kIntervalTree) {
+      object->max_end = end_point(object->val);
+    }
   }
 
   void destroy(node_type* object) noexcept {
+    value_allocator_type value_alloc(alloc_);
+    value_allocator_traits::destroy(value_alloc, std::addressof(object->val));
     node_allocator_traits::destroy(alloc_, object);
   }
 
+  /* Ends the life of the values in a subtree and leaves the nodes as is. */
+  void destroy_values(basic_node_type* node) noexcept {
+    if constexpr (!std::is_trivially_destructible_v<value_type>) {
+      if (node->is_nil()) {
+        return;
+      }
+      destroy_values(node->left);
+      destroy_values(node->right);
+      destroy(static_cast<node_type*>(node));
+    }
+  }
+
   bool compare_less(const key_type& lhs, const key_type& rhs) const {
-    return compare_(lhs, rhs);
+    return less(lhs, rhs);
   }
 
   bool compare_less_equal(const key_type& lhs, const key_type& rhs) const {
-    return !compare_(rhs, lhs);
+    return !less(rhs, lhs);
   }
 
   bool compare_greater(const key_type& lhs, const key_type& rhs) const {
-    return compare_(rhs, lhs);
+    return less(rhs, lhs);
   }
 
   bool compare_greater_equal(const key_type& lhs, const key_type& rhs) const {
-    return !compare_(lhs, rhs);
+    return !less(lhs, rhs);
+  }
+
+  std::weak_ordering compare_three_way(const key_type& lhs,
+                                       const key_type& rhs) const {
+    if constexpr (!kThreeWayCompare) {
+      if (less(lhs, rhs)) {
+        return std::weak_ordering::less;
+      }
+      return less(rhs, lhs) ? std::weak_ordering::greater
+                            : std::weak_ordering::equivalent;
+    } else if constexpr (three_way_key_compare<key_compare, key_type>) {
+      stats_.on_comparison();
+      return compare_(lhs, rhs);
+    } else {
+      stats_.on_comparison();
+      return lhs <=> rhs;
+    }
+  }
+
+  /* Settles on the inline prefixes when they differ, see RBtreePolicies. */
+  std::weak_ordering compare_with_node(const key_type& key,
+                                       key_prefix_type prefix,
+                                       basic_node_type* node) const {
+    if constexpr (kKeyPrefixCache) {
+      const key_prefix_type node_prefix = static_cast<node_type*>(node)->prefix;
+      if (prefix != node_prefix) {
+        return prefix < node_prefix ? std::weak_ordering::less
+                                    : std::weak_ordering::greater;
+      }
+    } else {
+      (void)prefix;
+    }
+    return compare_three_way(key, node->get_key());
+  }
+
+  /* The single point where the tree's own operations compare keys. */
+  bool less(const key_type& lhs, const key_type& rhs) const {
+    if constexpr (kThreeWayCompare) {
+      return compare_three_way(lhs, rhs) < 0;
+    } else {
+      stats_.on_comparison();
+      return compare_(lhs, rhs);
+    }
+  }
+
+  /*
+   * The same order without touching the counters, for the validator: its
+   * parallel pass compares from several threads at once.
+   */
+  bool less_uncounted(const key_type& lhs, const key_type& rhs) const {
+    if constexpr (three_way_key_compare<key_compare, key_type>) {
+      return compare_(lhs, rhs) < 0;
+    } else {
+      return compare_(lhs, rhs);
+    }
+  }
+
+  /*========================== Compaction =============================*/
+  /* A block of nodes allocated at once by compact. */
+  struct Slab {
+    bool owns(const basic_node_type* node) const noexcept {
+      return std::less_equal<>{}(nodes, node) &&
+             std::less<>{}(node, nodes + capacity);
+    }
+
+    node_type* nodes{};
+    size_type capacity{};
+    /* Slots handed out, in order; erased ones are not reused. */
+    size_type used{};
+    /* Elements still living in the block. */
+    size_type live{};
+  };
+
+  /*
+   * The previous block retires, to be drained by the pass, and a new one
+   * for the current elements is allocated.
+   */
+  void start_compact_pass() {
+    RBTREE_CHECK(retired_slab_.nodes == nullptr);
+    Slab slab{node_allocator_traits::allocate(alloc_, size_), size_, 0, 0};
+    stats_.on_allocation();
+    retired_slab_ = std::exchange(slab_, slab);
+    if (retired_slab_.live == 0) {
+      release_slab(retired_slab_);
+    }
+    compact_cursor_ = nil()->right;
+  }
+
+  void finish_compact_pass() {
+    if (compact_cursor_ != nullptr) {
+      compact_step(max_size());
+    }
+  }
+
+  void release_slab(Slab& slab) noexcept {
+    if (slab.nodes != nullptr) {
+      stats_.on_deallocation();
+      node_allocator_traits::deallocate(alloc_, slab.nodes, slab.capacity);
+    }
+    slab = Slab{};
+  }
+
+  node_type* take_slab_node() noexcept {
+    RBTREE_CHECK(slab_.used != slab_.capacity);
+    return slab_.nodes + slab_.used++;
   }
 
-  bool compare_equal(const key_type& lhs, const key_type& rhs) const {
-    return compare_less_equal(lhs, rhs) && compare_greater_equal(lhs, rhs);
+  /*
+   * Moves the element of node into the raw memory of target, which takes
+   * over all links to node. Returns target.
+   */
+  basic_node_type* relocate(basic_node_type* node, node_type* target) {
+    try {
+      construct(target, node->left, node->right, node->parent, node->color,
+                false, std::move_if_noexcept(node->get_value()));
+    } catch (...) {
+      if (slab_.owns(target)) {
+        --slab_.used;
+      } else {
+        deallocate(target);
+      }
+      throw;
+    }
+    slab_.live += slab_.owns(target) ? 1U : 0U;
+    if (node->parent->is_nil()) {
+      update_root(target);
+    } else {
+      node->replace_child_in_parent(target);
+    }
+    for (basic_node_type* child : {node->left, node->right}) {
+      if (child->is_not_nil()) {
+        child->parent = target;
+      }
+    }
+    if (nil()->right == node) {
+      nil()->right = target;
+    }
+    if constexpr (kThreadedLinks) {
+      target->prev = node->prev;
+      target->next = node->next;
+      target->prev->next = target;
+      target->next->prev = target;
+    }
+    if constexpr (kIntervalTree) {
+      static_cast<node_type*>(target)->max_end =
+          static_cast<node_type*>(node)->max_end;
+    }
+    target->balance = node->balance;
+    if (compact_cursor_ == node) {
+      compact_cursor_ = target;
+    }
+    annihilate(node);
+    return target;
+  }
+
+  static basic_node_type* successor(basic_node_type* node) noexcept {
+    return std::next(iterator(node)).current_node_;
+  }
+
+  std::vector<basic_node_type*> van_emde_boas_sequence() const {
+    std::vector<basic_node_type*> sequence;
+    sequence.reserve(size_);
+    append_van_emde_boas(root_, subtree_height(root_), sequence);
+    return sequence;
+  }
+
+  /* The top height / 2 levels, then each subtree hanging below them. */
+  static void append_van_emde_boas(basic_node_type* node, size_type height,
+                                   std::vector<basic_node_type*>& sequence) {
+    if (node->is_nil()) {
+      return;
+    }
+    if (height == 1) {
+      sequence.push_back(node);
+      return;
+    }
+    const size_type top = height / 2;
+    append_van_emde_boas(node, top, sequence);
+    append_bottom_trees(node, top, height - top, sequence);
+  }
+
+  static void append_bottom_trees(basic_node_type* node, size_type depth,
+                                  size_type height,
+                                  std::vector<basic_node_type*>& sequence) {
+    if (node->is_nil()) {
+      return;
+    }
+    if (depth == 0) {
+      append_van_emde_boas(node, height, sequence);
+      return;
+    }
+    append_bottom_trees(node->left, depth - 1, height, sequence);
+    append_bottom_trees(node->right, depth - 1, height, sequence);
+  }
+
+  static size_type subtree_height(basic_node_type* node) noexcept {
+    if (node->is_nil()) {
+      return 0;
+    }
+    return 1 + std::max(subtree_height(node->left),
+                        subtree_height(node->right));
+  }
+
+  /* Validates the whole tree at RBTREE_CHECK_LEVEL 2, see RBtreeChecks. */
+  void check_invariants() noexcept {
+    if constexpr (kRBtreeCheckLevel == rbtree_check_level::kFull) {
+      RBTREE_CHECK(
+          (RBtreeValidator<Key, T, Compare, Allocator, Policy>(*this)
+               .is_valid()));
+    }
   }
 
   void increase_size(std::size_t offset) noexcept { size_ += offset; }
 
   void decrease_size(std::size_t offset) noexcept { size_ -= offset; }
 
-  void construct_nil() {
-    NIL_ = basic_node_allocator_traits::allocate(basic_alloc_, 1);
-    std::construct_at(NIL_, NIL_, NIL_, NIL_, Color::Black, true);
-    root_ = NIL_;
+  /*=========================== Digest ================================*/
+  /* The finalizer of splitmix64, which spreads identity hashes of ints. */
+  static std::uint64_t mix_digest(std::uint64_t bits) noexcept {
+    bits = (bits ^ (bits >> 30U)) * 0xbf58476d1ce4e5b9ULL;
+    bits = (bits ^ (bits >> 27U)) * 0x94d049bb133111ebULL;
+    return bits ^ (bits >> 31U);
   }
 
-  void destroy_nil() noexcept {
-    std::destroy_at(NIL_);
-    basic_node_allocator_traits::deallocate(basic_alloc_, NIL_, 1);
+  /*
+   * The digest of the tree is the sum of those of its elements modulo
+   * 2^64: independent of the order and undone by a subtraction.
+   */
+  static std::uint64_t digest_of(const value_type& value) noexcept {
+    const content_hash_type hash{};
+    static_assert(noexcept(hash(key_of(value))),
+                  "content_hash must not throw");
+    const std::uint64_t key_digest = mix_digest(hash(key_of(value)));
+    if constexpr (kSetMode) {
+      return key_digest;
+    } else {
+      return mix_digest(key_digest + hash(value.second));
+    }
+  }
+
+  void add_digest(const basic_node_type* node) noexcept {
+    if constexpr (kContentDigest) {
+      digest_ += digest_of(node->get_value());
+    }
+  }
+
+  void remove_digest(const basic_node_type* node) noexcept {
+    if constexpr (kContentDigest) {
+      digest_ -= digest_of(node->get_value());
+    }
+  }
+
+  /*=========================== Sentinel ==============================*/
+  basic_node_type* nil() const noexcept {
+    return const_cast<basic_node_type*>(&nil_);
+  }
+
+  /* Back to the links of an empty tree: all of them to the sentinel. */
+  void reset_nil() noexcept {
+    nil_.left = nil_.right = nil_.parent = nil();
+    if constexpr (kThreadedLinks) {
+      nil_.prev = nil_.next = nil();
+    }
+    root_ = nil();
+  }
+
+  /*
+   * Moves the nodes of other into this empty tree and leaves other empty.
+   * Each object keeps its own sentinel, so every link to the one of
+   * other, from the leaves, the root and the ends of the thread, is
+   * redirected here.
+   */
+  void take(RBtree& other) noexcept {
+    RBTREE_CHECK(empty() && root_ == nil());
+    basic_node_type* other_nil = other.nil();
+    if (other.root_->is_not_nil()) {
+      redirect_links(other.root_, other_nil, nil());
+      update_root(other.root_);
+      nil_.right = other_nil->right;
+      if constexpr (kThreadedLinks) {
+        nil_.prev = other_nil->prev;
+        nil_.next = other_nil->next;
+      }
+    }
+    size_ = std::exchange(other.size_, 0);
+    digest_ = std::exchange(other.digest_, digest_type{});
+    slab_ = std::exchange(other.slab_, Slab{});
+    retired_slab_ = std::exchange(other.retired_slab_, Slab{});
+    compact_cursor_ = std::exchange(other.compact_cursor_, nullptr);
+    if (compact_cursor_ == other_nil) {
+      compact_cursor_ = nil();
+    }
+    other.reset_nil();
+  }
+
+  static void redirect_links(basic_node_type* node, basic_node_type* from,
+                             basic_node_type* to) noexcept {
+    if (node->parent == from) {
+      node->parent = to;
+    }
+    if constexpr (kThreadedLinks) {
+      if (node->prev == from) {
+        node->prev = to;
+      }
+      if (node->next == from) {
+        node->next = to;
+      }
+    }
+    for (auto direction : {&basic_node_type::left, &basic_node_type::right}) {
+      if (node->*direction == from) {
+        node->*direction = to;
+      } else {
+        redirect_links(node->*direction, from, to);
+      }
+    }
   }
 
   node_allocator_type alloc_{};
-  basic_node_allocator_type basic_alloc_{};
 
-  basic_node_type* NIL_{};
-  basic_node_type* root_{};
+  /* nil_.left is the root, nil_.right the first element. */
+  basic_node_type nil_{nil(), nil(), nil(), Color::Black, true};
+  basic_node_type* root_{nil()};
   key_compare compare_{};
   size_type size_{};
+  [[no_unique_address]] digest_type digest_{};
+  /* Block filled by compact and the one it drains, see Slab. */
+  Slab slab_;
+  Slab retired_slab_;
+  /* Next element of a running compact_step pass, nullptr between passes. */
+  basic_node_type* compact_cursor_{};
+  [[no_unique_address]] mutable rbtree_stats_collector<
+      policy_type::kCollectStats>
+      stats_;
 };
 
-template <class Key, class T, class Compare, class Allocator>
+template <class Key, class T, class Compare, class Allocator, class Policy>
 template <bool IsConst>
-class RBtree<Key, T, Compare, Allocator>::Iterator {
+class RBtree<Key, T, Compare, Allocator, Policy>::Iterator {
   /*======================== Usings and Structures =========================*/
   friend class List;
-  using rbtree = RBtree<Key, T, Compare, Allocator>;
+  using rbtree = RBtree<Key, T, Compare, Allocator, Policy>;
   using basic_node_type = rbtree::basic_node_type;
   using node_type = rbtree::node_type;
 
@@ -706,8 +2547,18 @@ class RBtree<Key, T, Compare, Allocator>::Iterator {
   using difference_type = ptrdiff_t;
   using iterator_category = std::bidirectional_iterator_tag;
   using value_type = rbtree::value_type;
-  using pointer = std::conditional_t<IsConst, const value_type*, value_type*>;
-  using reference = std::conditional_t<IsConst, const value_type&, value_type&>;
+  /*
+   * Under kContentDigest and in interval trees mapped values change only
+   * through the tree, which keeps the digest and the end maxima in step.
+   */
+  static constexpr bool kReadOnly = IsConst || rbtree::kSetMode ||
+                                    rbtree::kContentDigest ||
+                                    rbtree::kIntervalTree;
+
+  using pointer =
+      std::conditional_t<kReadOnly, const value_type*, value_type*>;
+  using reference =
+      std::conditional_t<kReadOnly, const value_type&, value_type&>;
 
   /*============================ Constructors ==============================*/
   Iterator() = default;
@@ -764,6 +2615,12 @@ class RBtree<Key, T, Compare, Allocator>::Iterator {
             basic_node_type* basic_node_type::*another_direction =
                 basic_node_type::another_direction(direction)>
   Iterator& operator_unary_step_impl() {
+    if constexpr (rbtree::kThreadedLinks) {
+      current_node_ = direction == &basic_node_type::left
+                          ? current_node_->next
+                          : current_node_->prev;
+      return *this;
+    }
     if ((current_node_->*another_direction)->is_not_nil()) {
       current_node_ = current_node_->*another_direction;
       current_node_ = current_node_->template get_most_impl<direction>();
@@ -784,4 +2641,62 @@ class RBtree<Key, T, Compare, Allocator>::Iterator {
 
   /*================================ Fields ================================*/
   basic_node_type* current_node_{nullptr};
-};
\ No newline at end of file
+};
+template <class Key, class Compare = std::less<Key>,
+          class Allocator = std::allocator<Key>,
+          class Policy = rbtree_default_policy>
+using RBset = RBtree<Key, void, Compare, Allocator, Policy>;
+
+/*
+ * Equal keys stored as nodes of their own, each new one after the others,
+ * so they keep their insertion order. No operator[], at or try_emplace.
+ */
+template <class Key, class T, class Compare = std::less<Key>,
+          class Allocator = std::allocator<std::pair<const Key, T>>,
+          class Policy = rbtree_multi_policy>
+using RBMultimap = RBtree<Key, T, Compare, Allocator, Policy>;
+
+template <class Key, class Compare = std::less<Key>,
+          class Allocator = std::allocator<Key>,
+          class Policy = rbtree_multi_policy>
+using RBMultiset = RBtree<Key, void, Compare, Allocator, Policy>;
+
+/*
+ * Interval tree keyed by the start of each interval. EndOf gives its end,
+ * by default the mapped value itself: RBIntervalMap<Key> maps start to
+ * end. Keys must be default constructible and copyable. Iterators are
+ * const; update changes a mapped value and the maxima above it.
+ */
+template <class Key, class T = Key, class EndOf = rbtree_mapped_end,
+          class Compare = std::less<Key>,
+          class Allocator = std::allocator<std::pair<const Key, T>>>
+using RBIntervalMap =
+    RBtree<Key, T, Compare, Allocator, rbtree_interval_policy<EndOf>>;
+
+namespace pmr {
+
+template <class Key, class T, class Compare = std::less<Key>,
+          class Policy = rbtree_default_policy>
+using RBtree = ::RBtree<
+    Key, T, Compare,
+    std::pmr::polymorphic_allocator<std::pair<const Key, T>>, Policy>;
+
+template <class Key, class Compare = std::less<Key>,
+          class Policy = rbtree_default_policy>
+using RBset =
+    ::RBtree<Key, void, Compare, std::pmr::polymorphic_allocator<Key>, Policy>;
+
+template <class Key, class T, class Compare = std::less<Key>,
+          class Policy = rbtree_multi_policy>
+using RBMultimap = RBtree<Key, T, Compare, Policy>;
+
+template <class Key, class Compare = std::less<Key>,
+          class Policy = rbtree_multi_policy>
+using RBMultiset = RBset<Key, Compare, Policy>;
+
+}  // namespace pmr
+
+/* Full checks need the validator, which includes this header in turn. */
+#if RBTREE_CHECK_LEVEL >= 2
+#include "RBtreeValidator.hpp"
+#endif
@@ -0,0 +1,1090 @@
+#pragma once
+#include <algorithm>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "RBtree.hpp"
+
+/* Node numbering left behind by RBtree<..., rbtree_arena_policy>::compact. */
+enum class rbtree_arena_order {
+  /* Neighbours in key order are neighbours in memory: the fastest scans. */
+  kInOrder,
+  /* Level by level: the top levels, which every lookup reads, share lines. */
+  kBreadthFirst,
+};
+
+/*
+ * RBtree with all nodes in one growable array, linked by 32-bit indices
+ * instead of pointers. Slot 0 is the sentinel, freed slots are reused
+ * through a free list, and the color lives in the top bit of the parent
+ * link, so RBtreeArena<uint32_t, uint32_t> takes 20 bytes per element
+ * against 48 of the heap chunk of an RBtree node.
+ *
+ * Iterators hold the tree and an index: unlike pointers they survive the
+ * growth of the array, but not compact(), a move or a swap of the tree.
+ * Serialization and RBtreeStats are not available for this variant.
+ */
+template <class Key, class T, class Compare, class Allocator>
+class RBtree<Key, T, Compare, Allocator, rbtree_arena_policy> {
+  static constexpr const char* kOutOfRange = "Missing element";
+  static constexpr const char* kArenaFull = "Arena index space exhausted";
+
+  static constexpr bool kSetMode = std::is_void_v<T>;
+
+  template <bool IsConst>
+  class Iterator;
+
+ public:
+  using key_type = Key;
+  using mapped_type = T;
+  using value_type =
+      std::conditional_t<kSetMode, Key, std::pair<const Key, T>>;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+  using key_compare = Compare;
+  using allocator_type = Allocator;
+  using reference = value_type&;
+  using const_reference = const value_type&;
+  using allocator_traits = std::allocator_traits<allocator_type>;
+  using pointer = typename allocator_traits::pointer;
+  using const_pointer = typename allocator_traits::const_pointer;
+  using iterator = Iterator<false>;
+  using const_iterator = Iterator<true>;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+  using policy_type = rbtree_arena_policy;
+  using index_type = std::uint32_t;
+
+  template <typename K, typename V, typename C, typename A, typename P>
+  friend class RBtreeFriendMediator;
+  template <typename K, typename V, typename C, typename A, typename P>
+  friend class RBtreeValidator;
+
+ private:
+  using value_allocator_type =
+      typename allocator_traits::template rebind_alloc<value_type>;
+  using value_allocator_traits = std::allocator_traits<value_allocator_type>;
+
+  static constexpr index_type kNil = 0;
+  /* Parent link of a slot on the free list, the top of the 31-bit range. */
+  static constexpr index_type kFreeSlot = (index_type{1} << 31) - 1;
+  static constexpr index_type kMinCapacity = 16;
+
+  /* Values that a memcpy of the node array may move. */
+  static constexpr bool kTriviallyRelocatable = [] {
+    if constexpr (kSetMode) {
+      return std::is_trivially_copyable_v<key_type>;
+    } else {
+      return std::is_trivially_copyable_v<key_type> &&
+             std::is_trivially_copyable_v<mapped_type>;
+    }
+  }();
+
+  struct Node {
+    value_type* value() noexcept {
+      return std::launder(reinterpret_cast<value_type*>(storage));
+    }
+
+    index_type left;
+    index_type right;
+    index_type parent : 31;
+    index_type red : 1;
+    alignas(value_type) std::byte storage[sizeof(value_type)];
+  };
+
+  static_assert(std::is_trivially_copyable_v<Node>);
+
+  using node_type = Node;
+  using node_allocator_type =
+      typename allocator_traits::template rebind_alloc<node_type>;
+  using node_allocator_traits = std::allocator_traits<node_allocator_type>;
+  using direction_type = index_type Node::*;
+
+  static constexpr direction_type another_direction(
+      direction_type direction) noexcept {
+    return direction == &Node::left ? &Node::right : &Node::left;
+  }
+
+ public:
+  /*========================= Member functions ========================*/
+  /* Allocates nothing until the first insertion. */
+  RBtree() noexcept = default;
+
+  explicit RBtree(const allocator_type& alloc) noexcept
+      : alloc_(alloc), node_alloc_(alloc) {}
+
+  /* One allocation, and a memcpy of the links: indices need no rewiring. */
+  RBtree(const RBtree& other)
+      : alloc_(value_allocator_traits::select_on_container_copy_construction(
+            other.alloc_)),
+        node_alloc_(alloc_),
+        compare_(other.compare_) {
+    if (other.used_ == 0) {
+      return;
+    }
+    Node* nodes = node_allocator_traits::allocate(node_alloc_, other.used_);
+    std::memcpy(static_cast<void*>(nodes), other.nodes_,
+                other.used_ * sizeof(Node));
+    index_type constructed = 1;
+    try {
+      for (; constructed < other.used_; ++constructed) {
+        if (other.nodes_[constructed].parent != kFreeSlot) {
+          value_allocator_traits::construct(alloc_, nodes[constructed].value(),
+                                            *other.nodes_[constructed].value());
+        }
+      }
+    } catch (...) {
+      destroy_values(nodes, constructed);
+      node_allocator_traits::deallocate(node_alloc_, nodes, other.used_);
+      throw;
+    }
+    nodes_ = nodes;
+    capacity_ = used_ = other.used_;
+    free_ = other.free_;
+    root_ = other.root_;
+    size_ = other.size_;
+  }
+
+  RBtree(RBtree&& other) noexcept
+      : alloc_(other.alloc_),
+        node_alloc_(other.node_alloc_),
+        compare_(std::move(other.compare_)),
+        nodes_(std::exchange(other.nodes_, nullptr)),
+        capacity_(std::exchange(other.capacity_, 0)),
+        used_(std::exchange(other.used_, 0)),
+        free_(std::exchange(other.free_, kNil)),
+        root_(std::exchange(other.root_, kNil)),
+        size_(std::exchange(other.size_, 0)) {}
+
+  RBtree& operator=(RBtree other) noexcept {
+    swap(*this, other);
+    return *this;
+  }
+
+  ~RBtree() {
+    clear();
+    if (nodes_ != nullptr) {
+      node_allocator_traits::deallocate(node_alloc_, nodes_, capacity_);
+    }
+  }
+
+  allocator_type get_allocator() const noexcept {
+    return allocator_type(alloc_);
+  }
+
+  /*========================== Element access =========================*/
+  auto& operator[](const key_type& key)
+    requires(!kSetMode)
+  {
+    return try_emplace(key).first->second;
+  }
+
+  auto& at(const key_type& key)
+    requires(!kSetMode)
+  {
+    auto found = find(key);
+    if (found == end()) {
+      throw std::out_of_range(kOutOfRange);
+    }
+    return found->second;
+  }
+
+  const auto& at(const key_type& key) const
+    requires(!kSetMode)
+  {
+    return const_cast<RBtree*>(this)->at(key);
+  }
+
+  /*============================ Iterators ============================*/
+  iterator begin() noexcept {
+    return {this, size_ == 0 ? kNil : nodes_[kNil].right};
+  }
+
+  const_iterator begin() const noexcept {
+    return const_cast<RBtree*>(this)->begin();
+  }
+
+  const_iterator cbegin() const noexcept { return begin(); }
+
+  iterator end() noexcept { return {this, kNil}; }
+
+  const_iterator end() const noexcept {
+    return const_cast<RBtree*>(this)->end();
+  }
+
+  const_iterator cend() const noexcept { return end(); }
+
+  reverse_iterator rbegin() noexcept { return reverse_iterator(end()); }
+
+  const_reverse_iterator rbegin() const noexcept {
+    return const_reverse_iterator(end());
+  }
+
+  const_reverse_iterator crbegin() const noexcept { return rbegin(); }
+
+  reverse_iterator rend() noexcept { return reverse_iterator(begin()); }
+
+  const_reverse_iterator rend() const noexcept {
+    return const_reverse_iterator(begin());
+  }
+
+  const_reverse_iterator crend() const noexcept { return rend(); }
+
+  /*============================ Capacity =============================*/
+  bool empty() const noexcept { return size_ == 0; }
+
+  size_type size() const noexcept { return size_; }
+
+  size_type max_size() const noexcept { return kFreeSlot - 1; }
+
+  /* Elements that fit without growing the array. */
+  size_type capacity() const noexcept {
+    return capacity_ == 0 ? 0 : capacity_ - 1;
+  }
+
+  /* Bytes of the node array, the sentinel and free slots included. */
+  size_type allocated_bytes() const noexcept {
+    return capacity_ * sizeof(Node);
+  }
+
+  void reserve(size_type count) {
+    if (count > max_size()) {
+      throw std::length_error(kArenaFull);
+    }
+    if (count + 1 > capacity_) {
+      grow(static_cast<index_type>(count + 1));
+    }
+  }
+
+  /*
+   * Renumbers the elements 1..size() in the given order into a new array
+   * of exactly size() + 1 slots, dropping the free list. Values are moved
+   * unless their move may throw. Invalidates every iterator.
+   */
+  void compact(rbtree_arena_order order = rbtree_arena_order::kInOrder) {
+    if (size_ == 0) {
+      clear();
+      return;
+    }
+    const std::vector<index_type> sequence = traversal(order);
+    std::vector<index_type> renumbered(used_, kNil);
+    for (index_type i = 0; i < size_; ++i) {
+      renumbered[sequence[i]] = i + 1;
+    }
+
+    const auto capacity = static_cast<index_type>(size_ + 1);
+    Node* nodes = node_allocator_traits::allocate(node_alloc_, capacity);
+    nodes[kNil] = nodes_[kNil];
+    nodes[kNil].left = renumbered[nodes_[kNil].left];
+    nodes[kNil].right = renumbered[nodes_[kNil].right];
+    nodes[kNil].parent = kNil;
+    index_type constructed = 1;
+    try {
+      for (; constructed < capacity; ++constructed) {
+        Node& source = nodes_[sequence[constructed - 1]];
+        Node& target = nodes[constructed];
+        target.left = renumbered[source.left];
+        target.right = renumbered[source.right];
+        target.parent = renumbered[source.parent] & kFreeSlot;
+        target.red = source.red;
+        value_allocator_traits::construct(alloc_, target.value(),
+                                          std::move_if_noexcept(
+                                              *source.value()));
+      }
+    } catch (...) {
+      destroy_values(nodes, constructed);
+      node_allocator_traits::deallocate(node_alloc_, nodes, capacity);
+      throw;
+    }
+
+    destroy_values(nodes_, used_);
+    node_allocator_traits::deallocate(node_alloc_, nodes_, capacity_);
+    nodes_ = nodes;
+    capacity_ = used_ = capacity;
+    free_ = kNil;
+    root_ = nodes_[kNil].left;
+    check_invariants();
+  }
+
+  /*============================ Modifiers ============================*/
+  /* Keeps the array, like std::vector::clear. */
+  void clear() noexcept {
+    if (nodes_ == nullptr) {
+      return;
+    }
+    destroy_values(nodes_, used_);
+    reset_nil();
+    size_ = 0;
+    check_invariants();
+  }
+
+  iterator erase(const_iterator pos) noexcept {
+    iterator next = std::next(iterator(this, pos.index_));
+    erase_node(pos.index_);
+    check_invariants();
+    return next;
+  }
+
+  iterator erase(const_iterator first, const_iterator last) noexcept {
+    const_iterator current = first;
+    while (current != last) {
+      erase_node(std::exchange(current, std::next(current)).index_);
+    }
+    check_invariants();
+    return {this, current.index_};
+  }
+
+  size_type erase(const key_type& key) {
+    auto pos = find(key);
+    if (pos == end()) {
+      return 0;
+    }
+    erase(pos);
+    return 1;
+  }
+
+  std::pair<iterator, bool> insert(const value_type& value) {
+    return emplace(value);
+  }
+
+  template <class P>
+  std::pair<iterator, bool> insert(P&& value) {
+    return emplace(std::forward<P>(value));
+  }
+
+  std::pair<iterator, bool> insert(value_type&& value) {
+    if constexpr (kSetMode) {
+      return emplace(std::move(value));
+    } else {
+      return emplace(std::move(const_cast<key_type&>(value.first)),
+                     std::move(value.second));
+    }
+  }
+
+  template <class... Args>
+  std::pair<iterator, bool> emplace(Args&&... args) {
+    const index_type slot = acquire_slot();
+    try {
+      value_allocator_traits::construct(alloc_, nodes_[slot].value(),
+                                        std::forward<Args>(args)...);
+    } catch (...) {
+      release_slot(slot);
+      throw;
+    }
+    return link(slot);
+  }
+
+  template <class... Args>
+  std::pair<iterator, bool> try_emplace(const key_type& k, Args&&... args)
+    requires(!kSetMode)
+  {
+    auto found = find(k);
+    if (found != end()) {
+      return {found, false};
+    }
+    return emplace(std::piecewise_construct, std::forward_as_tuple(k),
+                   std::forward_as_tuple(std::forward<Args>(args)...));
+  }
+
+  /*============================== Lookup =============================*/
+  iterator lower_bound(const key_type& key) {
+    return {this, bound<false>(key)};
+  }
+
+  iterator upper_bound(const key_type& key) {
+    return {this, bound<true>(key)};
+  }
+
+  iterator find(const key_type& key) {
+    const index_type found = bound<false>(key);
+    if (found == kNil || compare_less(key, key_at(found))) {
+      return end();
+    }
+    return {this, found};
+  }
+
+  const_iterator upper_bound(const key_type& key) const {
+    return const_cast<RBtree*>(this)->upper_bound(key);
+  }
+
+  const_iterator lower_bound(const key_type& key) const {
+    return const_cast<RBtree*>(this)->lower_bound(key);
+  }
+
+  const_iterator find(const key_type& key) const {
+    return const_cast<RBtree*>(this)->find(key);
+  }
+
+  bool contains(const key_type& key) const { return find(key) != end(); }
+
+  size_type count(const key_type& key) const {
+    return static_cast<size_type>(contains(key));
+  }
+
+  std::pair<iterator, iterator> equal_range(const key_type& key) {
+    return {lower_bound(key), upper_bound(key)};
+  }
+
+  std::pair<const_iterator, const_iterator> equal_range(
+      const key_type& key) const {
+    return const_cast<RBtree*>(this)->equal_range(key);
+  }
+
+  /*============================ Visitors =============================*/
+  /* As in RBtree: f(value) in key order, a false result stops the walk. */
+  template <typename Visitor>
+  bool visit(Visitor&& visitor) {
+    return visit_impl<false, false>(root_, nullptr, nullptr, visitor);
+  }
+
+  template <typename Visitor>
+  bool visit(Visitor&& visitor) const {
+    return const_cast<RBtree*>(this)->visit(make_const_visitor(visitor));
+  }
+
+  template <typename Visitor>
+  bool for_each_in_range(const key_type& lo, const key_type& hi,
+                         Visitor&& visitor) {
+    return visit_impl<true, true>(root_, &lo, &hi, visitor);
+  }
+
+  template <typename Visitor>
+  bool for_each_in_range(const key_type& lo, const key_type& hi,
+                         Visitor&& visitor) const {
+    return const_cast<RBtree*>(this)->for_each_in_range(
+        lo, hi, make_const_visitor(visitor));
+  }
+
+  /*============================ Observers ============================*/
+  key_compare key_comp() const noexcept { return compare_; }
+
+  /*====================== Non-member functions =======================*/
+  /* Keys by equivalence and mapped values by ==, as RBtree does. */
+  friend bool operator==(const RBtree& lhs, const RBtree& rhs) {
+    if (lhs.size() != rhs.size()) {
+      return false;
+    }
+    return std::equal(
+        lhs.begin(), lhs.end(), rhs.begin(),
+        [&](const auto& l, const auto& r) {
+          if (lhs.compare_less(key_of(l), key_of(r)) ||
+              lhs.compare_less(key_of(r), key_of(l))) {
+            return false;
+          }
+          if constexpr (kSetMode) {
+            return true;
+          } else {
+            return l.second == r.second;
+          }
+        });
+  }
+
+  /* Keys first, mapped values break the ties as in std::map. */
+  friend auto operator<=>(const RBtree& lhs, const RBtree& rhs) {
+    const auto compare_pred = [&](const auto& l,
+                                  const auto& r) -> std::weak_ordering {
+      if (lhs.compare_less(key_of(l), key_of(r))) {
+        return std::weak_ordering::less;
+      }
+      if (lhs.compare_less(key_of(r), key_of(l))) {
+        return std::weak_ordering::greater;
+      }
+      if constexpr (kSetMode) {
+        return std::weak_ordering::equivalent;
+      } else {
+        return std::compare_weak_order_fallback(l.second, r.second);
+      }
+    };
+    return std::lexicographical_compare_three_way(
+        lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), compare_pred);
+  }
+
+  friend void swap(RBtree& lhs, RBtree& rhs) noexcept {
+    using std::swap;
+    swap(lhs.alloc_, rhs.alloc_);
+    swap(lhs.node_alloc_, rhs.node_alloc_);
+    swap(lhs.compare_, rhs.compare_);
+    swap(lhs.nodes_, rhs.nodes_);
+    swap(lhs.capacity_, rhs.capacity_);
+    swap(lhs.used_, rhs.used_);
+    swap(lhs.free_, rhs.free_);
+    swap(lhs.root_, rhs.root_);
+    swap(lhs.size_, rhs.size_);
+  }
+
+  template <typename Pred>
+  requires std::is_nothrow_invocable_r_v<bool, Pred,
+                                         typename RBtree::value_type>
+      size_type erase_if(Pred pred)
+  noexcept {
+    RBtree::size_type result = 0;
+    iterator current = begin();
+    while (current != end()) {
+      if (pred(*current)) {
+        erase_node(std::exchange(current, std::next(current)).index_);
+        ++result;
+      } else {
+        ++current;
+      }
+    }
+    check_invariants();
+    return result;
+  }
+
+ private:
+  /*============================= Slots ===============================*/
+  index_type acquire_slot() {
+    if (free_ != kNil) {
+      const index_type slot = free_;
+      free_ = nodes_[slot].left;
+      return slot;
+    }
+    if (used_ == capacity_) {
+      if (capacity_ >= kFreeSlot) {
+        throw std::length_error(kArenaFull);
+      }
+      /* 1.5x keeps the slack of a huge arena and the copy peak lower. */
+      const std::uint64_t wanted = std::max<std::uint64_t>(
+          kMinCapacity, std::uint64_t{capacity_} + capacity_ / 2);
+      grow(static_cast<index_type>(
+          std::min<std::uint64_t>(wanted, kFreeSlot)));
+    }
+    if (used_ == 0) {
+      reset_nil();
+    }
+    return used_++;
+  }
+
+  /* Only the sentinel in use: begin() == end() == slot 0. */
+  void reset_nil() noexcept {
+    Node& nil = nodes_[kNil];
+    nil.left = nil.right = kNil;
+    nil.parent = kNil;
+    nil.red = 0U;
+    used_ = 1;
+    free_ = kNil;
+    root_ = kNil;
+  }
+
+  /* The slot holds no value, either never constructed or destroyed. */
+  void release_slot(index_type slot) noexcept {
+    nodes_[slot].left = free_;
+    nodes_[slot].parent = kFreeSlot;
+    free_ = slot;
+  }
+
+  void grow(index_type capacity) {
+    Node* nodes = node_allocator_traits::allocate(node_alloc_, capacity);
+    if (nodes_ != nullptr) {
+      try {
+        relocate(nodes);
+      } catch (...) {
+        node_allocator_traits::deallocate(node_alloc_, nodes, capacity);
+        throw;
+      }
+      node_allocator_traits::deallocate(node_alloc_, nodes_, capacity_);
+    }
+    nodes_ = nodes;
+    capacity_ = capacity;
+  }
+
+  /* Moves the used slots to nodes, keeping the old ones on a throw. */
+  void relocate(Node* nodes) {
+    std::memcpy(static_cast<void*>(nodes), nodes_, used_ * sizeof(Node));
+    if constexpr (!kTriviallyRelocatable) {
+      index_type constructed = 1;
+      try {
+        for (; constructed < used_; ++constructed) {
+          if (nodes_[constructed].parent != kFreeSlot) {
+            value_allocator_traits::construct(
+                alloc_, nodes[constructed].value(),
+                std::move_if_noexcept(*nodes_[constructed].value()));
+          }
+        }
+      } catch (...) {
+        destroy_values(nodes, constructed);
+        throw;
+      }
+      destroy_values(nodes_, used_);
+    }
+  }
+
+  /* Values of the live slots in [1, count). */
+  void destroy_values(Node* nodes, index_type count) noexcept {
+    if constexpr (!std::is_trivially_destructible_v<value_type>) {
+      for (index_type slot = 1; slot < count; ++slot) {
+        if (nodes[slot].parent != kFreeSlot) {
+          value_allocator_traits::destroy(alloc_, nodes[slot].value());
+        }
+      }
+    }
+  }
+
+  std::vector<index_type> traversal(rbtree_arena_order order) const {
+    std::vector<index_type> sequence;
+    sequence.reserve(size_);
+    if (order == rbtree_arena_order::kInOrder) {
+      for (auto it = begin(); it != end(); ++it) {
+        sequence.push_back(it.index_);
+      }
+      return sequence;
+    }
+    /* The sequence is its own queue. */
+    sequence.push_back(root_);
+    for (size_type i = 0; i < sequence.size(); ++i) {
+      const Node& node = nodes_[sequence[i]];
+      for (const index_type child : {node.left, node.right}) {
+        if (child != kNil) {
+          sequence.push_back(child);
+        }
+      }
+    }
+    return sequence;
+  }
+
+  /*============================= Access ==============================*/
+  value_type& value_at(index_type index) const noexcept {
+    return *nodes_[index].value();
+  }
+
+  const key_type& key_at(index_type index) const noexcept {
+    return key_of(value_at(index));
+  }
+
+  static const key_type& key_of(const value_type& value) noexcept {
+    if constexpr (kSetMode) {
+      return value;
+    } else {
+      return value.first;
+    }
+  }
+
+  index_type parent_of(index_type index) const noexcept {
+    return nodes_[index].parent;
+  }
+
+  void set_parent(index_type index, index_type parent) noexcept {
+    nodes_[index].parent = parent & kFreeSlot;
+  }
+
+  bool is_red(index_type index) const noexcept {
+    return nodes_[index].red != 0U;
+  }
+
+  void paint(index_type index, bool red) noexcept {
+    nodes_[index].red = red ? 1U : 0U;
+  }
+
+  bool is_left(index_type index) const noexcept {
+    return nodes_[parent_of(index)].left == index;
+  }
+
+  void replace_child_in_parent(index_type index,
+                               index_type new_child) noexcept {
+    Node& parent = nodes_[parent_of(index)];
+    if (parent.left == index) {
+      parent.left = new_child;
+    } else {
+      parent.right = new_child;
+    }
+  }
+
+  template <direction_type direction>
+  index_type most(index_type index) const noexcept {
+    if (index == kNil) {
+      return index;
+    }
+    while (nodes_[index].*direction != kNil) {
+      index = nodes_[index].*direction;
+    }
+    return index;
+  }
+
+  void update_root(index_type new_root) noexcept {
+    root_ = new_root;
+    nodes_[kNil].left = new_root;
+  }
+
+  /*============================= Lookup ==============================*/
+  /* First element not less than key, or greater than it when kUpper. */
+  template <bool kUpper>
+  index_type bound(const key_type& key) const {
+    index_type found = kNil;
+    index_type current = root_;
+    while (current != kNil) {
+      const Node& node = nodes_[current];
+      const bool go_left = kUpper ? compare_less(key, key_at(current))
+                                  : !compare_less(key_at(current), key);
+      found = go_left ? current : found;
+      current = go_left ? node.left : node.right;
+    }
+    return found;
+  }
+
+  bool compare_less(const key_type& lhs, const key_type& rhs) const {
+    return compare_(lhs, rhs);
+  }
+
+  template <bool kLowBound, bool kHighBound, typename Visitor>
+  bool visit_impl(index_type index, const key_type* lo, const key_type* hi,
+                  Visitor& visitor) {
+    while (index != kNil) {
+      if constexpr (kLowBound) {
+        if (compare_less(key_at(index), *lo)) {
+          index = nodes_[index].right;
+          continue;
+        }
+      }
+      if constexpr (kHighBound) {
+        if (!compare_less(key_at(index), *hi)) {
+          index = nodes_[index].left;
+          continue;
+        }
+      }
+      if (!visit_impl<kLowBound, false>(nodes_[index].left, lo, hi,
+                                        visitor) ||
+          !call_visitor(visitor, *iterator(this, index))) {
+        return false;
+      }
+      if constexpr (kLowBound) {
+        return visit_impl<false, kHighBound>(nodes_[index].right, lo, hi,
+                                             visitor);
+      } else {
+        index = nodes_[index].right;
+      }
+    }
+    return true;
+  }
+
+  template <typename Visitor, typename Value>
+  static bool call_visitor(Visitor& visitor, Value& value) {
+    if constexpr (std::is_void_v<std::invoke_result_t<Visitor&, Value&>>) {
+      std::invoke(visitor, value);
+      return true;
+    } else {
+      return static_cast<bool>(std::invoke(visitor, value));
+    }
+  }
+
+  template <typename Visitor>
+  static auto make_const_visitor(Visitor& visitor) {
+    return [&visitor](const value_type& value) {
+      return call_visitor(visitor, value);
+    };
+  }
+
+  /*============================ Balancing ============================*/
+  /* RBtree::insert with indices: one comparison per level. */
+  std::pair<iterator, bool> link(index_type new_index) {
+    const key_type& key = key_at(new_index);
+    index_type parent = kNil;
+    direction_type side = &Node::left;
+    index_type not_less = kNil;
+    bool leftmost = true;
+
+    for (index_type current = root_; current != kNil;
+         current = nodes_[current].*side) {
+      parent = current;
+      if (compare_less(key_at(current), key)) {
+        side = &Node::right;
+      } else {
+        not_less = current;
+        side = &Node::left;
+      }
+      leftmost = leftmost && side == &Node::left;
+    }
+
+    if (not_less != kNil && !compare_less(key, key_at(not_less))) {
+      value_allocator_traits::destroy(alloc_, nodes_[new_index].value());
+      release_slot(new_index);
+      return {{this, not_less}, false};
+    }
+
+    Node& node = nodes_[new_index];
+    node.left = node.right = kNil;
+    set_parent(new_index, parent);
+    paint(new_index, true);
+    if (leftmost) {
+      nodes_[kNil].right = new_index;
+    }
+    if (parent == kNil) {
+      update_root(new_index);
+    } else {
+      nodes_[parent].*side = new_index;
+    }
+    ++size_;
+    insert_fixup(new_index);
+    check_invariants();
+    return {{this, new_index}, true};
+  }
+
+  void insert_fixup(index_type current) noexcept {
+    while (is_red(parent_of(current))) {
+      if (is_left(parent_of(current))) {
+        current = insert_fixup_impl<&Node::left>(current);
+      } else {
+        current = insert_fixup_impl<&Node::right>(current);
+      }
+    }
+    paint(root_, false);
+  }
+
+  template <direction_type direction,
+            direction_type another = another_direction(direction)>
+  index_type insert_fixup_impl(index_type current) noexcept {
+    index_type parent = parent_of(current);
+    const index_type grandparent = parent_of(parent);
+    const index_type uncle = nodes_[grandparent].*another;
+    if (is_red(uncle)) {
+      paint(parent, false);
+      paint(uncle, false);
+      paint(grandparent, true);
+      return grandparent;
+    }
+    if (current == nodes_[parent].*another) {
+      rotate<direction>(parent);
+      std::swap(parent, current);
+    }
+    paint(parent, false);
+    paint(grandparent, true);
+    rotate<another>(grandparent);
+    return current;
+  }
+
+  /* RBtree::erase with indices: the successor takes the place of the node. */
+  void erase_node(index_type delete_node) noexcept {
+    const Node& deleted = nodes_[delete_node];
+    const index_type instead_node =
+        deleted.left == kNil || deleted.right == kNil
+            ? delete_node
+            : most<&Node::left>(deleted.right);
+    const bool instead_red = is_red(instead_node);
+    const index_type restored_node = nodes_[instead_node].left != kNil
+                                         ? nodes_[instead_node].left
+                                         : nodes_[instead_node].right;
+
+    set_parent(restored_node, parent_of(instead_node));
+    if (parent_of(delete_node) == kNil) {
+      update_root(instead_node);
+    }
+    if (parent_of(instead_node) == kNil) {
+      update_root(restored_node);
+    } else {
+      replace_child_in_parent(instead_node, restored_node);
+    }
+
+    if (instead_node != delete_node) {
+      if (parent_of(delete_node) != kNil) {
+        replace_child_in_parent(delete_node, instead_node);
+      }
+      Node& instead = nodes_[instead_node];
+      set_parent(instead_node, parent_of(delete_node));
+      instead.left = nodes_[delete_node].left;
+      instead.right = nodes_[delete_node].right;
+      set_parent(instead.left, instead_node);
+      set_parent(instead.right, instead_node);
+      instead.red = nodes_[delete_node].red;
+    }
+
+    if (!instead_red) {
+      erase_fixup(restored_node);
+    }
+
+    update_begin_on_erase(delete_node, instead_node, restored_node);
+    value_allocator_traits::destroy(alloc_, nodes_[delete_node].value());
+    release_slot(delete_node);
+    --size_;
+  }
+
+  void update_begin_on_erase(index_type delete_node, index_type instead_node,
+                             index_type restored_node) noexcept {
+    if (nodes_[kNil].right != delete_node) {
+      return;
+    }
+    if (instead_node != delete_node) {
+      nodes_[kNil].right = instead_node;
+    } else if (restored_node == kNil) {
+      nodes_[kNil].right = parent_of(delete_node);
+    } else {
+      nodes_[kNil].right = restored_node;
+    }
+  }
+
+  void erase_fixup(index_type restored_node) noexcept {
+    while (restored_node != root_ && !is_red(restored_node)) {
+      if (is_left(restored_node)) {
+        restored_node = erase_fixup_impl<&Node::left>(restored_node);
+      } else {
+        restored_node = erase_fixup_impl<&Node::right>(restored_node);
+      }
+    }
+    paint(restored_node, false);
+  }
+
+  template <direction_type direction,
+            direction_type another = another_direction(direction)>
+  index_type erase_fixup_impl(index_type current) noexcept {
+    const index_type parent = parent_of(current);
+    index_type brother = nodes_[parent].*another;
+    if (is_red(brother)) {
+      paint(brother, false);
+      paint(parent, true);
+      rotate<direction>(parent);
+      brother = nodes_[parent].*another;
+    }
+    if (!is_red(nodes_[brother].*direction) &&
+        !is_red(nodes_[brother].*another)) {
+      paint(brother, true);
+      return parent;
+    }
+    if (!is_red(nodes_[brother].*another)) {
+      paint(nodes_[brother].*direction, false);
+      paint(brother, true);
+      rotate<another>(brother);
+      brother = nodes_[parent].*another;
+    }
+    paint(brother, is_red(parent));
+    paint(parent, false);
+    paint(nodes_[brother].*another, false);
+    rotate<direction>(parent);
+    return root_;
+  }
+
+  template <direction_type direction,
+            direction_type another = another_direction(direction)>
+  void rotate(index_type node) noexcept {
+    const index_type child = nodes_[node].*another;
+    if (parent_of(node) == kNil) {
+      update_root(child);
+    } else {
+      replace_child_in_parent(node, child);
+    }
+    set_parent(child, parent_of(node));
+    set_parent(node, child);
+    nodes_[node].*another = nodes_[child].*direction;
+    if (nodes_[node].*another != kNil) {
+      set_parent(nodes_[node].*another, node);
+    }
+    nodes_[child].*direction = node;
+  }
+
+  /*============================= Checks ==============================*/
+  /* Validates the whole tree at RBTREE_CHECK_LEVEL 2, see RBtreeChecks. */
+  void check_invariants() noexcept {
+    if constexpr (kRBtreeCheckLevel == rbtree_check_level::kFull) {
+      RBTREE_CHECK(
+          (RBtreeValidator<Key, T, Compare, Allocator, rbtree_arena_policy>(
+               *this)
+               .is_valid()));
+    }
+  }
+
+  /*============================== Fields =============================*/
+  [[no_unique_address]] value_allocator_type alloc_{};
+  [[no_unique_address]] node_allocator_type node_alloc_{};
+  [[no_unique_address]] key_compare compare_{};
+  Node* nodes_{};
+  index_type capacity_{};
+  /* Slots handed out so far, the sentinel included. */
+  index_type used_{};
+  /* Head of the free list, linked through left. */
+  index_type free_{kNil};
+  index_type root_{kNil};
+  size_type size_{};
+};
+
+template <class Key, class T, class Compare, class Allocator>
+template <bool IsConst>
+class RBtree<Key, T, Compare, Allocator, rbtree_arena_policy>::Iterator {
+  /*======================== Usings and Structures =========================*/
+  using rbtree = RBtree<Key, T, Compare, Allocator, rbtree_arena_policy>;
+  using index_type = rbtree::index_type;
+  using node_type = rbtree::node_type;
+
+ public:
+  using difference_type = ptrdiff_t;
+  using iterator_category = std::bidirectional_iterator_tag;
+  using value_type = rbtree::value_type;
+  using pointer = std::conditional_t<IsConst || rbtree::kSetMode,
+                                     const value_type*, value_type*>;
+  using reference = std::conditional_t<IsConst || rbtree::kSetMode,
+                                       const value_type&, value_type&>;
+
+  /*============================ Constructors ==============================*/
+  Iterator() = default;
+
+  Iterator(rbtree* tree, index_type index) : tree_(tree), index_(index) {}
+
+  /*============================== Operators ===============================*/
+  Iterator& operator++() { return step<&node_type::left>(); }
+
+  Iterator& operator--() { return step<&node_type::right>(); }
+
+  Iterator operator++(int) {
+    Iterator result = *this;
+    ++*this;
+    return result;
+  }
+
+  Iterator operator--(int) {
+    Iterator result = *this;
+    --*this;
+    return result;
+  }
+
+  reference operator*() const { return tree_->value_at(index_); }
+
+  pointer operator->() const { return std::addressof(**this); }
+
+  bool operator==(const Iterator& other) const {
+    return index_ == other.index_;
+  }
+
+  bool operator!=(const Iterator& other) const { return !(*this == other); }
+
+  operator Iterator<true>() const { return Iterator<true>(tree_, index_); }
+
+ private:
+  friend rbtree;
+
+  operator Iterator<false>() const { return Iterator<false>(tree_, index_); }
+
+  /* Towards the most direction-ward node of the other subtree, or up. */
+  template <typename rbtree::direction_type direction,
+            typename rbtree::direction_type another =
+                rbtree::another_direction(direction)>
+  Iterator& step() {
+    const node_type* nodes = tree_->nodes_;
+    if (nodes[index_].*another != rbtree::kNil) {
+      index_ = tree_->template most<direction>(nodes[index_].*another);
+      return *this;
+    }
+    index_type parent = nodes[index_].parent;
+    while (parent != rbtree::kNil && nodes[parent].*another == index_) {
+      index_ = parent;
+      parent = nodes[parent].parent;
+    }
+    index_ = parent;
+    return *this;
+  }
+
+  /*================================ Fields ================================*/
+  rbtree* tree_{nullptr};
+  index_type index_{0};
+};
+
+template <class Key, class T, class Compare = std::less<Key>,
+          class Allocator = std::allocator<std::pair<const Key, T>>>
+using RBtreeArena = RBtree<Key, T, Compare, Allocator, rbtree_arena_policy>;
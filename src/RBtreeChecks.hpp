@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+/*
+ * Self-checks of the trees, chosen per translation unit by defining
+ * RBTREE_CHECK_LEVEL before the first include, or through the CMake cache
+ * variable of the same name:
+ *   0  off:   nothing is checked;
+ *   1  cheap: O(1) assertions, RBTREE_CHECK;
+ *   2  full:  in addition RBtreeValidator runs over the whole tree after
+ *             every mutation, which makes each of them O(n).
+ * Without a definition the level is 1, or 0 under NDEBUG. Every translation
+ * unit of a program that shares a tree type must use the same level.
+ */
+#ifndef RBTREE_CHECK_LEVEL
+#ifdef NDEBUG
+#define RBTREE_CHECK_LEVEL 0
+#else
+#define RBTREE_CHECK_LEVEL 1
+#endif
+#endif
+
+enum class rbtree_check_level { kOff, kCheap, kFull };
+
+inline constexpr rbtree_check_level kRBtreeCheckLevel =
+    static_cast<rbtree_check_level>(RBTREE_CHECK_LEVEL);
+
+static_assert(kRBtreeCheckLevel >= rbtree_check_level::kOff &&
+                  kRBtreeCheckLevel <= rbtree_check_level::kFull,
+              "RBTREE_CHECK_LEVEL must be 0, 1 or 2");
+
+[[noreturn]] inline void rbtree_check_failed(const char* condition,
+                                             const char* file,
+                                             int line) noexcept {
+  std::fprintf(stderr, "%s:%d: RBtree check failed: %s\n", file, line,
+               condition);
+  std::abort();
+}
+
+/* Unlike assert, independent of NDEBUG; the condition is not evaluated at 0. */
+#define RBTREE_CHECK(condition)                                      \
+  do {                                                               \
+    if constexpr (kRBtreeCheckLevel >= rbtree_check_level::kCheap) { \
+      if (!(condition)) {                                            \
+        rbtree_check_failed(#condition, __FILE__, __LINE__);         \
+      }                                                              \
+    }                                                                \
+  } while (false)
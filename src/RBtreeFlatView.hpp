@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+
+#include "RBtreeSerialization.hpp"
+
+/*
+ * Read-only view over a flat file written by RBtree::serialize(), e.g. one
+ * mapped with mmap(). Lookups run in place over the sorted key section, the
+ * file is never deserialized. With T = void it views the file of a set,
+ * which has no mapped section, and the access to mapped values is gone.
+ */
+template <class Key, class T, class Compare = std::less<Key>>
+requires std::is_trivially_copyable_v<Key> &&
+    (std::is_void_v<T> || std::is_trivially_copyable_v<T>)
+class RBtreeFlatView {
+  static constexpr const char* kBadFile = "Bad flat file";
+  static constexpr const char* kOutOfRange = "Missing element";
+
+  static constexpr bool kSetMode = std::is_void_v<T>;
+
+  static constexpr std::size_t kMappedSize = [] {
+    if constexpr (kSetMode) {
+      return std::size_t{0};
+    } else {
+      return sizeof(T);
+    }
+  }();
+
+  struct NoMapped {};
+
+  using mapped_span_type =
+      std::conditional_t<kSetMode, NoMapped, std::span<const T>>;
+
+ public:
+  using key_type = Key;
+  using mapped_type = T;
+  using size_type = std::size_t;
+  using key_compare = Compare;
+
+  RBtreeFlatView(const void* data, size_type size, Compare compare = Compare())
+      : data_(static_cast<const char*>(data)), compare_(compare) {
+    if (size < sizeof(rbtree_file_header)) {
+      throw std::runtime_error(kBadFile);
+    }
+    rbtree_file_header header{};
+    std::memcpy(&header, data_, sizeof(header));
+    if (!rbtree_file_header::is_flat_count_valid(
+            header.count, sizeof(key_type), kMappedSize)) {
+      throw std::runtime_error(kBadFile);
+    }
+    const auto count = static_cast<size_type>(header.count);
+    const size_type payload_bytes = rbtree_file_header::flat_payload_bytes(
+        count, sizeof(key_type), kMappedSize);
+    if (header.magic != rbtree_file_header::kMagic ||
+        header.version != rbtree_file_header::kVersion || !header.is_flat() ||
+        header.key_size != sizeof(key_type) ||
+        header.mapped_size != kMappedSize ||
+        header.payload_bytes != payload_bytes ||
+        size < sizeof(header) + payload_bytes + sizeof(std::uint64_t) ||
+        !is_aligned<key_type>(data_)) {
+      throw std::runtime_error(kBadFile);
+    }
+    keys_ = {reinterpret_cast<const key_type*>(
+                 data_ + rbtree_file_header::keys_offset()),
+             count};
+    if constexpr (!kSetMode) {
+      if (!is_aligned<mapped_type>(data_)) {
+        throw std::runtime_error(kBadFile);
+      }
+      mapped_ = {reinterpret_cast<const mapped_type*>(
+                     data_ + rbtree_file_header::mapped_offset(
+                                 count, sizeof(key_type))),
+                 count};
+    }
+  }
+
+  /*========================== Element access =========================*/
+  const auto& at(const key_type& key) const
+    requires(!kSetMode)
+  {
+    const mapped_type* found = find(key);
+    if (found == nullptr) {
+      throw std::out_of_range(kOutOfRange);
+    }
+    return *found;
+  }
+
+  const key_type& key(size_type index) const noexcept { return keys_[index]; }
+
+  const auto& mapped(size_type index) const noexcept
+    requires(!kSetMode)
+  {
+    return mapped_[index];
+  }
+
+  /*============================ Capacity =============================*/
+  bool empty() const noexcept { return keys_.empty(); }
+
+  size_type size() const noexcept { return keys_.size(); }
+
+  /*============================== Lookup =============================*/
+  /* Index of the first key not less than key, size() if there is none. */
+  size_type lower_bound(const key_type& key) const {
+    return static_cast<size_type>(
+        std::lower_bound(keys_.begin(), keys_.end(), key, compare_) -
+        keys_.begin());
+  }
+
+  size_type upper_bound(const key_type& key) const {
+    return static_cast<size_type>(
+        std::upper_bound(keys_.begin(), keys_.end(), key, compare_) -
+        keys_.begin());
+  }
+
+  const auto* find(const key_type& key) const
+    requires(!kSetMode)
+  {
+    const size_type index = lower_bound(key);
+    return holds_key(key, index) ? std::addressof(mapped_[index]) : nullptr;
+  }
+
+  bool contains(const key_type& key) const {
+    return holds_key(key, lower_bound(key));
+  }
+
+  /* Recomputes the payload checksum, O(n) over the whole file. */
+  bool verify_checksum() const noexcept {
+    rbtree_file_header header{};
+    std::memcpy(&header, data_, sizeof(header));
+    const char* payload = data_ + rbtree_file_header::keys_offset();
+    std::uint64_t stored = 0;
+    std::memcpy(&stored, payload + header.payload_bytes, sizeof(stored));
+    rbtree_checksum checksum;
+    checksum.update(payload, header.payload_bytes);
+    return checksum.value() == stored;
+  }
+
+  /*============================ Observers ============================*/
+  key_compare key_comp() const noexcept { return compare_; }
+
+ private:
+  /* Whether index, the lower bound of key, holds key itself. */
+  bool holds_key(const key_type& key, size_type index) const {
+    return index != size() && !compare_(key, keys_[index]);
+  }
+
+  template <typename Type>
+  static bool is_aligned(const char* pointer) noexcept {
+    return reinterpret_cast<std::uintptr_t>(pointer) % alignof(Type) == 0;
+  }
+
+  const char* data_;
+  std::span<const key_type> keys_;
+  [[no_unique_address]] mapped_span_type mapped_;
+  key_compare compare_;
+};
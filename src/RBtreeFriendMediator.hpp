@@ -1,18 +1,29 @@
 #pragma once
 #include "RBtree.hpp"
 
-template <class Key, class T, class Compare, class Allocator>
+template <class Key, class T, class Compare, class Allocator, class Policy>
 class RBtreeFriendMediator {
  public:
-  using tree_type = RBtree<Key, T, Compare, Allocator>;
+  using tree_type = RBtree<Key, T, Compare, Allocator, Policy>;
   using node_type = tree_type::basic_node_type;
+  using value_node_type = tree_type::node_type;
 
   RBtreeFriendMediator() = delete;
   RBtreeFriendMediator(tree_type& tree) : tree_(tree) {}
 
   auto& get_root() { return tree_.root_; }
-  auto& get_NIL() { return tree_.NIL_; }
+  auto* get_NIL() { return tree_.nil(); }
   auto& get_compare() { return tree_.compare_; }
+  auto& get_size() { return tree_.size_; }
+  auto& get_digest() { return tree_.digest_; }
+
+  bool compare_less(const Key& lhs, const Key& rhs) const {
+    return tree_.less_uncounted(lhs, rhs);
+  }
+
+  static std::uint64_t digest_of(const tree_type::value_type& value) {
+    return tree_type::digest_of(value);
+  }
 
  private:
   tree_type& tree_;
@@ -0,0 +1,206 @@
+#pragma once
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * Minimal lazy generator, the part of C++23 std::generator that the scans
+ * below need. The coroutine runs only while the consumer advances, and a
+ * yielded reference stays valid until the next advance.
+ */
+template <class Reference>
+class RBtreeGenerator {
+ public:
+  using value_type = std::remove_cvref_t<Reference>;
+
+  struct promise_type;
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  struct promise_type {
+    RBtreeGenerator get_return_object() noexcept {
+      return RBtreeGenerator(handle_type::from_promise(*this));
+    }
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    std::suspend_always final_suspend() noexcept { return {}; }
+
+    std::suspend_always yield_value(Reference value) noexcept {
+      current = std::addressof(value);
+      return {};
+    }
+
+    void return_void() noexcept {}
+
+    void unhandled_exception() noexcept {
+      exception = std::current_exception();
+    }
+
+    std::add_pointer_t<Reference> current{};
+    std::exception_ptr exception;
+  };
+
+  class iterator {
+   public:
+    using value_type = RBtreeGenerator::value_type;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+
+    Reference operator*() const {
+      return static_cast<Reference>(*handle_.promise().current);
+    }
+
+    iterator& operator++() {
+      resume(handle_);
+      return *this;
+    }
+
+    void operator++(int) { ++*this; }
+
+    bool operator==(std::default_sentinel_t /*unused*/) const noexcept {
+      return handle_.done();
+    }
+
+   private:
+    friend RBtreeGenerator;
+
+    explicit iterator(handle_type handle) noexcept : handle_(handle) {}
+
+    handle_type handle_;
+  };
+
+  RBtreeGenerator(RBtreeGenerator&& other) noexcept
+      : handle_(std::exchange(other.handle_, nullptr)) {}
+
+  RBtreeGenerator& operator=(RBtreeGenerator other) noexcept {
+    std::swap(handle_, other.handle_);
+    return *this;
+  }
+
+  ~RBtreeGenerator() {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+
+  /* Single pass: runs the coroutine up to its first yield. */
+  iterator begin() {
+    resume(handle_);
+    return iterator(handle_);
+  }
+
+  std::default_sentinel_t end() const noexcept { return {}; }
+
+ private:
+  explicit RBtreeGenerator(handle_type handle) noexcept : handle_(handle) {}
+
+  static void resume(handle_type handle) {
+    handle.resume();
+    if (handle.promise().exception) {
+      std::rethrow_exception(std::exchange(handle.promise().exception, {}));
+    }
+  }
+
+  handle_type handle_;
+};
+
+enum class rbtree_scan_mode {
+  /*
+   * Keeps the iterator between batches. The tree may change while the scan
+   * is suspended, except for erasing the element after the last yielded one.
+   */
+  kStable,
+  /*
+   * Finds the next element again after every batch with one upper_bound
+   * descent from the last yielded key, so any element may be erased while
+   * the scan is suspended.
+   */
+  kEraseSafe,
+};
+
+/* The key of an element of a map or of a set. */
+template <class Tree>
+const typename Tree::key_type& rbtree_key_of(
+    const typename Tree::value_type& value) noexcept {
+  if constexpr (std::is_same_v<typename Tree::key_type,
+                               typename Tree::value_type>) {
+    return value;
+  } else {
+    return value.first;
+  }
+}
+
+template <class Tree>
+using rbtree_batch_generator =
+    RBtreeGenerator<const std::vector<typename Tree::value_type>&>;
+
+/* GCC warns about the switch it generates for the coroutine's resume points. */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wswitch-default"
+template <class Tree>
+rbtree_batch_generator<Tree> rbtree_scan_impl(Tree& tree,
+                                              typename Tree::key_type start,
+                                              bool after_start,
+                                              typename Tree::key_type hi,
+                                              std::size_t batch_size,
+                                              rbtree_scan_mode mode) {
+  const auto compare = tree.key_comp();
+  std::vector<typename Tree::value_type> batch;
+  batch.reserve(batch_size);
+  auto it = after_start ? tree.upper_bound(start) : tree.lower_bound(start);
+  while (true) {
+    batch.clear();
+    for (; batch.size() < batch_size && it != tree.end() &&
+           compare(rbtree_key_of<Tree>(*it), hi);
+         ++it) {
+      batch.push_back(*it);
+    }
+    if (batch.empty()) {
+      co_return;
+    }
+    for (; it != tree.end() && compare(rbtree_key_of<Tree>(*it), hi) &&
+           !compare(rbtree_key_of<Tree>(batch.back()),
+                    rbtree_key_of<Tree>(*it));
+         ++it) {
+      batch.push_back(*it);
+    }
+    co_yield batch;
+    if (mode == rbtree_scan_mode::kEraseSafe) {
+      it = tree.upper_bound(rbtree_key_of<Tree>(batch.back()));
+    }
+  }
+}
+#pragma GCC diagnostic pop
+
+/*
+ * Lazily copies the elements in [lo, hi) out of the tree in batches of
+ * batch_size, the last one possibly shorter. Keep the key of the last
+ * element of a batch to continue later with rbtree_scan_after. In either
+ * mode a batch never splits a run of equal keys of a multi tree, so that
+ * the resumed scan misses none of them: it grows past batch_size to take
+ * the rest of the run.
+ */
+template <class Tree>
+rbtree_batch_generator<Tree> rbtree_scan(
+    Tree& tree, typename Tree::key_type lo, typename Tree::key_type hi,
+    std::size_t batch_size,
+    rbtree_scan_mode mode = rbtree_scan_mode::kStable) {
+  return rbtree_scan_impl(tree, std::move(lo), false, std::move(hi),
+                          batch_size, mode);
+}
+
+/* The elements in (after, hi), found with a single descent. */
+template <class Tree>
+rbtree_batch_generator<Tree> rbtree_scan_after(
+    Tree& tree, typename Tree::key_type after, typename Tree::key_type hi,
+    std::size_t batch_size,
+    rbtree_scan_mode mode = rbtree_scan_mode::kStable) {
+  return rbtree_scan_impl(tree, std::move(after), true, std::move(hi),
+                          batch_size, mode);
+}
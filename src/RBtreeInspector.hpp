@@ -0,0 +1,160 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "RBtreeFriendMediator.hpp"
+
+struct RBtreeShape {
+  std::size_t size{};
+  /* Nodes on the longest root-to-leaf path. */
+  std::size_t height{};
+  /* Black nodes on every root-to-leaf path. */
+  std::size_t black_height{};
+  /* Nodes visited by a lookup that stops at its element. */
+  double average_depth{};
+  /* Nodes visited by a lower_bound descent, which always ends at a leaf. */
+  double average_descent{};
+  /* Elements per level, the root is level 0. */
+  std::vector<std::size_t> depth_histogram;
+  /* Expected cache lines touched by one lower_bound descent. */
+  double cache_lines_per_lookup{};
+};
+
+struct RBtreeMemory {
+  std::size_t basic_node_size{};
+  std::size_t node_size{};
+  std::size_t value_size{};
+  /* Bytes of a node that hold neither links, color nor the value. */
+  std::size_t node_padding{};
+  /* sizeof of all nodes; the sentinel is a member of the tree object. */
+  std::size_t node_bytes{};
+  /* node_bytes plus the per-allocation overhead of a general purpose malloc. */
+  std::size_t estimated_heap_bytes{};
+};
+
+/*
+ * Read-only shape and memory report for capacity planning. Every call walks
+ * the whole tree once, O(n) time and O(height) stack.
+ */
+template <class Key, class T, class Compare, class Allocator, class Policy>
+class RBtreeInspector
+    : public RBtreeFriendMediator<Key, T, Compare, Allocator, Policy> {
+ public:
+  using mediator_type =
+      RBtreeFriendMediator<Key, T, Compare, Allocator, Policy>;
+  using tree_type = mediator_type::tree_type;
+  using node_type = mediator_type::node_type;
+  using value_node_type = mediator_type::value_node_type;
+  using mediator_type::RBtreeFriendMediator;
+
+  /* glibc malloc: 8-byte chunk header, 16-byte granularity, 32 at least. */
+  static constexpr std::size_t kMallocHeader = 8;
+  static constexpr std::size_t kMallocAlignment = 16;
+  static constexpr std::size_t kMallocMinChunk = 32;
+  static constexpr std::size_t kCacheLine = 64;
+
+  RBtreeShape shape() {
+    RBtreeShape result;
+    result.size = this->get_size();
+    std::size_t depth_sum = 0;
+    std::size_t descent_sum = 0;
+    walk(this->get_root(), 0, result.depth_histogram, depth_sum, descent_sum);
+    result.height = result.depth_histogram.size();
+    for (node_type* node = this->get_root(); node->is_not_nil();
+         node = node->left) {
+      result.black_height += node->is_black() ? 1U : 0U;
+    }
+    if (result.size != 0) {
+      const auto elements = static_cast<double>(result.size);
+      result.average_depth = static_cast<double>(depth_sum) / elements;
+      result.average_descent =
+          static_cast<double>(descent_sum) / (elements + 1);
+      result.cache_lines_per_lookup =
+          result.average_descent * cache_lines_per_visit();
+    }
+    return result;
+  }
+
+  RBtreeMemory memory() {
+    RBtreeMemory result;
+    result.basic_node_size = sizeof(node_type);
+    result.node_size = sizeof(value_node_type);
+    result.value_size = sizeof(typename tree_type::value_type);
+    result.node_padding = sizeof(value_node_type) - kNodePayload;
+    result.node_bytes = this->get_size() * sizeof(value_node_type);
+    result.estimated_heap_bytes =
+        this->get_size() * malloc_chunk(sizeof(value_node_type));
+    return result;
+  }
+
+ private:
+  using balance_type = decltype(node_type::balance);
+  using max_end_type = decltype(value_node_type::max_end);
+
+  /*
+   * Links, color, nil flag, AVL or weight balance, key prefix, the largest
+   * end point of an interval tree and value.
+   */
+  static constexpr std::size_t kNodePayload =
+      (tree_type::policy_type::kThreadedLinks ? 5 : 3) * sizeof(node_type*) +
+      2 * sizeof(bool) +
+      (std::is_empty_v<balance_type> ? 0 : sizeof(balance_type)) +
+      (tree_type::policy_type::kKeyPrefixCache ? sizeof(std::uint64_t) : 0) +
+      (std::is_empty_v<max_end_type> ? 0 : sizeof(max_end_type)) +
+      sizeof(typename tree_type::value_type);
+
+  /*
+   * Every element is a node at depth d (found after d + 1 visits) and every
+   * empty child slot is where a lower_bound descent ends.
+   */
+  void walk(node_type* node, std::size_t depth,
+            std::vector<std::size_t>& histogram, std::size_t& depth_sum,
+            std::size_t& descent_sum) {
+    if (node->is_nil()) {
+      descent_sum += depth;
+      return;
+    }
+    if (histogram.size() <= depth) {
+      histogram.resize(depth + 1);
+    }
+    ++histogram[depth];
+    depth_sum += depth + 1;
+    walk(node->left, depth + 1, histogram, depth_sum, descent_sum);
+    walk(node->right, depth + 1, histogram, depth_sum, descent_sum);
+  }
+
+  /*
+   * A descent reads the links and the key of a node. Nodes start on a
+   * kMallocAlignment boundary, so average over the possible offsets of that
+   * span inside a cache line.
+   */
+  double cache_lines_per_visit() {
+    node_type* root = this->get_root();
+    const auto* begin = reinterpret_cast<const char*>(root);
+    const auto* key_end =
+        reinterpret_cast<const char*>(&root->get_key()) + sizeof(Key);
+    const auto span = static_cast<std::size_t>(key_end - begin);
+    std::size_t lines = 0;
+    std::size_t offsets = 0;
+    for (std::size_t offset = 0; offset < kCacheLine;
+         offset += kMallocAlignment, ++offsets) {
+      lines += (offset + span + kCacheLine - 1) / kCacheLine;
+    }
+    return static_cast<double>(lines) / static_cast<double>(offsets);
+  }
+
+  static constexpr std::size_t malloc_chunk(std::size_t bytes) noexcept {
+    const std::size_t chunk = (bytes + kMallocHeader + kMallocAlignment - 1) /
+                              kMallocAlignment * kMallocAlignment;
+    return std::max(chunk, kMallocMinChunk);
+  }
+};
+
+template <class Key, class T, class Compare = std::less<Key>,
+          class Allocator = std::allocator<std::pair<const Key, T>>,
+          class Policy = rbtree_default_policy>
+RBtreeInspector(RBtree<Key, T, Compare, Allocator, Policy>&)
+    -> RBtreeInspector<Key, T, Compare, Allocator, Policy>;
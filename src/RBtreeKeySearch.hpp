@@ -0,0 +1,100 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+/*
+ * Key search for arithmetic keys under the default comparator, where a
+ * comparison is a single instruction and lookups are bound by latency
+ * rather than by the comparisons themselves.
+ */
+template <typename Compare, typename Key>
+concept simd_searchable_key =
+    (std::is_integral_v<Key> || std::is_floating_point_v<Key>)&&(
+        sizeof(Key) == 4 || sizeof(Key) == 8) &&
+    (std::same_as<Compare, std::less<Key>> ||
+     std::same_as<Compare, std::less<>>);
+
+/*
+ * Vector width picked at compile time from the target: AVX2, SSE2 or plain
+ * scalar code. Build with -march=native (RBTREE_NATIVE_ARCH in CMake) to
+ * get AVX2 where the machine has it.
+ */
+#if defined(__AVX2__)
+inline constexpr std::size_t kKeySearchVectorBytes = 32;
+#elif defined(__SSE2__)
+inline constexpr std::size_t kKeySearchVectorBytes = 16;
+#else
+inline constexpr std::size_t kKeySearchVectorBytes = 0;
+#endif
+
+/*
+ * Number of keys in the sorted array keys[0, count) that are less than the
+ * probe, or not greater than it when Inclusive: the lower_bound and the
+ * upper_bound index. Compares a whole vector of keys per step and never
+ * branches on a comparison, so it suits the short arrays of a node.
+ */
+template <bool Inclusive, typename Key>
+std::size_t count_keys_below(const Key* keys, std::size_t count,
+                             Key probe) noexcept {
+  std::size_t result = 0;
+  std::size_t index = 0;
+  if constexpr (kKeySearchVectorBytes != 0) {
+    constexpr std::size_t kLanes = kKeySearchVectorBytes / sizeof(Key);
+    using vector_type [[gnu::vector_size(kKeySearchVectorBytes)]] = Key;
+    using mask_type = decltype(vector_type{} < vector_type{});
+
+    /* Every true lane is -1, so the sum counts down. */
+    const vector_type probes = vector_type{} + probe;
+    mask_type below{};
+    for (; index + kLanes <= count; index += kLanes) {
+      vector_type chunk;
+      std::memcpy(&chunk, keys + index, sizeof(chunk));
+      if constexpr (Inclusive) {
+        below += ~(probes < chunk);
+      } else {
+        below += chunk < probes;
+      }
+    }
+    for (std::size_t lane = 0; lane < kLanes; ++lane) {
+      result -= static_cast<std::size_t>(below[lane]);
+    }
+  }
+  for (; index < count; ++index) {
+    if constexpr (Inclusive) {
+      result += !(probe < keys[index]) ? 1U : 0U;
+    } else {
+      result += keys[index] < probe ? 1U : 0U;
+    }
+  }
+  return result;
+}
+
+/* Byte strings whose std::less order is that of their unsigned bytes. */
+template <typename Compare, typename Key>
+concept prefix_cacheable_key =
+    std::same_as<Key, std::basic_string<char, std::char_traits<char>,
+                                        typename Key::allocator_type>> &&
+    (std::same_as<Compare, std::less<Key>> ||
+     std::same_as<Compare, std::less<>>);
+
+/*
+ * The first 8 bytes of a key as a big-endian integer, zero padded. Integer
+ * order of two prefixes agrees with the order of their keys unless the
+ * prefixes are equal.
+ */
+inline std::uint64_t make_key_prefix(std::string_view key) noexcept {
+  std::uint64_t prefix = 0;
+  std::memcpy(&prefix, key.data(), std::min(key.size(), sizeof(prefix)));
+  if constexpr (std::endian::native == std::endian::little) {
+    prefix = __builtin_bswap64(prefix);
+  }
+  return prefix;
+}
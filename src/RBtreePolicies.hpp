@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+/*
+ * How RBtree keeps its balance, see kBalancing: as a red-black tree fixed
+ * up bottom-up or top-down, as an AVL tree, or weight-balanced.
+ */
+enum class rbtree_balancing { kBottomUp, kTopDown, kAvl, kWeightBalanced };
+
+/*
+ * Weight-balanced trees: no subtree weighs more than kRBtreeWeightDelta
+ * times its sibling, a weight being the size plus one. A single rotation
+ * restores that unless the inner grandchild weighs kRBtreeWeightRatio
+ * times the outer one. (3, 2) is the only integer pair valid for both
+ * insert and erase.
+ */
+inline constexpr std::size_t kRBtreeWeightDelta = 3;
+inline constexpr std::size_t kRBtreeWeightRatio = 2;
+
+/*
+ * Compile-time options of RBtree. To change some of them derive from
+ * rbtree_default_policy and hide the members in question.
+ */
+struct rbtree_default_policy {
+  /*
+   * Every node keeps prev/next links to its in-order neighbours, the
+   * sentinel closing them into a ring. Iterator steps and access to both
+   * ends become O(1) at the cost of two pointers per node.
+   */
+  static constexpr bool kThreadedLinks = false;
+
+  /*
+   * String keys under std::less: every node keeps the first 8 bytes of its
+   * key inline, and a descent reads the string itself only when those tie.
+   * Costs 8 bytes per node and pays off when keys differ early.
+   */
+  static constexpr bool kKeyPrefixCache = false;
+
+  /*
+   * Equal keys are kept, a new one going after those already there, see
+   * RBMultimap. insert and emplace then return the iterator alone.
+   */
+  static constexpr bool kMultiKeys = false;
+
+  /*
+   * Interval tree: a functor giving the end point of an element whose key
+   * is the start. Every node then keeps the largest end in its subtree,
+   * see RBIntervalMap. void leaves the nodes as they are.
+   */
+  using interval_end = void;
+
+  /*
+   * Content digest: a functor hashing keys and mapped values, see
+   * rbtree_std_hash. The tree then keeps an order-independent digest of its
+   * elements, so operator== rejects most unequal trees in O(1) and digest()
+   * tells whether a tree changed. Mapped values are read-only through
+   * iterators and written through insert_or_assign or update. void keeps
+   * no digest.
+   */
+  using content_hash = void;
+
+  /*
+   * kTopDown: insert splits nodes with two red children on its way down
+   * and erase by key pushes a red node down ahead of it, so neither climbs
+   * back through the path it has just read. Erasing at an iterator stays
+   * bottom-up, its fixup being amortized O(1) without any descent.
+   *
+   * kAvl keeps the heights of sibling subtrees within one of each other,
+   * a height of at most 1.44 log n against 2 log n, for read-mostly trees;
+   * the height takes a byte of node padding. kWeightBalanced bounds the
+   * ratio of sibling sizes instead and keeps a size in every node.
+   */
+  static constexpr rbtree_balancing kBalancing = rbtree_balancing::kBottomUp;
+
+  /*
+   * Counts comparisons, rotations, fixups, allocations and lookup depths,
+   * see RBtree::stats. Takes the counters' 80 bytes in the tree.
+   */
+  static constexpr bool kCollectStats = false;
+};
+
+struct rbtree_threaded_policy : rbtree_default_policy {
+  static constexpr bool kThreadedLinks = true;
+};
+
+struct rbtree_prefix_cache_policy : rbtree_default_policy {
+  static constexpr bool kKeyPrefixCache = true;
+};
+
+struct rbtree_top_down_policy : rbtree_default_policy {
+  static constexpr rbtree_balancing kBalancing = rbtree_balancing::kTopDown;
+};
+
+struct rbtree_avl_policy : rbtree_default_policy {
+  static constexpr rbtree_balancing kBalancing = rbtree_balancing::kAvl;
+};
+
+struct rbtree_weight_balanced_policy : rbtree_default_policy {
+  static constexpr rbtree_balancing kBalancing =
+      rbtree_balancing::kWeightBalanced;
+};
+
+struct rbtree_stats_policy : rbtree_default_policy {
+  static constexpr bool kCollectStats = true;
+};
+
+struct rbtree_multi_policy : rbtree_default_policy {
+  static constexpr bool kMultiKeys = true;
+};
+
+/* The mapped value is the end point, as in RBIntervalMap<Key, Key>. */
+struct rbtree_mapped_end {
+  template <typename Value>
+  const auto& operator()(const Value& value) const noexcept {
+    return value.second;
+  }
+};
+
+/* Intervals may share a start, so the keys are multi keys. */
+template <typename EndOf = rbtree_mapped_end>
+struct rbtree_interval_policy : rbtree_multi_policy {
+  using interval_end = EndOf;
+};
+
+/* std::hash of whatever it is given. */
+struct rbtree_std_hash {
+  template <typename Value>
+  std::size_t operator()(const Value& value) const noexcept {
+    return std::hash<Value>{}(value);
+  }
+};
+
+/*
+ * Equal keys must hash equally: the hash has to agree with the equivalence
+ * of the comparator, as std::hash does with std::less.
+ */
+template <typename Hash = rbtree_std_hash>
+struct rbtree_digest_policy : rbtree_default_policy {
+  using content_hash = Hash;
+};
+
+/*
+ * Selects the arena variant of RBtree from RBtreeArena.hpp: all nodes in one
+ * growable array, linked by 32-bit indices. The other options do not apply.
+ */
+struct rbtree_arena_policy : rbtree_default_policy {};
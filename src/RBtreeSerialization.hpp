@@ -0,0 +1,315 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/*
+ * On-disk layout (native byte order):
+ *
+ *   [rbtree_file_header, 64 bytes]
+ *   [payload, header.payload_bytes]
+ *   [checksum, 8 bytes: rbtree_checksum of the payload]
+ *
+ * Flat payload (trivially copyable Key and T): the sorted keys as one array,
+ * then the mapped values as one array, each section starting on a
+ * kSectionAlignment boundary of the file. Such a file can be mapped into
+ * memory and queried in place through RBtreeFlatView.
+ *
+ * Record payload (any other types): for every entry in key order a
+ * length-prefixed key record followed by a length-prefixed mapped record,
+ * each encoded through serialization_traits.
+ */
+struct rbtree_file_header {
+  static constexpr std::uint64_t kMagic = 0x0031'4545'5254'4252;  // "RBTREE1"
+  static constexpr std::uint32_t kVersion = 1;
+  static constexpr std::uint32_t kFlatFlag = 1;
+  static constexpr std::size_t kSectionAlignment = 64;
+
+  std::uint64_t magic;
+  std::uint32_t version;
+  std::uint32_t flags;
+  std::uint32_t key_size;
+  std::uint32_t mapped_size;
+  std::uint64_t count;
+  std::uint64_t payload_bytes;
+  std::uint64_t reserved[3];
+
+  bool is_flat() const noexcept { return (flags & kFlatFlag) != 0; }
+
+  static constexpr std::size_t align_up(std::size_t offset) noexcept {
+    return (offset + kSectionAlignment - 1) / kSectionAlignment *
+           kSectionAlignment;
+  }
+
+  /* Offsets are counted from the beginning of the file. */
+  static constexpr std::size_t keys_offset() noexcept {
+    return sizeof(rbtree_file_header);
+  }
+
+  /*
+   * Whether the sections of count elements fit in a std::size_t: the count
+   * of a header read from a file is checked before any offset is computed.
+   */
+  static constexpr bool is_flat_count_valid(std::uint64_t count,
+                                            std::size_t key_size,
+                                            std::size_t mapped_size) noexcept {
+    constexpr std::size_t kSpace = std::numeric_limits<std::size_t>::max() -
+                                   keys_offset() - 2 * kSectionAlignment;
+    const std::size_t element_size = key_size + mapped_size;
+    return element_size == 0 || count <= kSpace / element_size;
+  }
+
+  static constexpr std::size_t mapped_offset(std::size_t count,
+                                             std::size_t key_size) noexcept {
+    return align_up(keys_offset() + count * key_size);
+  }
+
+  static constexpr std::size_t flat_payload_bytes(
+      std::size_t count, std::size_t key_size,
+      std::size_t mapped_size) noexcept {
+    return align_up(mapped_offset(count, key_size) + count * mapped_size) -
+           keys_offset();
+  }
+};
+
+static_assert(sizeof(rbtree_file_header) ==
+              rbtree_file_header::kSectionAlignment);
+static_assert(std::is_trivially_copyable_v<rbtree_file_header>);
+
+/*
+ * FNV-1a over 64-bit words, so that hashing keeps up with the disk. The
+ * result does not depend on how the input is split between update() calls.
+ */
+class rbtree_checksum {
+  static constexpr std::uint64_t kOffsetBasis = 0xcbf2'9ce4'8422'2325;
+  static constexpr std::uint64_t kPrime = 0x0000'0100'0000'01b3;
+  static constexpr std::size_t kWordSize = sizeof(std::uint64_t);
+
+ public:
+  void update(const void* data, std::size_t size) noexcept {
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    while (size != 0 && pending_size_ != 0) {
+      push_byte(*bytes++);
+      --size;
+    }
+    for (; size >= kWordSize; size -= kWordSize, bytes += kWordSize) {
+      std::uint64_t word = 0;
+      for (std::size_t i = 0; i < kWordSize; ++i) {
+        word |= static_cast<std::uint64_t>(bytes[i]) << (i * 8U);
+      }
+      hash_ = (hash_ ^ word) * kPrime;
+    }
+    for (; size != 0; --size) {
+      push_byte(*bytes++);
+    }
+  }
+
+  std::uint64_t value() const noexcept {
+    if (pending_size_ == 0) {
+      return hash_;
+    }
+    return (hash_ ^ pending_ ^ (pending_size_ << 56U)) * kPrime;
+  }
+
+ private:
+  void push_byte(unsigned char byte) noexcept {
+    pending_ |= static_cast<std::uint64_t>(byte) << (pending_size_ * 8U);
+    if (++pending_size_ == kWordSize) {
+      hash_ = (hash_ ^ pending_) * kPrime;
+      pending_ = 0;
+      pending_size_ = 0;
+    }
+  }
+
+  std::uint64_t hash_{kOffsetBasis};
+  std::uint64_t pending_{};
+  std::uint64_t pending_size_{};
+};
+
+/*
+ * Byte encoding of a single key or mapped value inside a record payload.
+ * Specialize it for user types that are neither trivially copyable nor
+ * strings.
+ */
+template <typename Type>
+struct serialization_traits;
+
+template <typename Type>
+requires std::is_trivially_copyable_v<Type> &&
+    std::is_default_constructible_v<Type>
+struct serialization_traits<Type> {
+  static std::size_t size(const Type& /*unused*/) noexcept {
+    return sizeof(Type);
+  }
+
+  static const void* data(const Type& value) noexcept {
+    return std::addressof(value);
+  }
+
+  static Type read(const char* bytes, std::size_t size) {
+    if (size != sizeof(Type)) {
+      throw std::runtime_error("Bad record size");
+    }
+    Type value;
+    std::memcpy(std::addressof(value), bytes, sizeof(Type));
+    return value;
+  }
+};
+
+template <typename CharT, typename Traits, typename Allocator>
+requires std::is_trivially_copyable_v<CharT>
+struct serialization_traits<std::basic_string<CharT, Traits, Allocator>> {
+  using string_type = std::basic_string<CharT, Traits, Allocator>;
+
+  static std::size_t size(const string_type& value) noexcept {
+    return value.size() * sizeof(CharT);
+  }
+
+  static const void* data(const string_type& value) noexcept {
+    return value.data();
+  }
+
+  static string_type read(const char* bytes, std::size_t size) {
+    if (size % sizeof(CharT) != 0) {
+      throw std::runtime_error("Bad record size");
+    }
+    string_type value(size / sizeof(CharT), CharT{});
+    std::memcpy(value.data(), bytes, size);
+    return value;
+  }
+};
+
+/* Buffers the payload into large writes and checksums it on the way. */
+class rbtree_payload_writer {
+  static constexpr std::size_t kBufferSize = 1 << 16;
+
+ public:
+  explicit rbtree_payload_writer(std::ostream& stream) : stream_(stream) {
+    buffer_.reserve(kBufferSize);
+  }
+
+  void write(const void* data, std::size_t size) {
+    checksum_.update(data, size);
+    written_ += size;
+    const auto* bytes = static_cast<const char*>(data);
+    if (buffer_.size() + size > kBufferSize) {
+      flush();
+    }
+    if (size >= kBufferSize) {
+      put(bytes, size);
+      return;
+    }
+    buffer_.insert(buffer_.end(), bytes, bytes + size);
+  }
+
+  template <typename Type>
+  void write_record(const Type& value) {
+    const auto size =
+        static_cast<std::uint64_t>(serialization_traits<Type>::size(value));
+    write(&size, sizeof(size));
+    write(serialization_traits<Type>::data(value), size);
+  }
+
+  void pad_to(std::size_t offset) {
+    static constexpr char kZeros[rbtree_file_header::kSectionAlignment]{};
+    while (written_ < offset) {
+      write(kZeros, std::min(offset - written_, sizeof(kZeros)));
+    }
+  }
+
+  /* Flushes the buffer and appends the checksum trailer. */
+  void finish() {
+    flush();
+    const std::uint64_t checksum = checksum_.value();
+    put(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+    if (!stream_) {
+      throw std::runtime_error("Bad serialized stream");
+    }
+  }
+
+  std::size_t written() const noexcept { return written_; }
+
+ private:
+  void flush() {
+    put(buffer_.data(), buffer_.size());
+    buffer_.clear();
+  }
+
+  void put(const char* data, std::size_t size) {
+    stream_.write(data, static_cast<std::streamsize>(size));
+  }
+
+  std::ostream& stream_;
+  std::vector<char> buffer_;
+  rbtree_checksum checksum_;
+  std::size_t written_{};
+};
+
+/*
+ * Reads and verifies a whole payload, then hands out records from memory.
+ * The payload size comes from the header, so the buffer grows by chunks as
+ * they arrive: a corrupted size runs into the end of the stream instead of
+ * allocating all of it up front.
+ */
+class rbtree_payload_reader {
+  static constexpr std::size_t kChunkSize = 1 << 20;
+
+ public:
+  rbtree_payload_reader(std::istream& stream, std::size_t payload_bytes) {
+    for (std::size_t read = 0; read < payload_bytes;) {
+      const std::size_t chunk = std::min(payload_bytes - read, kChunkSize);
+      payload_.resize(read + chunk);
+      stream.read(payload_.data() + read, static_cast<std::streamsize>(chunk));
+      if (!stream) {
+        throw std::runtime_error("Truncated serialized stream");
+      }
+      read += chunk;
+    }
+    std::uint64_t checksum = 0;
+    stream.read(reinterpret_cast<char*>(&checksum), sizeof(checksum));
+    if (!stream) {
+      throw std::runtime_error("Truncated serialized stream");
+    }
+    rbtree_checksum expected;
+    expected.update(payload_.data(), payload_.size());
+    if (expected.value() != checksum) {
+      throw std::runtime_error("Serialized stream checksum mismatch");
+    }
+  }
+
+  const char* data() const noexcept { return payload_.data(); }
+
+  template <typename Type>
+  Type read_record() {
+    std::uint64_t size = 0;
+    take(&size, sizeof(size));
+    if (size > payload_.size() - position_) {
+      throw std::runtime_error("Truncated serialized stream");
+    }
+    const char* bytes = payload_.data() + position_;
+    position_ += size;
+    return serialization_traits<Type>::read(bytes, size);
+  }
+
+ private:
+  void take(void* destination, std::size_t size) {
+    if (size > payload_.size() - position_) {
+      throw std::runtime_error("Truncated serialized stream");
+    }
+    std::memcpy(destination, payload_.data() + position_, size);
+    position_ += size;
+  }
+
+  std::vector<char> payload_;
+  std::size_t position_{};
+};
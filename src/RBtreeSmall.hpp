@@ -0,0 +1,638 @@
+#pragma once
+
+#include <algorithm>
+#include <compare>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "RBtree.hpp"
+#include "RBtreeChecks.hpp"
+#include "RBtreeKeySearch.hpp"
+
+/* Entries an RBtreeSmall keeps inline before it turns into a tree. */
+inline constexpr std::size_t kRBtreeSmallCapacity = 16;
+
+/*
+ * Map for the common case of a handful of entries: up to N of them live in
+ * a sorted array inside the object itself and are found by a linear scan,
+ * so an empty or small map allocates nothing. The insert that overflows the
+ * array moves its entries into an RBtree with insert_sorted_batch, and the
+ * map stays a tree until clear().
+ *
+ * The interface is that of RBtree with unique keys. While the entries are
+ * inline, insert and erase invalidate every iterator as in Btree, and so
+ * does the insert that converts; iterators into the tree are stable.
+ */
+template <class Key, class T, class Compare = std::less<Key>,
+          class Allocator = std::allocator<std::pair<const Key, T>>,
+          std::size_t N = kRBtreeSmallCapacity>
+class RBtreeSmall {
+  static_assert(N > 0, "RBtreeSmall needs room for one entry");
+
+  static constexpr const char* kOutOfRange = "Missing element";
+
+  template <bool IsConst>
+  class Iterator;
+
+ public:
+  using key_type = Key;
+  using mapped_type = T;
+  using value_type = std::pair<const Key, T>;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+  using key_compare = Compare;
+  using allocator_type = Allocator;
+  using reference = value_type&;
+  using const_reference = const value_type&;
+  using allocator_traits = std::allocator_traits<allocator_type>;
+  using pointer = typename allocator_traits::pointer;
+  using const_pointer = typename allocator_traits::const_pointer;
+  using iterator = Iterator<false>;
+  using const_iterator = Iterator<true>;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+  using tree_type = RBtree<Key, T, Compare, Allocator>;
+
+ private:
+  using tree_iterator = typename tree_type::iterator;
+  using tree_allocator_type =
+      typename allocator_traits::template rebind_alloc<tree_type>;
+  using tree_allocator_traits = std::allocator_traits<tree_allocator_type>;
+
+  /* Arithmetic keys get a scan without a branch per entry. */
+  static constexpr bool kBranchlessSearch = simd_searchable_key<Compare, Key>;
+
+ public:
+  /*========================= Member functions ========================*/
+  RBtreeSmall() = default;
+
+  explicit RBtreeSmall(const allocator_type& alloc)
+      : alloc_(alloc), tree_alloc_(alloc) {}
+
+  explicit RBtreeSmall(const key_compare& compare,
+                       const allocator_type& alloc = allocator_type())
+      : alloc_(alloc), tree_alloc_(alloc), compare_(compare) {}
+
+  RBtreeSmall(const RBtreeSmall& other)
+      : alloc_(allocator_traits::select_on_container_copy_construction(
+            other.alloc_)),
+        tree_alloc_(alloc_),
+        compare_(other.compare_) {
+    if (other.tree_ != nullptr) {
+      tree_ = create_tree(other.tree_->begin(), other.tree_->end());
+      return;
+    }
+    try {
+      for (; size_ < other.size_; ++size_) {
+        allocator_traits::construct(alloc_, slot(size_), *other.slot(size_));
+      }
+    } catch (...) {
+      clear();
+      throw;
+    }
+  }
+
+  RBtreeSmall(RBtreeSmall&& other) noexcept
+      : alloc_(std::move(other.alloc_)),
+        tree_alloc_(std::move(other.tree_alloc_)),
+        compare_(std::move(other.compare_)) {
+    take(other);
+  }
+
+  RBtreeSmall& operator=(RBtreeSmall other) noexcept {
+    swap(*this, other);
+    return *this;
+  }
+
+  ~RBtreeSmall() { clear(); }
+
+  allocator_type get_allocator() const noexcept { return alloc_; }
+
+  /*========================== Element access =========================*/
+  mapped_type& operator[](const key_type& key) {
+    return try_emplace(key).first->second;
+  }
+
+  mapped_type& at(const key_type& key) {
+    auto found = find(key);
+    if (found == end()) {
+      throw std::out_of_range(kOutOfRange);
+    }
+    return found->second;
+  }
+
+  const mapped_type& at(const key_type& key) const {
+    return const_cast<RBtreeSmall*>(this)->at(key);
+  }
+
+  /*============================ Iterators ============================*/
+  iterator begin() noexcept {
+    return tree_ == nullptr ? iterator(slot(0)) : iterator(tree_->begin());
+  }
+
+  const_iterator begin() const noexcept {
+    return const_cast<RBtreeSmall*>(this)->begin();
+  }
+
+  const_iterator cbegin() const noexcept { return begin(); }
+
+  iterator end() noexcept {
+    return tree_ == nullptr ? iterator(slot(size_)) : iterator(tree_->end());
+  }
+
+  const_iterator end() const noexcept {
+    return const_cast<RBtreeSmall*>(this)->end();
+  }
+
+  const_iterator cend() const noexcept { return end(); }
+
+  reverse_iterator rbegin() noexcept { return reverse_iterator(end()); }
+
+  const_reverse_iterator rbegin() const noexcept {
+    return const_reverse_iterator(end());
+  }
+
+  const_reverse_iterator crbegin() const noexcept { return rbegin(); }
+
+  reverse_iterator rend() noexcept { return reverse_iterator(begin()); }
+
+  const_reverse_iterator rend() const noexcept {
+    return const_reverse_iterator(begin());
+  }
+
+  const_reverse_iterator crend() const noexcept { return rend(); }
+
+  /*============================ Capacity =============================*/
+  bool empty() const noexcept { return size() == 0; }
+
+  size_type size() const noexcept {
+    return tree_ == nullptr ? size_ : tree_->size();
+  }
+
+  size_type max_size() const noexcept {
+    return std::numeric_limits<size_type>::max();
+  }
+
+  /* Whether the entries are still in the array, not in a tree. */
+  bool is_inline() const noexcept { return tree_ == nullptr; }
+
+  static constexpr size_type inline_capacity() noexcept { return N; }
+
+  /*============================ Modifiers ============================*/
+  /* Also turns a tree back into the inline array. */
+  void clear() noexcept {
+    if (tree_ != nullptr) {
+      destroy_tree(std::exchange(tree_, nullptr));
+      return;
+    }
+    destroy_slots(0, size_);
+    size_ = 0;
+  }
+
+  iterator erase(const_iterator pos) {
+    if (tree_ != nullptr) {
+      return tree_->erase(pos.node_);
+    }
+    const size_type index = index_of(pos);
+    erase_slots(index, index + 1);
+    return slot(index);
+  }
+
+  iterator erase(const_iterator first, const_iterator last) {
+    if (tree_ != nullptr) {
+      return tree_->erase(first.node_, last.node_);
+    }
+    const size_type index = index_of(first);
+    erase_slots(index, index_of(last));
+    return slot(index);
+  }
+
+  size_type erase(const key_type& key) {
+    if (tree_ != nullptr) {
+      return tree_->erase(key);
+    }
+    const size_type index = lower_index(key);
+    if (index == size_ || less(key, slot(index)->first)) {
+      return 0;
+    }
+    erase_slots(index, index + 1);
+    return 1;
+  }
+
+  std::pair<iterator, bool> insert(const value_type& value) {
+    return emplace_unique(value.first, value);
+  }
+
+  template <class P>
+  std::pair<iterator, bool> insert(P&& value) {
+    return emplace(std::forward<P>(value));
+  }
+
+  std::pair<iterator, bool> insert(value_type&& value) {
+    return emplace_unique(value.first,
+                          std::move(const_cast<key_type&>(value.first)),
+                          std::move(value.second));
+  }
+
+  template <class... Args>
+  std::pair<iterator, bool> emplace(Args&&... args) {
+    value_type value(std::forward<Args>(args)...);
+    return insert(std::move(value));
+  }
+
+  template <class... Args>
+  std::pair<iterator, bool> try_emplace(const key_type& k, Args&&... args) {
+    return emplace_unique(k, std::piecewise_construct, std::forward_as_tuple(k),
+                          std::forward_as_tuple(std::forward<Args>(args)...));
+  }
+
+  /*============================== Lookup =============================*/
+  iterator lower_bound(const key_type& key) {
+    if (tree_ != nullptr) {
+      return tree_->lower_bound(key);
+    }
+    return slot(lower_index(key));
+  }
+
+  iterator upper_bound(const key_type& key) {
+    if (tree_ != nullptr) {
+      return tree_->upper_bound(key);
+    }
+    return slot(upper_index(key));
+  }
+
+  iterator find(const key_type& key) {
+    if (tree_ != nullptr) {
+      return tree_->find(key);
+    }
+    const size_type index = lower_index(key);
+    if (index == size_ || less(key, slot(index)->first)) {
+      return end();
+    }
+    return slot(index);
+  }
+
+  const_iterator upper_bound(const key_type& key) const {
+    return const_cast<RBtreeSmall*>(this)->upper_bound(key);
+  }
+
+  const_iterator lower_bound(const key_type& key) const {
+    return const_cast<RBtreeSmall*>(this)->lower_bound(key);
+  }
+
+  const_iterator find(const key_type& key) const {
+    return const_cast<RBtreeSmall*>(this)->find(key);
+  }
+
+  bool contains(const key_type& key) const { return find(key) != end(); }
+
+  size_type count(const key_type& key) const {
+    return static_cast<size_type>(contains(key));
+  }
+
+  std::pair<iterator, iterator> equal_range(const key_type& key) {
+    return {lower_bound(key), upper_bound(key)};
+  }
+
+  std::pair<const_iterator, const_iterator> equal_range(
+      const key_type& key) const {
+    return const_cast<RBtreeSmall*>(this)->equal_range(key);
+  }
+
+  /*============================ Observers ============================*/
+  key_compare key_comp() const noexcept { return compare_; }
+
+  /*====================== Non-member functions =======================*/
+  /* Keys by equivalence and mapped values by ==, as RBtree does. */
+  friend bool operator==(const RBtreeSmall& lhs, const RBtreeSmall& rhs) {
+    if (lhs.size() != rhs.size()) {
+      return false;
+    }
+    return std::equal(
+        lhs.begin(), lhs.end(), rhs.begin(),
+        [&](const auto& l, const auto& r) {
+          if (lhs.less(l.first, r.first) ||
+              lhs.less(r.first, l.first)) {
+            return false;
+          }
+          return l.second == r.second;
+        });
+  }
+
+  /* Keys first, mapped values break the ties as in std::map. */
+  friend auto operator<=>(const RBtreeSmall& lhs, const RBtreeSmall& rhs) {
+    const auto compare_pred = [&](const auto& l,
+                                  const auto& r) -> std::weak_ordering {
+      if (lhs.less(l.first, r.first)) {
+        return std::weak_ordering::less;
+      }
+      if (lhs.less(r.first, l.first)) {
+        return std::weak_ordering::greater;
+      }
+      return std::compare_weak_order_fallback(l.second, r.second);
+    };
+    return std::lexicographical_compare_three_way(
+        lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), compare_pred);
+  }
+
+  friend void swap(RBtreeSmall& lhs, RBtreeSmall& rhs) noexcept {
+    using std::swap;
+    RBtreeSmall temp(std::move(lhs));
+    lhs.take(rhs);
+    rhs.take(temp);
+    swap(lhs.alloc_, rhs.alloc_);
+    swap(lhs.tree_alloc_, rhs.tree_alloc_);
+    swap(lhs.compare_, rhs.compare_);
+  }
+
+  template <typename Pred>
+  requires std::is_nothrow_invocable_r_v<bool, Pred,
+                                         typename RBtreeSmall::value_type>
+      size_type erase_if(Pred pred) {
+    RBtreeSmall::size_type result = 0;
+    iterator current = begin();
+    while (current != end()) {
+      if (pred(*current)) {
+        current = erase(current);
+        ++result;
+      } else {
+        ++current;
+      }
+    }
+    return result;
+  }
+
+ private:
+  /*============================== Lookup =============================*/
+  size_type lower_index(const key_type& key) const {
+    if constexpr (kBranchlessSearch) {
+      return count_below<false>(key);
+    } else {
+      size_type index = 0;
+      while (index != size_ && less(slot(index)->first, key)) {
+        ++index;
+      }
+      return index;
+    }
+  }
+
+  size_type upper_index(const key_type& key) const {
+    if constexpr (kBranchlessSearch) {
+      return count_below<true>(key);
+    } else {
+      size_type index = 0;
+      while (index != size_ && !less(key, slot(index)->first)) {
+        ++index;
+      }
+      return index;
+    }
+  }
+
+  /* The keys are interleaved with the mapped values, as in a Btree leaf. */
+  template <bool Inclusive>
+  size_type count_below(key_type key) const noexcept {
+    size_type result = 0;
+    for (size_type i = 0; i < size_; ++i) {
+      if constexpr (Inclusive) {
+        result += !(key < slot(i)->first) ? 1U : 0U;
+      } else {
+        result += slot(i)->first < key ? 1U : 0U;
+      }
+    }
+    return result;
+  }
+
+  size_type index_of(const_iterator pos) const noexcept {
+    return static_cast<size_type>(pos.slot_ - slot(0));
+  }
+
+  /*============================= Insert ==============================*/
+  template <class... Args>
+  std::pair<iterator, bool> emplace_unique(const key_type& key,
+                                           Args&&... args) {
+    if (tree_ == nullptr) {
+      const size_type index = lower_index(key);
+      if (index != size_ && !less(key, slot(index)->first)) {
+        return {slot(index), false};
+      }
+      if (size_ != N) {
+        return {insert_at(index, std::forward<Args>(args)...), true};
+      }
+      convert_to_tree();
+    } else if (auto found = tree_->find(key); found != tree_->end()) {
+      return {found, false};
+    }
+    return {tree_->emplace(std::forward<Args>(args)...).first, true};
+  }
+
+  template <class... Args>
+  iterator insert_at(size_type index, Args&&... args) {
+    relocate(slot(index + 1), slot(index), size_ - index);
+    try {
+      allocator_traits::construct(alloc_, slot(index),
+                                  std::forward<Args>(args)...);
+    } catch (...) {
+      relocate(slot(index), slot(index + 1), size_ - index);
+      throw;
+    }
+    ++size_;
+    return slot(index);
+  }
+
+  /*
+   * The entries are copied rather than moved into the tree, so that a
+   * throw leaves them in place and the map unchanged. It happens once.
+   */
+  void convert_to_tree() {
+    RBTREE_CHECK(tree_ == nullptr && size_ == N);
+    tree_type* tree = create_tree(slot(0), slot(size_));
+    destroy_slots(0, size_);
+    size_ = 0;
+    tree_ = tree;
+  }
+
+  /* Moves the entries of other into this empty inline map. */
+  void take(RBtreeSmall& other) noexcept {
+    RBTREE_CHECK(tree_ == nullptr && size_ == 0);
+    tree_ = std::exchange(other.tree_, nullptr);
+    relocate(slot(0), other.slot(0), other.size_);
+    size_ = std::exchange(other.size_, 0);
+  }
+
+  /*============================== Erase ==============================*/
+  void erase_slots(size_type first, size_type last) noexcept {
+    destroy_slots(first, last);
+    relocate(slot(first), slot(last), size_ - last);
+    size_ -= last - first;
+  }
+
+  void destroy_slots(size_type first, size_type last) noexcept {
+    for (size_type i = first; i < last; ++i) {
+      allocator_traits::destroy(alloc_, slot(i));
+    }
+  }
+
+  /*=========================== Memory ================================*/
+  value_type* slot(size_type index) noexcept {
+    return std::launder(reinterpret_cast<value_type*>(storage_)) + index;
+  }
+
+  const value_type* slot(size_type index) const noexcept {
+    return const_cast<RBtreeSmall*>(this)->slot(index);
+  }
+
+  /*
+   * Moves count entries from src into the uninitialized dst, which may
+   * overlap it, leaving src uninitialized.
+   */
+  void relocate(value_type* dst, value_type* src, size_type count) noexcept {
+    if (count == 0 || dst == src) {
+      return;
+    }
+    if constexpr (std::is_trivially_copyable_v<key_type> &&
+                  std::is_trivially_copyable_v<mapped_type>) {
+      std::memmove(static_cast<void*>(dst), static_cast<const void*>(src),
+                   count * sizeof(value_type));
+    } else if (dst < src) {
+      for (size_type i = 0; i < count; ++i) {
+        relocate_one(dst + i, src + i);
+      }
+    } else {
+      for (size_type i = count; i > 0; --i) {
+        relocate_one(dst + i - 1, src + i - 1);
+      }
+    }
+  }
+
+  void relocate_one(value_type* dst, value_type* src) noexcept {
+    allocator_traits::construct(alloc_, dst,
+                                std::move(const_cast<key_type&>(src->first)),
+                                std::move(src->second));
+    allocator_traits::destroy(alloc_, src);
+  }
+
+  /* A tree holding the ascending values of [first, last). */
+  template <typename InputIt>
+  tree_type* create_tree(InputIt first, InputIt last) {
+    tree_type* tree = tree_allocator_traits::allocate(tree_alloc_, 1);
+    try {
+      std::construct_at(tree, compare_, alloc_);
+    } catch (...) {
+      tree_allocator_traits::deallocate(tree_alloc_, tree, 1);
+      throw;
+    }
+    try {
+      tree->insert_sorted_batch(first, last);
+    } catch (...) {
+      destroy_tree(tree);
+      throw;
+    }
+    return tree;
+  }
+
+  void destroy_tree(tree_type* tree) noexcept {
+    std::destroy_at(tree);
+    tree_allocator_traits::deallocate(tree_alloc_, tree, 1);
+  }
+
+  bool less(const key_type& lhs, const key_type& rhs) const {
+    return compare_(lhs, rhs);
+  }
+
+  [[no_unique_address]] allocator_type alloc_{};
+  [[no_unique_address]] tree_allocator_type tree_alloc_{};
+
+  key_compare compare_{};
+  /* Null while the entries are inline. */
+  tree_type* tree_{};
+  size_type size_{};
+  alignas(value_type) std::byte storage_[N * sizeof(value_type)];
+};
+
+template <class Key, class T, class Compare, class Allocator, std::size_t N>
+template <bool IsConst>
+class RBtreeSmall<Key, T, Compare, Allocator, N>::Iterator {
+  /*======================== Usings and Structures =========================*/
+  using small = RBtreeSmall<Key, T, Compare, Allocator, N>;
+  using tree_iterator = small::tree_iterator;
+
+ public:
+  using difference_type = ptrdiff_t;
+  using iterator_category = std::bidirectional_iterator_tag;
+  using value_type = small::value_type;
+  using pointer = std::conditional_t<IsConst, const value_type*, value_type*>;
+  using reference = std::conditional_t<IsConst, const value_type&, value_type&>;
+
+  /*============================ Constructors ==============================*/
+  Iterator() = default;
+
+  Iterator(value_type* slot) : slot_(slot) {}
+
+  Iterator(tree_iterator node) : node_(node) {}
+
+  /*============================== Operators ===============================*/
+  Iterator& operator++() {
+    if (slot_ != nullptr) {
+      ++slot_;
+    } else {
+      ++node_;
+    }
+    return *this;
+  }
+
+  Iterator& operator--() {
+    if (slot_ != nullptr) {
+      --slot_;
+    } else {
+      --node_;
+    }
+    return *this;
+  }
+
+  Iterator operator++(int) {
+    Iterator result = *this;
+    ++*this;
+    return result;
+  }
+
+  Iterator operator--(int) {
+    Iterator result = *this;
+    --*this;
+    return result;
+  }
+
+  reference operator*() const { return slot_ != nullptr ? *slot_ : *node_; }
+
+  pointer operator->() const { return std::addressof(**this); }
+
+  bool operator==(const Iterator& other) const {
+    return slot_ == other.slot_ && node_ == other.node_;
+  }
+
+  bool operator!=(const Iterator& other) const { return !(*this == other); }
+
+  operator Iterator<true>() const {
+    return slot_ != nullptr ? Iterator<true>(slot_) : Iterator<true>(node_);
+  }
+
+ private:
+  friend RBtreeSmall;
+
+  operator Iterator<false>() const {
+    return slot_ != nullptr ? Iterator<false>(slot_) : Iterator<false>(node_);
+  }
+
+  /*================================ Fields ================================*/
+  /* Null once the map is a tree, node_ is unused before. */
+  value_type* slot_{nullptr};
+  tree_iterator node_{};
+};
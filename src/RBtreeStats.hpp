@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+
+/*
+ * Hot-path counters of RBtree. They are compiled in only under a policy
+ * with kCollectStats, see rbtree_stats_policy; otherwise the collector is
+ * an empty member whose hooks are no-ops, so the tree keeps its size and
+ * code.
+ */
+
+struct RBtreeStats {
+  std::uint64_t comparisons{};
+  std::uint64_t rotations{};
+  std::uint64_t insert_fixup_iterations{};
+  std::uint64_t erase_fixup_iterations{};
+  std::uint64_t recolorings{};
+  std::uint64_t allocations{};
+  std::uint64_t deallocations{};
+  std::uint64_t lookups{};
+  std::uint64_t lookup_depth{};
+  std::uint64_t max_lookup_depth{};
+
+  double average_lookup_depth() const noexcept {
+    return lookups == 0 ? 0.0
+                        : static_cast<double>(lookup_depth) /
+                              static_cast<double>(lookups);
+  }
+};
+
+template <bool Enabled>
+class rbtree_stats_collector {
+ public:
+  void on_comparison() noexcept { ++stats_.comparisons; }
+  void on_rotation() noexcept { ++stats_.rotations; }
+  void on_insert_fixup() noexcept { ++stats_.insert_fixup_iterations; }
+  void on_erase_fixup() noexcept { ++stats_.erase_fixup_iterations; }
+  void on_allocation() noexcept { ++stats_.allocations; }
+  void on_deallocation() noexcept { ++stats_.deallocations; }
+
+  void on_recolor(bool changed) noexcept {
+    stats_.recolorings += changed ? 1U : 0U;
+  }
+
+  void on_lookup(std::uint64_t depth) noexcept {
+    ++stats_.lookups;
+    stats_.lookup_depth += depth;
+    stats_.max_lookup_depth = std::max(stats_.max_lookup_depth, depth);
+  }
+
+  RBtreeStats snapshot() const noexcept { return stats_; }
+  void reset() noexcept { stats_ = {}; }
+
+ private:
+  RBtreeStats stats_;
+};
+
+template <>
+class rbtree_stats_collector<false> {
+ public:
+  void on_comparison() noexcept {}
+  void on_rotation() noexcept {}
+  void on_insert_fixup() noexcept {}
+  void on_erase_fixup() noexcept {}
+  void on_allocation() noexcept {}
+  void on_deallocation() noexcept {}
+  void on_recolor(bool /*unused*/) noexcept {}
+  void on_lookup(std::uint64_t /*unused*/) noexcept {}
+
+  RBtreeStats snapshot() const noexcept { return {}; }
+  void reset() noexcept {}
+};
+
+static_assert(std::is_empty_v<rbtree_stats_collector<false>>);
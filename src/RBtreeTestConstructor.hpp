@@ -1,17 +1,19 @@
 #pragma once
 #include "RBtreeFriendMediator.hpp"
 
-template <class Key, class T, class Compare, class Allocator>
+template <class Key, class T, class Compare, class Allocator, class Policy>
 class RBtreeTestConstructor
-    : public RBtreeFriendMediator<Key, T, Compare, Allocator> {
+    : public RBtreeFriendMediator<Key, T, Compare, Allocator, Policy> {
  public:
-  using mediator_type = RBtreeFriendMediator<Key, T, Compare, Allocator>;
+  using mediator_type =
+      RBtreeFriendMediator<Key, T, Compare, Allocator, Policy>;
   using tree_type = mediator_type::tree_type;
   using node_type = mediator_type::node_type;
   using mediator_type::RBtreeFriendMediator;
 };
 
 template <class Key, class T, class Compare = std::less<Key>,
-          class Allocator = std::allocator<std::pair<const Key, T>>>
-RBtreeTestConstructor(RBtree<Key, T, Compare, Allocator>&)
-    -> RBtreeTestConstructor<Key, T, Compare, Allocator>;
\ No newline at end of file
+          class Allocator = std::allocator<std::pair<const Key, T>>,
+          class Policy = rbtree_default_policy>
+RBtreeTestConstructor(RBtree<Key, T, Compare, Allocator, Policy>&)
+    -> RBtreeTestConstructor<Key, T, Compare, Allocator, Policy>;
\ No newline at end of file
@@ -1,17 +1,303 @@
 #pragma once
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "RBtreeArena.hpp"
 #include "RBtreeFriendMediator.hpp"
 
-template <class Key, class T, class Compare, class Allocator>
+/*
+ * Checks every red-black tree invariant in a single O(n) pass: sentinel and
+ * root links, parent links, strict key order (non-decreasing in multi
+ * trees), no red node with a red child, equal black height on every path,
+ * the cached size and, for threaded trees, the prev/next links, for
+ * interval trees, the subtree maxima of the end points and, under
+ * kContentDigest, the digest. AVL and weight-balanced trees have their
+ * heights or sizes and bounds checked instead of the colors.
+ */
+template <class Key, class T, class Compare, class Allocator, class Policy>
 class RBtreeValidator
-    : public RBtreeFriendMediator<Key, T, Compare, Allocator> {
+    : public RBtreeFriendMediator<Key, T, Compare, Allocator, Policy> {
  public:
-  using mediator_type = RBtreeFriendMediator<Key, T, Compare, Allocator>;
+  using mediator_type =
+      RBtreeFriendMediator<Key, T, Compare, Allocator, Policy>;
   using tree_type = mediator_type::tree_type;
   using node_type = mediator_type::node_type;
   using mediator_type::RBtreeFriendMediator;
+
+  bool is_valid() { return is_valid_impl(0); }
+
+  /* Validates the top subtrees on up to `threads` threads. */
+  bool is_valid_parallel(
+      std::size_t threads = std::thread::hardware_concurrency()) {
+    return is_valid_impl(threads < 2 ? 0 : std::bit_width(threads - 1));
+  }
+
+ private:
+  using key_type = tree_type::key_type;
+
+  static constexpr bool kThreadedLinks = tree_type::policy_type::kThreadedLinks;
+  static constexpr bool kMultiKeys = tree_type::policy_type::kMultiKeys;
+  using interval_end_type = typename tree_type::policy_type::interval_end;
+  static constexpr bool kIntervalTree = !std::is_void_v<interval_end_type>;
+  static constexpr bool kContentDigest =
+      !std::is_void_v<typename tree_type::policy_type::content_hash>;
+  static constexpr rbtree_balancing kBalancing =
+      tree_type::policy_type::kBalancing;
+  static constexpr bool kRedBlack = kBalancing == rbtree_balancing::kBottomUp ||
+                                    kBalancing == rbtree_balancing::kTopDown;
+
+  struct SubtreeReport {
+    bool valid;
+    std::size_t black_height;
+    std::size_t size;
+    /* Sum of the element digests, 0 without kContentDigest. */
+    std::uint64_t digest;
+  };
+
+  bool is_valid_impl(std::size_t parallel_depth) {
+    node_type* nil = this->get_NIL();
+    node_type* root = this->get_root();
+    if (nil->is_not_nil() || nil->left != root ||
+        nil->right != root->get_most_left() ||
+        (root->is_not_nil() && root->parent != nil)) {
+      return false;
+    }
+    if constexpr (kRedBlack) {
+      if (nil->is_red() || root->is_red()) {
+        return false;
+      }
+    } else if (nil->balance != 0) {
+      return false;
+    }
+    if constexpr (kThreadedLinks) {
+      if (nil->next != nil->right || nil->prev != root->get_most_right()) {
+        return false;
+      }
+    }
+    const SubtreeReport report =
+        check_subtree(root, nil, nullptr, nullptr, parallel_depth);
+    if (!report.valid || report.size != this->get_size()) {
+      return false;
+    }
+    if constexpr (kContentDigest) {
+      return report.digest == this->get_digest();
+    }
+    return true;
+  }
+
+  SubtreeReport check_subtree(node_type* node, node_type* parent,
+                              const key_type* low, const key_type* high,
+                              std::size_t parallel_depth) {
+    static constexpr SubtreeReport kInvalid{false, 0, 0, 0};
+    if (node->is_nil()) {
+      return {true, 0, 0, 0};
+    }
+    const key_type& key = node->get_key();
+    if (node->parent != parent || (low != nullptr && !in_order(*low, key)) ||
+        (high != nullptr && !in_order(key, *high))) {
+      return kInvalid;
+    }
+    if constexpr (kRedBlack) {
+      if (node->is_red() && (node->left->is_red() || node->right->is_red())) {
+        return kInvalid;
+      }
+    } else if (!is_balanced(node)) {
+      return kInvalid;
+    }
+    if constexpr (kThreadedLinks) {
+      if (!is_threaded(node)) {
+        return kInvalid;
+      }
+    }
+    if constexpr (kIntervalTree) {
+      if (!is_max_end_valid(node)) {
+        return kInvalid;
+      }
+    }
+
+    SubtreeReport left{};
+    SubtreeReport right{};
+    if (parallel_depth == 0) {
+      left = check_subtree(node->left, node, low, &key, 0);
+      right = check_subtree(node->right, node, &key, high, 0);
+    } else {
+      auto left_future = std::async(std::launch::async, [&] {
+        return check_subtree(node->left, node, low, &key, parallel_depth - 1);
+      });
+      right = check_subtree(node->right, node, &key, high, parallel_depth - 1);
+      left = left_future.get();
+    }
+
+    if (!left.valid || !right.valid ||
+        left.black_height != right.black_height) {
+      return kInvalid;
+    }
+    std::uint64_t digest = left.digest + right.digest;
+    if constexpr (kContentDigest) {
+      digest += mediator_type::digest_of(node->get_value());
+    }
+    if constexpr (!kRedBlack) {
+      return {true, 0, left.size + right.size + 1, digest};
+    }
+    return {true, left.black_height + (node->is_black() ? 1U : 0U),
+            left.size + right.size + 1, digest};
+  }
+
+  /*
+   * Neighbours inside the subtrees are checked here, every other adjacent
+   * pair is checked from the side of its upper node.
+   */
+  static bool is_threaded(node_type* node) {
+    return node->prev->next == node && node->next->prev == node &&
+           (node->left->is_nil() ||
+            node->prev == node->left->get_most_right()) &&
+           (node->right->is_nil() ||
+            node->next == node->right->get_most_left());
+  }
+
+  /*
+   * A correct height or size, children's heights within one or weights
+   * within kRBtreeWeightDelta of each other.
+   */
+  static bool is_balanced(node_type* node) {
+    const std::size_t left = node->left->balance;
+    const std::size_t right = node->right->balance;
+    if constexpr (kBalancing == rbtree_balancing::kAvl) {
+      return node->balance == std::max(left, right) + 1 && left <= right + 1 &&
+             right <= left + 1;
+    } else {
+      return node->balance == left + right + 1 &&
+             left + 1 <= kRBtreeWeightDelta * (right + 1) &&
+             right + 1 <= kRBtreeWeightDelta * (left + 1);
+    }
+  }
+
+  /* The largest of its own end and the maxima kept by its children. */
+  bool is_max_end_valid(node_type* node) {
+    using value_node_type = mediator_type::value_node_type;
+    const key_type& max_end = static_cast<value_node_type*>(node)->max_end;
+    key_type expected = interval_end_type{}(node->get_value());
+    for (node_type* child : {node->left, node->right}) {
+      const auto* value_child = static_cast<value_node_type*>(child);
+      if (child->is_not_nil() && less(expected, value_child->max_end)) {
+        expected = value_child->max_end;
+      }
+    }
+    return !less(max_end, expected) && !less(expected, max_end);
+  }
+
+  /* Strictly increasing keys, or non-decreasing in a multi tree. */
+  bool in_order(const key_type& lhs, const key_type& rhs) {
+    if constexpr (kMultiKeys) {
+      return !less(rhs, lhs);
+    } else {
+      return less(lhs, rhs);
+    }
+  }
+
+  bool less(const key_type& lhs, const key_type& rhs) {
+    return this->compare_less(lhs, rhs);
+  }
 };
 
 template <class Key, class T, class Compare = std::less<Key>,
-          class Allocator = std::allocator<std::pair<const Key, T>>>
-RBtreeValidator(RBtree<Key, T, Compare, Allocator>&)
-    -> RBtreeValidator<Key, T, Compare, Allocator>;
\ No newline at end of file
+          class Allocator = std::allocator<std::pair<const Key, T>>,
+          class Policy = rbtree_default_policy>
+RBtreeValidator(RBtree<Key, T, Compare, Allocator, Policy>&)
+    -> RBtreeValidator<Key, T, Compare, Allocator, Policy>;
+
+/*
+ * The same checks over the node array of the arena variant, plus the free
+ * list: every slot below the high-water mark is either reachable from the
+ * root or on the free list, exactly once.
+ */
+template <class Key, class T, class Compare, class Allocator>
+class RBtreeValidator<Key, T, Compare, Allocator, rbtree_arena_policy> {
+ public:
+  using tree_type = RBtree<Key, T, Compare, Allocator, rbtree_arena_policy>;
+
+  explicit RBtreeValidator(tree_type& tree) : tree_(tree) {}
+
+  bool is_valid() {
+    if (tree_.nodes_ == nullptr) {
+      return tree_.size_ == 0 && tree_.used_ == 0 && tree_.root_ == kNil;
+    }
+    const auto& nil = tree_.nodes_[kNil];
+    if (tree_.used_ == 0 || tree_.used_ > tree_.capacity_ || nil.red != 0U ||
+        nil.left != tree_.root_ ||
+        nil.right != tree_.template most<&node_type::left>(tree_.root_) ||
+        tree_.is_red(tree_.root_) ||
+        (tree_.root_ != kNil && tree_.parent_of(tree_.root_) != kNil)) {
+      return false;
+    }
+    seen_.assign(tree_.used_, false);
+    seen_[kNil] = true;
+    const SubtreeReport report = check_subtree(tree_.root_, kNil, nullptr,
+                                               nullptr);
+    return report.valid && report.size == tree_.size_ &&
+           check_free_list(tree_.used_ - 1 - tree_.size_);
+  }
+
+ private:
+  using key_type = tree_type::key_type;
+  using index_type = tree_type::index_type;
+  using node_type = tree_type::node_type;
+
+  static constexpr index_type kNil = tree_type::kNil;
+
+  struct SubtreeReport {
+    bool valid;
+    std::size_t black_height;
+    std::size_t size;
+  };
+
+  SubtreeReport check_subtree(index_type index, index_type parent,
+                              const key_type* low, const key_type* high) {
+    static constexpr SubtreeReport kInvalid{false, 0, 0};
+    if (index == kNil) {
+      return {true, 0, 0};
+    }
+    if (index >= tree_.used_ || seen_[index]) {
+      return kInvalid;
+    }
+    seen_[index] = true;
+    const auto& node = tree_.nodes_[index];
+    const key_type& key = tree_.key_at(index);
+    if (tree_.parent_of(index) != parent ||
+        (low != nullptr && !tree_.compare_less(*low, key)) ||
+        (high != nullptr && !tree_.compare_less(key, *high)) ||
+        (tree_.is_red(index) &&
+         (tree_.is_red(node.left) || tree_.is_red(node.right)))) {
+      return kInvalid;
+    }
+    const SubtreeReport left = check_subtree(node.left, index, low, &key);
+    const SubtreeReport right = check_subtree(node.right, index, &key, high);
+    if (!left.valid || !right.valid ||
+        left.black_height != right.black_height) {
+      return kInvalid;
+    }
+    return {true, left.black_height + (tree_.is_red(index) ? 0U : 1U),
+            left.size + right.size + 1};
+  }
+
+  bool check_free_list(std::size_t expected) {
+    std::size_t length = 0;
+    for (index_type slot = tree_.free_; slot != kNil;
+         slot = tree_.nodes_[slot].left, ++length) {
+      if (slot >= tree_.used_ || seen_[slot] ||
+          tree_.parent_of(slot) != tree_type::kFreeSlot) {
+        return false;
+      }
+      seen_[slot] = true;
+    }
+    return length == expected;
+  }
+
+  tree_type& tree_;
+  std::vector<bool> seen_;
+};
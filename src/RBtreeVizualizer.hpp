@@ -5,14 +5,16 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include <type_traits>
 
 #include "RBtreeFriendMediator.hpp"
 
-template <class Key, class T, class Compare, class Allocator>
+template <class Key, class T, class Compare, class Allocator, class Policy>
 class RBtreeVisualizer
-    : public RBtreeFriendMediator<Key, T, Compare, Allocator> {
+    : public RBtreeFriendMediator<Key, T, Compare, Allocator, Policy> {
  public:
-  using mediator_type = RBtreeFriendMediator<Key, T, Compare, Allocator>;
+  using mediator_type =
+      RBtreeFriendMediator<Key, T, Compare, Allocator, Policy>;
   using tree_type = mediator_type::tree_type;
   using node_type = mediator_type::node_type;
   using mediator_type::RBtreeFriendMediator;
@@ -58,10 +60,13 @@ class RBtreeVisualizer
     std::string node_color = node->is_red() ? "red" : "black";
     std::string font_color = node->is_red() ? "white" : "white";
 
-    file << "  node" << node_ptr << " [label=\"key:" << node->get_key()
-         << "\nmapped:" << node->get_mapped() << "\naddr:" << std::hex
-         << node_ptr << std::dec << "\", fillcolor=" << node_color
-         << ", fontcolor=" << font_color << "];\n";
+    file << "  node" << node_ptr << " [label=\"key:" << node->get_key();
+    if constexpr (!std::is_void_v<T>) {
+      file << "\nmapped:" << node->get_mapped();
+    }
+    file << "\naddr:" << std::hex << node_ptr << std::dec
+         << "\", fillcolor=" << node_color << ", fontcolor=" << font_color
+         << "];\n";
 
     if (node->left->is_not_nil()) {
       file << "  node" << node_ptr << " -> node" << left_ptr
@@ -83,6 +88,7 @@ class RBtreeVisualizer
 };
 
 template <class Key, class T, class Compare = std::less<Key>,
-          class Allocator = std::allocator<std::pair<const Key, T>>>
-RBtreeVisualizer(RBtree<Key, T, Compare, Allocator>&)
-    -> RBtreeVisualizer<Key, T, Compare, Allocator>;
\ No newline at end of file
+          class Allocator = std::allocator<std::pair<const Key, T>>,
+          class Policy = rbtree_default_policy>
+RBtreeVisualizer(RBtree<Key, T, Compare, Allocator, Policy>&)
+    -> RBtreeVisualizer<Key, T, Compare, Allocator, Policy>;
\ No newline at end of file
@@ -0,0 +1,1356 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory_resource>
+#include <numeric>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Btree.hpp"
+#include "RBtree.hpp"
+#include "RBtreeArena.hpp"
+#include "RBtreeFlatView.hpp"
+#include "RBtreeGenerator.hpp"
+#include "RBtreeInspector.hpp"
+#include "RBtreeSmall.hpp"
+
+/*
+ * Usage: benchmarks [filter]
+ * Runs every benchmark whose name contains filter. Build with
+ * CMAKE_BUILD_TYPE=Release for meaningful numbers, and compare variants of
+ * one benchmark in separate runs.
+ */
+
+namespace {
+
+constexpr std::size_t kRestartEntries = 10'000'000;
+constexpr std::size_t kStringEntries = 1'000'000;
+constexpr std::size_t kLookupSizes[] = {1 << 10, 1 << 16, 1 << 20};
+constexpr std::size_t kLookupProbes = 4'000'000;
+constexpr std::size_t kScanEntries = 1'000'000;
+constexpr std::size_t kScanRanges = 100'000;
+constexpr std::size_t kScanRangeLength = 100;
+constexpr std::size_t kRangeLengths[] = {10, 100, 1000};
+constexpr std::size_t kRangeElements = 20'000'000;
+constexpr std::size_t kPageSizes[] = {10, 100, 1000};
+constexpr std::size_t kContainerEntries = 1'000'000;
+constexpr std::size_t kKeySearchEntries = 1'000'000;
+constexpr std::size_t kArenaEntries = 4'000'000;
+constexpr std::size_t kCompactSteps = 1024;
+constexpr std::size_t kRequests = 20'000;
+constexpr std::size_t kRequestEntries = 256;
+constexpr std::size_t kEventKeys = 100'000;
+constexpr std::size_t kEventsPerKey = 8;
+constexpr std::size_t kIntervals = 1'000'000;
+constexpr std::size_t kIntervalQueries = 2'000;
+constexpr std::uint64_t kIntervalSpace = 1ULL << 32;
+constexpr std::uint64_t kIntervalMaxLength = 1ULL << 16;
+constexpr std::size_t kBalancingEntries = 8'000'000;
+constexpr std::size_t kBalancingChurn = 2'000'000;
+constexpr std::size_t kPolicyEntries = 1'000'000;
+constexpr std::size_t kFingerEntries = 1'000'000;
+constexpr std::size_t kFingerProbeCounts[] = {1'000, 100'000, 2'000'000};
+constexpr std::size_t kBatchTreeEntries = 1'000'000;
+/* Batch sizes per 1000 tree entries. */
+constexpr std::size_t kBatchPerMille[] = {1, 10, 100, 500, 1000, 2000};
+constexpr std::size_t kSmallMaps = 1'000'000;
+constexpr std::size_t kSmallMapSizes[] = {0, 4, 16, 64};
+constexpr std::size_t kMoveSizes[] = {1 << 10, 1 << 16, 1 << 20};
+constexpr std::size_t kMoves = 64;
+constexpr std::size_t kMovedTrees = 1024;
+constexpr std::size_t kReplicaEntries = 1'000'000;
+constexpr std::size_t kReplicaComparisons = 10;
+
+template <typename Func>
+double MeasureMs(Func&& func) {
+  const auto start = std::chrono::steady_clock::now();
+  func();
+  const auto stop = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(stop - start).count();
+}
+
+void Report(std::string_view name, double ms) {
+  std::cout << "  " << std::left << std::setw(40) << name << std::right
+            << std::setw(12) << std::fixed << std::setprecision(2) << ms
+            << " ms\n";
+}
+
+void BenchmarkRestart() {
+  using tree_type = RBtree<std::uint64_t, std::uint64_t>;
+  const auto directory = std::filesystem::temp_directory_path();
+  const auto text_path = directory / "rbtree_restart.txt";
+  const auto binary_path = directory / "rbtree_restart.bin";
+
+  std::mt19937_64 random(42);
+  tree_type tree;
+  for (std::uint64_t i = 0; i < kRestartEntries; ++i) {
+    tree.insert({i * 2, random()});
+  }
+
+  Report("write text", MeasureMs([&] {
+           std::ofstream text(text_path);
+           for (const auto& [key, mapped] : tree) {
+             text << key << ' ' << mapped << '\n';
+           }
+         }));
+  Report("write binary", MeasureMs([&] {
+           std::ofstream binary(binary_path, std::ios::binary);
+           tree.serialize(binary);
+         }));
+
+  tree_type reloaded;
+  Report("restart: parse text + insert", MeasureMs([&] {
+           std::ifstream text(text_path);
+           std::uint64_t key = 0;
+           std::uint64_t mapped = 0;
+           while (text >> key >> mapped) {
+             reloaded.insert({key, mapped});
+           }
+         }));
+  reloaded.clear();
+
+  Report("restart: deserialize", MeasureMs([&] {
+           std::ifstream binary(binary_path, std::ios::binary);
+           reloaded.deserialize(binary);
+         }));
+  if (reloaded != tree) {
+    std::cerr << "deserialized tree differs\n";
+  }
+
+  const auto file_size =
+      static_cast<std::size_t>(std::filesystem::file_size(binary_path));
+  const int descriptor = ::open(binary_path.c_str(), O_RDONLY);
+  void* mapping = ::mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE,
+                         descriptor, 0);
+  if (descriptor < 0 || mapping == MAP_FAILED) {
+    std::cerr << "cannot map " << binary_path << '\n';
+    return;
+  }
+  std::uint64_t found = 0;
+  Report("restart: mmap flat view", MeasureMs([&] {
+           RBtreeFlatView<std::uint64_t, std::uint64_t> view(mapping,
+                                                             file_size);
+           for (std::uint64_t i = 0; i < kRestartEntries; i += 1000) {
+             found += view.contains(i) ? 1U : 0U;
+           }
+         }));
+  Report("flat view checksum", MeasureMs([&] {
+           RBtreeFlatView<std::uint64_t, std::uint64_t> view(mapping,
+                                                             file_size);
+           found += view.verify_checksum() ? 1U : 0U;
+         }));
+  ::munmap(mapping, file_size);
+  ::close(descriptor);
+
+  std::filesystem::remove(text_path);
+  std::filesystem::remove(binary_path);
+  std::cout << "  (" << found << " probes hit)\n";
+}
+
+/* Same order as std::less<std::string>, but only as a bool predicate. */
+struct TwoWayStringLess {
+  bool operator()(const std::string& lhs, const std::string& rhs) const {
+    return lhs < rhs;
+  }
+};
+
+/* URL-like keys: long shared prefix, differences near the end. */
+std::vector<std::string> MakeUrlKeys(std::size_t count, std::uint64_t seed) {
+  std::mt19937_64 random(seed);
+  std::vector<std::string> keys;
+  keys.reserve(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    keys.push_back("https://example.com/api/v1/users/" +
+                   std::to_string(random() % (count * 4)) + "/profile");
+  }
+  return keys;
+}
+
+template <typename Compare>
+void RunStringLookups(std::string_view name,
+                      const std::vector<std::string>& keys,
+                      const std::vector<std::string>& probes) {
+  RBtree<std::string, std::size_t, Compare> tree;
+  std::size_t found = 0;
+  Report(std::string(name) + ": insert", MeasureMs([&] {
+           for (std::size_t i = 0; i < keys.size(); ++i) {
+             tree.insert({keys[i], i});
+           }
+         }));
+  Report(std::string(name) + ": find hit", MeasureMs([&] {
+           for (const auto& key : keys) {
+             found += tree.find(key) != tree.end() ? 1U : 0U;
+           }
+         }));
+  Report(std::string(name) + ": find miss", MeasureMs([&] {
+           for (const auto& key : probes) {
+             found += tree.find(key) != tree.end() ? 1U : 0U;
+           }
+         }));
+  std::cout << "  (" << found << " probes hit)\n";
+}
+
+/* Each variant in its own run: a heap left behind by a previous tree skews
+ * the node placement of the next one. */
+void BenchmarkStringKeysTwoWay() {
+  RunStringLookups<TwoWayStringLess>("two-way",
+                                     MakeUrlKeys(kStringEntries, 1),
+                                     MakeUrlKeys(kStringEntries, 2));
+}
+
+void BenchmarkStringKeysThreeWay() {
+  RunStringLookups<std::less<std::string>>("three-way",
+                                           MakeUrlKeys(kStringEntries, 1),
+                                           MakeUrlKeys(kStringEntries, 2));
+}
+
+/* URL-like keys without the scheme: host names differ from the first byte. */
+std::vector<std::string> MakeHostKeys(std::size_t count, std::uint64_t seed) {
+  std::mt19937_64 random(seed);
+  std::uniform_int_distribution<int> letters('a', 'z');
+  std::vector<std::string> keys;
+  keys.reserve(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    std::string host(6, 'a');
+    for (auto& letter : host) {
+      letter = static_cast<char>(letters(random));
+    }
+    keys.push_back(host + ".example.com/api/v1/users/" +
+                   std::to_string(random() % (count * 4)));
+  }
+  return keys;
+}
+
+template <typename Policy>
+void RunPrefixCache(std::vector<std::string> (*make_keys)(std::size_t,
+                                                          std::uint64_t)) {
+  RBtree<std::string, std::size_t, std::less<std::string>,
+         std::allocator<std::pair<const std::string, std::size_t>>, Policy>
+      tree;
+  const auto keys = make_keys(kStringEntries, 1);
+  const auto probes = make_keys(kStringEntries, 2);
+  std::size_t found = 0;
+  Report("insert", MeasureMs([&] {
+           for (std::size_t i = 0; i < keys.size(); ++i) {
+             tree.insert({keys[i], i});
+           }
+         }));
+  Report("find hit", MeasureMs([&] {
+           for (const auto& key : keys) {
+             found += tree.find(key) != tree.end() ? 1U : 0U;
+           }
+         }));
+  Report("find miss", MeasureMs([&] {
+           for (const auto& key : probes) {
+             found += tree.find(key) != tree.end() ? 1U : 0U;
+           }
+         }));
+  Report("lower_bound", MeasureMs([&] {
+           for (const auto& key : probes) {
+             found += tree.lower_bound(key) != tree.end() ? 1U : 0U;
+           }
+         }));
+  std::cout << "  (" << found << " probes hit)\n";
+}
+
+void BenchmarkPrefixCacheHostsDefault() {
+  RunPrefixCache<rbtree_default_policy>(MakeHostKeys);
+}
+
+void BenchmarkPrefixCacheHostsCached() {
+  RunPrefixCache<rbtree_prefix_cache_policy>(MakeHostKeys);
+}
+
+/* MakeUrlKeys share far more than 8 bytes: the cache never settles. */
+void BenchmarkPrefixCacheSharedDefault() {
+  RunPrefixCache<rbtree_default_policy>(MakeUrlKeys);
+}
+
+void BenchmarkPrefixCacheSharedCached() {
+  RunPrefixCache<rbtree_prefix_cache_policy>(MakeUrlKeys);
+}
+
+/* Keys are even, so odd probes miss. */
+std::vector<std::uint64_t> MakeProbes(std::size_t size, std::uint64_t parity) {
+  std::mt19937_64 random(size);
+  std::vector<std::uint64_t> probes(kLookupProbes);
+  for (auto& probe : probes) {
+    probe = random() % size * 2 + parity;
+  }
+  return probes;
+}
+
+void BenchmarkFindEqual() {
+  for (const std::size_t size : kLookupSizes) {
+    std::vector<std::uint64_t> keys(size);
+    for (std::size_t i = 0; i < size; ++i) {
+      keys[i] = i * 2;
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(size));
+    RBtree<std::uint64_t, std::uint64_t> tree;
+    for (const auto key : keys) {
+      tree.insert({key, key});
+    }
+    const RBtreeShape shape = RBtreeInspector(tree).shape();
+    std::cout << "  size " << size << ": find visits " << shape.average_depth
+              << " nodes on a hit, lower_bound " << shape.average_descent
+              << '\n';
+
+    std::uint64_t found = 0;
+    for (const std::uint64_t parity : {0U, 1U}) {
+      const auto probes = MakeProbes(size, parity);
+      const std::string kind = parity == 0 ? " hit" : " miss";
+      Report("lower_bound + compare" + kind, MeasureMs([&] {
+               for (const auto probe : probes) {
+                 auto it = tree.lower_bound(probe);
+                 found += it != tree.end() && it->first == probe ? 1U : 0U;
+               }
+             }));
+      Report("find" + kind, MeasureMs([&] {
+               for (const auto probe : probes) {
+                 found += tree.find(probe) != tree.end() ? 1U : 0U;
+               }
+             }));
+    }
+    std::cout << "  (" << found << " probes hit)\n";
+  }
+}
+
+template <typename Policy>
+void RunScans() {
+  using tree_type =
+      RBtree<std::uint64_t, std::uint64_t, std::less<std::uint64_t>,
+             std::allocator<std::pair<const std::uint64_t, std::uint64_t>>,
+             Policy>;
+  std::vector<std::uint64_t> keys(kScanEntries);
+  for (std::size_t i = 0; i < kScanEntries; ++i) {
+    keys[i] = i;
+  }
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64(kScanEntries));
+  tree_type tree;
+  for (const auto key : keys) {
+    tree.insert({key, key});
+  }
+
+  std::uint64_t sum = 0;
+  Report("full scan forward", MeasureMs([&] {
+           for (const auto& [key, mapped] : tree) {
+             sum += mapped;
+           }
+         }));
+  Report("full scan backward", MeasureMs([&] {
+           for (auto it = tree.rbegin(); it != tree.rend(); ++it) {
+             sum += it->second;
+           }
+         }));
+  Report("partial scans", MeasureMs([&] {
+           for (std::size_t i = 0; i < kScanRanges; ++i) {
+             auto it = tree.lower_bound(keys[i]);
+             for (std::size_t step = 0;
+                  step < kScanRangeLength && it != tree.end(); ++step, ++it) {
+               sum += it->second;
+             }
+           }
+         }));
+  std::cout << "  (checksum " << sum << ")\n";
+}
+
+void BenchmarkScanDefault() { RunScans<rbtree_default_policy>(); }
+
+void BenchmarkScanThreaded() { RunScans<rbtree_threaded_policy>(); }
+
+/* [lo, lo + length) over keys 0..kScanEntries-1, iterators vs a visitor. */
+void BenchmarkRangeScan() {
+  std::vector<std::uint64_t> keys(kScanEntries);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64(kScanEntries));
+  RBtree<std::uint64_t, std::uint64_t> tree;
+  for (const auto key : keys) {
+    tree.insert({key, key});
+  }
+
+  std::uint64_t sum = 0;
+  for (const std::size_t length : kRangeLengths) {
+    const std::size_t queries = kRangeElements / length;
+    const std::string suffix = " length " + std::to_string(length);
+    Report("iterators" + suffix, MeasureMs([&] {
+             for (std::size_t i = 0; i < queries; ++i) {
+               const std::uint64_t lo = keys[i % kScanEntries];
+               const auto last = tree.lower_bound(lo + length);
+               for (auto it = tree.lower_bound(lo); it != last; ++it) {
+                 sum += it->second;
+               }
+             }
+           }));
+    Report("for_each_in_range" + suffix, MeasureMs([&] {
+             for (std::size_t i = 0; i < queries; ++i) {
+               const std::uint64_t lo = keys[i % kScanEntries];
+               tree.for_each_in_range(lo, lo + length, [&](const auto& value) {
+                 sum += value.second;
+               });
+             }
+           }));
+  }
+  Report("full scan: iterators", MeasureMs([&] {
+           for (const auto& [key, mapped] : tree) {
+             sum += mapped;
+           }
+         }));
+  Report("full scan: visit", MeasureMs([&] {
+           tree.visit([&](const auto& value) { sum += value.second; });
+         }));
+  std::cout << "  (checksum " << sum << ")\n";
+}
+
+/* Pages of the whole tree, as a paginated API serves them. */
+void BenchmarkPagination() {
+  using tree_type = RBtree<std::uint64_t, std::uint64_t>;
+  std::vector<std::uint64_t> keys(kScanEntries);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64(kScanEntries));
+  tree_type tree;
+  for (const auto key : keys) {
+    tree.insert({key, key});
+  }
+
+  std::uint64_t sum = 0;
+  for (const std::size_t page_size : kPageSizes) {
+    const std::string suffix = " page " + std::to_string(page_size);
+    Report("upper_bound per page" + suffix, MeasureMs([&] {
+             std::vector<tree_type::value_type> page;
+             auto it = tree.begin();
+             while (it != tree.end()) {
+               page.clear();
+               for (; page.size() < page_size && it != tree.end(); ++it) {
+                 page.push_back(*it);
+               }
+               sum += page.back().second;
+               it = tree.upper_bound(page.back().first);
+             }
+           }));
+    for (const auto mode :
+         {rbtree_scan_mode::kStable, rbtree_scan_mode::kEraseSafe}) {
+      const std::string name = mode == rbtree_scan_mode::kStable
+                                   ? "generator stable"
+                                   : "generator erase-safe";
+      Report(name + suffix, MeasureMs([&] {
+               for (const auto& page :
+                    rbtree_scan(tree, 0, kScanEntries, page_size, mode)) {
+                 sum += page.back().second;
+               }
+             }));
+    }
+  }
+  std::cout << "  (checksum " << sum << ")\n";
+}
+
+/* The same workload for RBtree and its B-tree sibling. */
+template <typename Tree>
+void RunContainer() {
+  std::vector<std::uint64_t> keys(kContainerEntries);
+  for (std::size_t i = 0; i < kContainerEntries; ++i) {
+    keys[i] = i * 2;
+  }
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64(kContainerEntries));
+  const auto probes = MakeProbes(kContainerEntries, 0);
+
+  Tree tree;
+  std::uint64_t sum = 0;
+  Report("insert shuffled", MeasureMs([&] {
+           for (const auto key : keys) {
+             tree.insert({key, key});
+           }
+         }));
+  Report("find", MeasureMs([&] {
+           for (const auto probe : probes) {
+             sum += tree.find(probe)->second;
+           }
+         }));
+  Report("lower_bound miss", MeasureMs([&] {
+           for (const auto probe : probes) {
+             auto it = tree.lower_bound(probe + 1);
+             sum += it != tree.end() ? it->second : 0U;
+           }
+         }));
+  Report("full scan", MeasureMs([&] {
+           for (const auto& [key, mapped] : tree) {
+             sum += mapped;
+           }
+         }));
+  Report("erase shuffled", MeasureMs([&] {
+           for (const auto key : keys) {
+             sum += tree.erase(key);
+           }
+         }));
+  Tree ascending;
+  Report("insert ascending", MeasureMs([&] {
+           for (std::uint64_t i = 0; i < kContainerEntries; ++i) {
+             ascending.insert({i, i});
+           }
+         }));
+  std::cout << "  (checksum " << sum << ")\n";
+}
+
+void BenchmarkContainerRBtree() {
+  RunContainer<RBtree<std::uint64_t, std::uint64_t>>();
+}
+
+void BenchmarkContainerBtree() {
+  RunContainer<Btree<std::uint64_t, std::uint64_t>>();
+}
+
+/* Small entries: the pointer tree against the arena, fresh and churned. */
+template <typename Tree>
+void RunArena() {
+  std::vector<std::uint32_t> keys(kArenaEntries);
+  std::iota(keys.begin(), keys.end(), 0U);
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64(kArenaEntries));
+  std::mt19937_64 random(kArenaEntries);
+
+  Tree tree;
+  std::uint64_t sum = 0;
+  const auto find_and_scan = [&](std::string_view when) {
+    Report(std::string("find ") + std::string(when), MeasureMs([&] {
+             for (const auto key : keys) {
+               sum += tree.find(key)->second;
+             }
+           }));
+    Report(std::string("full scan ") + std::string(when), MeasureMs([&] {
+             for (const auto& [key, mapped] : tree) {
+               sum += mapped;
+             }
+           }));
+  };
+
+  Report("insert shuffled", MeasureMs([&] {
+           for (const auto key : keys) {
+             tree.insert({key, key});
+           }
+         }));
+  find_and_scan("fresh");
+  Report("churn: erase + insert", MeasureMs([&] {
+           for (std::size_t i = 0; i < kArenaEntries; ++i) {
+             const auto key = static_cast<std::uint32_t>(random() %
+                                                         kArenaEntries);
+             tree.erase(key);
+             tree.insert({key, key});
+           }
+         }));
+  find_and_scan("churned");
+  std::size_t bytes = 0;
+  if constexpr (requires { tree.allocated_bytes(); }) {
+    Report("compact in order", MeasureMs([&] { tree.compact(); }));
+    find_and_scan("compacted");
+    bytes = tree.allocated_bytes();
+  } else {
+    bytes = RBtreeInspector(tree).memory().estimated_heap_bytes;
+  }
+  std::cout << "  bytes per entry: "
+            << static_cast<double>(bytes) / static_cast<double>(tree.size())
+            << "\n  (checksum " << sum << ")\n";
+}
+
+void BenchmarkArenaPointers() {
+  RunArena<RBtree<std::uint32_t, std::uint32_t>>();
+}
+
+void BenchmarkArenaIndices() {
+  RunArena<RBtreeArena<std::uint32_t, std::uint32_t>>();
+}
+
+/*
+ * A churned pointer tree before and after compact(), in one go or in
+ * bounded steps with the churn going on between them.
+ */
+void RunCompact(rbtree_layout layout, std::size_t step) {
+  std::vector<std::uint32_t> keys(kArenaEntries);
+  std::iota(keys.begin(), keys.end(), 0U);
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64(kArenaEntries));
+  std::mt19937_64 random(kArenaEntries);
+
+  RBtree<std::uint32_t, std::uint32_t> tree;
+  std::uint64_t sum = 0;
+  const auto churn = [&](std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+      const auto key = static_cast<std::uint32_t>(random() % kArenaEntries);
+      tree.erase(key);
+      tree.insert({key, key});
+    }
+  };
+  const auto find_and_scan = [&](std::string_view when) {
+    Report(std::string("find ") + std::string(when), MeasureMs([&] {
+             for (const auto key : keys) {
+               sum += tree.find(key)->second;
+             }
+           }));
+    Report(std::string("full scan ") + std::string(when), MeasureMs([&] {
+             for (const auto& [key, mapped] : tree) {
+               sum += mapped;
+             }
+           }));
+  };
+
+  for (const auto key : keys) {
+    tree.insert({key, key});
+  }
+  churn(kArenaEntries);
+  find_and_scan("churned");
+  if (step == 0) {
+    Report("compact", MeasureMs([&] { tree.compact(layout); }));
+  } else {
+    double ms = 0;
+    bool done = false;
+    while (!done) {
+      ms += MeasureMs([&] { done = tree.compact_step(step); });
+      churn(step / 16);
+    }
+    Report("compact_step, total", ms);
+  }
+  find_and_scan("compacted");
+  std::cout << "  (checksum " << sum << ")\n";
+}
+
+void BenchmarkCompactInOrder() { RunCompact(rbtree_layout::kInOrder, 0); }
+
+void BenchmarkCompactVanEmdeBoas() {
+  RunCompact(rbtree_layout::kVanEmdeBoas, 0);
+}
+
+void BenchmarkCompactIncremental() {
+  RunCompact(rbtree_layout::kInOrder, kCompactSteps);
+}
+
+/*
+ * Short-lived per-request maps: built, read once and dropped. MakeTree
+ * gets the buffer of the request and returns an empty tree.
+ */
+template <typename MakeTree>
+void RunPerRequest(MakeTree make_tree) {
+  std::vector<std::uint64_t> keys(kRequestEntries);
+  std::iota(keys.begin(), keys.end(), 0U);
+  std::mt19937_64 random(kRequests);
+  std::uint64_t sum = 0;
+  std::vector<std::byte> buffer(kRequestEntries * 128);
+  Report("build, read and destroy", MeasureMs([&] {
+           for (std::size_t request = 0; request < kRequests; ++request) {
+             std::pmr::monotonic_buffer_resource resource(buffer.data(),
+                                                          buffer.size());
+             auto tree = make_tree(resource);
+             std::shuffle(keys.begin(), keys.end(), random);
+             for (const auto key : keys) {
+               tree.emplace(key, std::to_string(key));
+             }
+             sum += tree.find(keys.front())->second.size();
+           }
+         }));
+  std::cout << "  (checksum " << sum << ")\n";
+}
+
+void BenchmarkPerRequestDefault() {
+  RunPerRequest([](std::pmr::memory_resource& /*unused*/) {
+    return RBtree<std::uint64_t, std::string>();
+  });
+}
+
+void BenchmarkPerRequestMonotonic() {
+  RunPerRequest([](std::pmr::memory_resource& resource) {
+    return pmr::RBtree<std::uint64_t, std::pmr::string>(&resource);
+  });
+}
+
+/*
+ * An event index, several events per timestamp: RBMultimap against the
+ * map of vectors it replaces. The events arrive in random order.
+ */
+std::vector<std::pair<std::uint64_t, std::uint64_t>> MakeEvents() {
+  std::vector<std::pair<std::uint64_t, std::uint64_t>> events;
+  events.reserve(kEventKeys * kEventsPerKey);
+  for (std::uint64_t key = 0; key < kEventKeys; ++key) {
+    for (std::uint64_t event = 0; event < kEventsPerKey; ++event) {
+      events.emplace_back(key, key * kEventsPerKey + event);
+    }
+  }
+  std::shuffle(events.begin(), events.end(), std::mt19937_64(kEventKeys));
+  return events;
+}
+
+void BenchmarkEventsMultimap() {
+  const auto events = MakeEvents();
+  RBMultimap<std::uint64_t, std::uint64_t> tree;
+  std::uint64_t sum = 0;
+  Report("insert", MeasureMs([&] {
+           for (const auto& event : events) {
+             tree.insert(event);
+           }
+         }));
+  Report("equal_range scan", MeasureMs([&] {
+           for (const auto& [key, unused] : events) {
+             const auto [first, last] = tree.equal_range(key);
+             for (auto it = first; it != last; ++it) {
+               sum += it->second;
+             }
+           }
+         }));
+  Report("count", MeasureMs([&] {
+           for (const auto& [key, unused] : events) {
+             sum += tree.count(key);
+           }
+         }));
+  Report("erase by key", MeasureMs([&] {
+           for (std::uint64_t key = 0; key < kEventKeys; ++key) {
+             sum += tree.erase(key);
+           }
+         }));
+  std::cout << "  (checksum " << sum << ")\n";
+}
+
+void BenchmarkEventsVectors() {
+  const auto events = MakeEvents();
+  RBtree<std::uint64_t, std::vector<std::uint64_t>> tree;
+  std::uint64_t sum = 0;
+  Report("insert", MeasureMs([&] {
+           for (const auto& [key, event] : events) {
+             tree[key].push_back(event);
+           }
+         }));
+  Report("equal_range scan", MeasureMs([&] {
+           for (const auto& [key, unused] : events) {
+             for (const auto event : tree.find(key)->second) {
+               sum += event;
+             }
+           }
+         }));
+  Report("count", MeasureMs([&] {
+           for (const auto& [key, unused] : events) {
+             sum += tree.find(key)->second.size();
+           }
+         }));
+  Report("erase by key", MeasureMs([&] {
+           for (std::uint64_t key = 0; key < kEventKeys; ++key) {
+             const auto found = tree.find(key);
+             sum += found->second.size();
+             tree.erase(found);
+           }
+         }));
+  std::cout << "  (checksum " << sum << ")\n";
+}
+
+/*
+ * Stabbing queries over address ranges: which of kIntervals random ranges
+ * contain a point. The interval tree against the linear scan it replaces.
+ */
+std::vector<std::pair<std::uint64_t, std::uint64_t>> MakeIntervals() {
+  std::mt19937_64 random(kIntervals);
+  std::vector<std::pair<std::uint64_t, std::uint64_t>> intervals(kIntervals);
+  for (auto& [start, end] : intervals) {
+    start = random() % kIntervalSpace;
+    end = start + random() % kIntervalMaxLength;
+  }
+  return intervals;
+}
+
+std::vector<std::uint64_t> MakeIntervalQueries() {
+  std::mt19937_64 random(kIntervalQueries);
+  std::vector<std::uint64_t> points(kIntervalQueries);
+  for (auto& point : points) {
+    point = random() % kIntervalSpace;
+  }
+  return points;
+}
+
+void BenchmarkIntervalsTree() {
+  const auto intervals = MakeIntervals();
+  const auto points = MakeIntervalQueries();
+  RBIntervalMap<std::uint64_t> tree;
+  std::uint64_t sum = 0;
+  Report("insert", MeasureMs([&] {
+           for (const auto& interval : intervals) {
+             tree.insert(interval);
+           }
+         }));
+  Report("find_overlapping", MeasureMs([&] {
+           for (const auto point : points) {
+             const auto found = tree.find_overlapping(point);
+             sum += found != tree.end() ? found->first : 0;
+           }
+         }));
+  Report("for_each_overlapping", MeasureMs([&] {
+           for (const auto point : points) {
+             tree.for_each_overlapping(point, point, [&](const auto& value) {
+               sum += value.first;
+             });
+           }
+         }));
+  std::cout << "  (checksum " << sum << ")\n";
+}
+
+void BenchmarkIntervalsLinearScan() {
+  const auto intervals = MakeIntervals();
+  const auto points = MakeIntervalQueries();
+  std::uint64_t sum = 0;
+  Report("find_overlapping", MeasureMs([&] {
+           for (const auto point : points) {
+             std::uint64_t first = kIntervalSpace;
+             for (const auto& [start, end] : intervals) {
+               if (start <= point && point <= end && start < first) {
+                 first = start;
+               }
+             }
+             sum += first != kIntervalSpace ? first : 0;
+           }
+         }));
+  Report("for_each_overlapping", MeasureMs([&] {
+           for (const auto point : points) {
+             for (const auto& [start, end] : intervals) {
+               if (start <= point && point <= end) {
+                 sum += start;
+               }
+             }
+           }
+         }));
+  std::cout << "  (checksum " << sum << ")\n";
+}
+
+/*
+ * Bottom-up against top-down balancing on a tree of kBalancingEntries
+ * nodes, larger than the last level cache: random inserts, a churn of
+ * erase and insert by key, then erasing everything by key.
+ */
+template <typename Tree>
+void RunBalancing() {
+  std::vector<std::uint64_t> keys(kBalancingEntries);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64(kBalancingEntries));
+  Tree tree;
+  std::uint64_t sum = 0;
+  Report("insert", MeasureMs([&] {
+           for (const auto key : keys) {
+             tree.insert({key, key});
+           }
+         }));
+  std::mt19937_64 random(kBalancingChurn);
+  Report("erase + insert", MeasureMs([&] {
+           for (std::size_t i = 0; i < kBalancingChurn; ++i) {
+             const std::uint64_t key = keys[random() % keys.size()];
+             sum += tree.erase(key);
+             tree.insert({key, key});
+           }
+         }));
+  std::shuffle(keys.begin(), keys.end(), random);
+  Report("erase", MeasureMs([&] {
+           for (const auto key : keys) {
+             sum += tree.erase(key);
+           }
+         }));
+  std::cout << "  (checksum " << sum << ")\n";
+}
+
+using BottomUpTree = RBtree<std::uint64_t, std::uint64_t>;
+
+using TopDownTree =
+    RBtree<std::uint64_t, std::uint64_t, std::less<std::uint64_t>,
+           std::allocator<std::pair<const std::uint64_t, std::uint64_t>>,
+           rbtree_top_down_policy>;
+
+/*
+ * Red-black against AVL and weight-balanced trees of kPolicyEntries keys,
+ * inserted in random and in ascending order: the shape each ends up with,
+ * update cost, and lookup latency over kLookupProbes random hits.
+ */
+template <typename Tree>
+void RunBalancePolicy() {
+  std::vector<std::uint64_t> keys(kPolicyEntries);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::vector<std::uint64_t> probes(kLookupProbes);
+  std::mt19937_64 random(kPolicyEntries);
+  for (auto& probe : probes) {
+    probe = keys[random() % keys.size()];
+  }
+  std::uint64_t sum = 0;
+  for (const bool ascending : {false, true}) {
+    if (!ascending) {
+      std::shuffle(keys.begin(), keys.end(), random);
+    } else {
+      std::sort(keys.begin(), keys.end());
+    }
+    const std::string order = ascending ? " ascending" : " random";
+    Tree tree;
+    Report("insert" + order, MeasureMs([&] {
+             for (const auto key : keys) {
+               tree.insert({key, key});
+             }
+           }));
+    const RBtreeShape shape = RBtreeInspector(tree).shape();
+    std::cout << "  height " << shape.height << ", find visits "
+              << shape.average_depth << " nodes on a hit\n";
+    Report("find" + order, MeasureMs([&] {
+             for (const auto probe : probes) {
+               sum += tree.find(probe)->second;
+             }
+           }));
+    Report("erase" + order, MeasureMs([&] {
+             for (const auto key : keys) {
+               sum += tree.erase(key);
+             }
+           }));
+  }
+  std::cout << "  (checksum " << sum << ")\n";
+}
+
+using AvlTree =
+    RBtree<std::uint64_t, std::uint64_t, std::less<std::uint64_t>,
+           std::allocator<std::pair<const std::uint64_t, std::uint64_t>>,
+           rbtree_avl_policy>;
+
+using WeightBalancedTree =
+    RBtree<std::uint64_t, std::uint64_t, std::less<std::uint64_t>,
+           std::allocator<std::pair<const std::uint64_t, std::uint64_t>>,
+           rbtree_weight_balanced_policy>;
+
+/*
+ * Sorted probe lists against kFingerEntries keys, as in a merge join:
+ * every probe searched from the root, or the whole list by find_sorted.
+ * Half of the probes miss.
+ */
+template <typename Search>
+void RunFingerSearch(Search search) {
+  RBtree<std::uint64_t, std::uint64_t> tree;
+  std::vector<std::uint64_t> keys(kFingerEntries);
+  for (std::size_t i = 0; i < kFingerEntries; ++i) {
+    keys[i] = i * 2;
+  }
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64(kFingerEntries));
+  for (const auto key : keys) {
+    tree.insert({key, key});
+  }
+  std::mt19937_64 random(kFingerEntries);
+  std::vector<decltype(tree)::const_iterator> found;
+  std::uint64_t sum = 0;
+  for (const std::size_t count : kFingerProbeCounts) {
+    std::vector<std::uint64_t> probes(count);
+    for (auto& probe : probes) {
+      probe = random() % (2 * kFingerEntries);
+    }
+    std::sort(probes.begin(), probes.end());
+    found.resize(count);
+    Report(std::to_string(count) + " probes", MeasureMs([&] {
+             search(tree, probes, found);
+           }));
+    for (const auto it : found) {
+      sum += it != tree.end() ? it->second : 0;
+    }
+  }
+  std::cout << "  (checksum " << sum << ")\n";
+}
+
+void BenchmarkFingerRoot() {
+  RunFingerSearch([](const auto& tree, const auto& probes, auto& found) {
+    for (std::size_t i = 0; i < probes.size(); ++i) {
+      found[i] = tree.find(probes[i]);
+    }
+  });
+}
+
+void BenchmarkFingerFindSorted() {
+  RunFingerSearch([](const auto& tree, const auto& probes, auto& found) {
+    tree.find_sorted(std::span(probes), found.begin());
+  });
+}
+
+/*
+ * Sorted batches of odd keys into a tree of kBatchTreeEntries even keys
+ * inserted at random, at several batch to tree size ratios.
+ */
+template <typename Insert>
+void RunSortedBatch(Insert insert) {
+  using tree_type = RBtree<std::uint64_t, std::uint64_t>;
+  std::vector<std::uint64_t> keys(kBatchTreeEntries);
+  for (std::size_t i = 0; i < kBatchTreeEntries; ++i) {
+    keys[i] = 2 * i;
+  }
+  std::mt19937_64 random(kBatchTreeEntries);
+  std::shuffle(keys.begin(), keys.end(), random);
+  std::uint64_t sum = 0;
+  for (const std::size_t per_mille : kBatchPerMille) {
+    tree_type tree;
+    for (const auto key : keys) {
+      tree.insert({key, key});
+    }
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> batch(
+        kBatchTreeEntries * per_mille / 1000);
+    for (auto& [key, value] : batch) {
+      key = 2 * (random() % (2 * kBatchTreeEntries)) + 1;
+      value = key;
+    }
+    std::sort(batch.begin(), batch.end());
+    Report("batch " + std::to_string(batch.size()), MeasureMs([&] {
+             insert(tree, batch);
+           }));
+    sum += tree.size();
+  }
+  std::cout << "  (checksum " << sum << ")\n";
+}
+
+/* Hides the size of a batch from insert_sorted_batch. */
+template <typename It>
+struct SinglePassIterator {
+  using iterator_concept = std::input_iterator_tag;
+  using value_type = std::iter_value_t<It>;
+  using difference_type = std::iter_difference_t<It>;
+
+  decltype(auto) operator*() const { return *it; }
+  SinglePassIterator& operator++() {
+    ++it;
+    return *this;
+  }
+  void operator++(int) { ++it; }
+  bool operator==(const SinglePassIterator&) const = default;
+
+  It it;
+};
+
+void BenchmarkSortedBatchInsertLoop() {
+  RunSortedBatch([](auto& tree, const auto& batch) {
+    for (const auto& value : batch) {
+      tree.insert(value);
+    }
+  });
+}
+
+void BenchmarkSortedBatchFinger() {
+  RunSortedBatch([](auto& tree, const auto& batch) {
+    using iterator = SinglePassIterator<decltype(batch.begin())>;
+    tree.insert_sorted_batch(iterator{batch.begin()}, iterator{batch.end()});
+  });
+}
+
+void BenchmarkSortedBatchMerge() {
+  RunSortedBatch([](auto& tree, const auto& batch) {
+    tree.insert_sorted_batch(batch.begin(), batch.end());
+  });
+}
+
+/* Counts the bytes in use, to weigh a container with its allocations. */
+class CountingResource : public std::pmr::memory_resource {
+ public:
+  std::size_t bytes() const noexcept { return bytes_; }
+
+ private:
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+    bytes_ += bytes;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void* pointer, std::size_t bytes,
+                     std::size_t alignment) override {
+    bytes_ -= bytes;
+    std::pmr::new_delete_resource()->deallocate(pointer, bytes, alignment);
+  }
+
+  bool do_is_equal(
+      const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+
+  std::size_t bytes_{};
+};
+
+/*
+ * Many short-lived maps of a few entries each: built, read and dropped,
+ * moved, then the memory of one of them. PmrMap is Map on a polymorphic
+ * allocator, only used to count the bytes.
+ */
+template <typename Map, typename PmrMap>
+void RunSmallMaps() {
+  std::uint64_t sum = 0;
+  for (const std::size_t size : kSmallMapSizes) {
+    Report("build, find and destroy " + std::to_string(size),
+           MeasureMs([&] {
+             for (std::size_t i = 0; i < kSmallMaps; ++i) {
+               Map map;
+               for (std::uint64_t key = 0; key < size; ++key) {
+                 map.insert({(key * 7 + i) % size, key});
+               }
+               sum += map.size() + map.count(i % 16);
+             }
+           }));
+    Map source;
+    for (std::uint64_t key = 0; key < size; ++key) {
+      source.insert({key, key});
+    }
+    Report("move there and back " + std::to_string(size), MeasureMs([&] {
+             for (std::size_t i = 0; i < kSmallMaps; ++i) {
+               Map target(std::move(source));
+               source = std::move(target);
+             }
+           }));
+    sum += source.size();
+    CountingResource resource;
+    PmrMap map(&resource);
+    for (std::uint64_t key = 0; key < size; ++key) {
+      map.insert({key, key});
+    }
+    std::cout << "  bytes per map of " << size << ": "
+              << sizeof(map) + resource.bytes() << "\n";
+  }
+  std::cout << "  (checksum " << sum << ")\n";
+}
+
+using SmallMapEntry = std::pair<const std::uint64_t, std::uint64_t>;
+
+/* kMovedTrees trees of size entries pushed into a vector as it grows. */
+template <typename Tree>
+std::size_t GrowVectorOfTrees(std::size_t size) {
+  std::vector<Tree> trees;
+  for (std::size_t i = 0; i < kMovedTrees; ++i) {
+    trees.emplace_back();
+    for (std::uint64_t key = 0; key < size; ++key) {
+      trees.back().insert({key, key});
+    }
+  }
+  return trees.size();
+}
+
+/*
+ * RBtree moves and swaps redirect every link to the embedded sentinel, so
+ * they are linear, unlike those of std::map: their cost next to building
+ * the same tree, and a vector of kMovedTrees trees relocating as it grows.
+ */
+template <typename Tree>
+void RunMoves() {
+  using std::swap;
+  std::uint64_t sum = 0;
+  for (const std::size_t size : kMoveSizes) {
+    const std::string suffix = " " + std::to_string(size);
+    Tree tree;
+    Report("insert" + suffix, MeasureMs([&] {
+             for (std::uint64_t key = 0; key < size; ++key) {
+               tree.insert({key, key});
+             }
+           }));
+    Tree other;
+    Report("move there and back x" + std::to_string(kMoves) + suffix,
+           MeasureMs([&] {
+             for (std::size_t i = 0; i < kMoves; ++i) {
+               other = std::move(tree);
+               tree = std::move(other);
+             }
+           }));
+    Report("swap x" + std::to_string(kMoves) + suffix, MeasureMs([&] {
+             for (std::size_t i = 0; i < kMoves; ++i) {
+               swap(tree, other);
+             }
+           }));
+    sum += tree.size() + other.size();
+  }
+  sum += GrowVectorOfTrees<Tree>(kSmallMapSizes[1]);
+  for (const std::size_t size : kSmallMapSizes) {
+    Report("vector growth, trees of " + std::to_string(size),
+           MeasureMs([&] { sum += GrowVectorOfTrees<Tree>(size); }));
+  }
+  std::cout << "  (checksum " << sum << ")\n";
+}
+
+void BenchmarkSmallMapsRBtree() {
+  RunSmallMaps<RBtree<std::uint64_t, std::uint64_t>,
+               pmr::RBtree<std::uint64_t, std::uint64_t>>();
+}
+
+void BenchmarkSmallMapsInline() {
+  RunSmallMaps<RBtreeSmall<std::uint64_t, std::uint64_t>,
+               RBtreeSmall<std::uint64_t, std::uint64_t,
+                           std::less<std::uint64_t>,
+                           std::pmr::polymorphic_allocator<SmallMapEntry>>>();
+}
+
+/*
+ * Replicas of kReplicaEntries entries, as kept by a cache that checks them
+ * for changes: the cost of updates, then of == against an equal replica
+ * and against one a single mapped value apart.
+ */
+template <typename Tree>
+void RunReplicas() {
+  std::vector<std::uint64_t> keys(kReplicaEntries);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64(kReplicaEntries));
+  Tree tree;
+  Tree replica;
+  Report("insert", MeasureMs([&] {
+           for (const auto key : keys) {
+             tree.insert({key, key});
+           }
+         }));
+  for (const auto key : keys) {
+    replica.insert({key, key});
+  }
+  std::size_t equal = 0;
+  Report("== equal", MeasureMs([&] {
+           for (std::size_t i = 0; i < kReplicaComparisons; ++i) {
+             equal += tree == replica ? 1U : 0U;
+           }
+         }));
+  replica.erase(keys.front());
+  replica.insert({keys.front(), 0});
+  Report("== one value apart", MeasureMs([&] {
+           for (std::size_t i = 0; i < kReplicaComparisons; ++i) {
+             equal += tree == replica ? 1U : 0U;
+           }
+         }));
+  Report("erase", MeasureMs([&] {
+           for (const auto key : keys) {
+             equal += tree.erase(key);
+           }
+         }));
+  std::cout << "  (checksum " << equal << ")\n";
+}
+
+using DigestTree =
+    RBtree<std::uint64_t, std::uint64_t, std::less<std::uint64_t>,
+           std::allocator<std::pair<const std::uint64_t, std::uint64_t>>,
+           rbtree_digest_policy<>>;
+
+/* Same order as std::less, but hides the key type from the fast paths. */
+template <typename Key>
+struct PlainLess {
+  bool operator()(const Key& lhs, const Key& rhs) const { return lhs < rhs; }
+};
+
+template <typename Tree>
+void RunKeySearch() {
+  using key_type = typename Tree::key_type;
+  std::mt19937_64 random(kKeySearchEntries);
+  std::vector<key_type> keys;
+  Tree tree;
+  while (keys.size() < kKeySearchEntries) {
+    const auto key = static_cast<key_type>(random() >> 33);
+    if (tree.insert({key, key}).second) {
+      keys.push_back(key);
+    }
+  }
+  std::vector<key_type> probes(kLookupProbes);
+  for (auto& probe : probes) {
+    probe = keys[random() % keys.size()];
+  }
+
+  double sum = 0;
+  Report("find hit", MeasureMs([&] {
+           for (const auto probe : probes) {
+             sum += static_cast<double>(tree.find(probe)->second);
+           }
+         }));
+  Report("lower_bound", MeasureMs([&] {
+           for (const auto probe : probes) {
+             auto it = tree.lower_bound(probe + 1);
+             sum += it != tree.end() ? static_cast<double>(it->second) : 0.0;
+           }
+         }));
+  std::cout << "  (checksum " << sum << ")\n";
+}
+
+template <typename Key>
+using KeySearchRBtree = RBtree<Key, Key>;
+
+template <typename Key>
+using KeySearchRBtreeBranchy = RBtree<Key, Key, PlainLess<Key>>;
+
+template <typename Key>
+using KeySearchBtree = Btree<Key, Key>;
+
+template <typename Key>
+using KeySearchBtreeBinary = Btree<Key, Key, PlainLess<Key>>;
+
+struct Benchmark {
+  std::string_view name;
+  void (*run)();
+};
+
+constexpr Benchmark kBenchmarks[] = {
+    {"restart", BenchmarkRestart},
+    {"string_keys/two_way", BenchmarkStringKeysTwoWay},
+    {"string_keys/three_way", BenchmarkStringKeysThreeWay},
+    {"prefix_cache/hosts/default", BenchmarkPrefixCacheHostsDefault},
+    {"prefix_cache/hosts/cached", BenchmarkPrefixCacheHostsCached},
+    {"prefix_cache/shared/default", BenchmarkPrefixCacheSharedDefault},
+    {"prefix_cache/shared/cached", BenchmarkPrefixCacheSharedCached},
+    {"find_equal", BenchmarkFindEqual},
+    {"scan/default", BenchmarkScanDefault},
+    {"scan/threaded", BenchmarkScanThreaded},
+    {"range_scan", BenchmarkRangeScan},
+    {"pagination", BenchmarkPagination},
+    {"container/rbtree", BenchmarkContainerRBtree},
+    {"container/btree", BenchmarkContainerBtree},
+    {"arena/pointers", BenchmarkArenaPointers},
+    {"arena/indices", BenchmarkArenaIndices},
+    {"compact/in_order", BenchmarkCompactInOrder},
+    {"compact/van_emde_boas", BenchmarkCompactVanEmdeBoas},
+    {"compact/incremental", BenchmarkCompactIncremental},
+    {"per_request/default", BenchmarkPerRequestDefault},
+    {"per_request/monotonic", BenchmarkPerRequestMonotonic},
+    {"events/multimap", BenchmarkEventsMultimap},
+    {"events/vectors", BenchmarkEventsVectors},
+    {"intervals/tree", BenchmarkIntervalsTree},
+    {"intervals/linear_scan", BenchmarkIntervalsLinearScan},
+    {"balancing/bottom_up", RunBalancing<BottomUpTree>},
+    {"balancing/top_down", RunBalancing<TopDownTree>},
+    {"balance_policy/red_black", RunBalancePolicy<BottomUpTree>},
+    {"balance_policy/avl", RunBalancePolicy<AvlTree>},
+    {"balance_policy/weight_balanced", RunBalancePolicy<WeightBalancedTree>},
+    {"finger/root", BenchmarkFingerRoot},
+    {"finger/find_sorted", BenchmarkFingerFindSorted},
+    {"sorted_batch/insert_loop", BenchmarkSortedBatchInsertLoop},
+    {"sorted_batch/finger", BenchmarkSortedBatchFinger},
+    {"sorted_batch/auto", BenchmarkSortedBatchMerge},
+    {"small_maps/rbtree", BenchmarkSmallMapsRBtree},
+    {"small_maps/inline", BenchmarkSmallMapsInline},
+    {"moves/rbtree", RunMoves<RBtree<std::uint64_t, std::uint64_t>>},
+    {"moves/std_map", RunMoves<std::map<std::uint64_t, std::uint64_t>>},
+    {"replicas/full_walk", RunReplicas<RBtree<std::uint64_t, std::uint64_t>>},
+    {"replicas/digest", RunReplicas<DigestTree>},
+    {"key_search/u32/rbtree_branchy",
+     RunKeySearch<KeySearchRBtreeBranchy<std::uint32_t>>},
+    {"key_search/u32/rbtree_branchless",
+     RunKeySearch<KeySearchRBtree<std::uint32_t>>},
+    {"key_search/u32/btree_binary",
+     RunKeySearch<KeySearchBtreeBinary<std::uint32_t>>},
+    {"key_search/u32/btree_simd", RunKeySearch<KeySearchBtree<std::uint32_t>>},
+    {"key_search/u64/rbtree_branchy",
+     RunKeySearch<KeySearchRBtreeBranchy<std::uint64_t>>},
+    {"key_search/u64/rbtree_branchless",
+     RunKeySearch<KeySearchRBtree<std::uint64_t>>},
+    {"key_search/u64/btree_binary",
+     RunKeySearch<KeySearchBtreeBinary<std::uint64_t>>},
+    {"key_search/u64/btree_simd", RunKeySearch<KeySearchBtree<std::uint64_t>>},
+    {"key_search/double/rbtree_branchy",
+     RunKeySearch<KeySearchRBtreeBranchy<double>>},
+    {"key_search/double/rbtree_branchless",
+     RunKeySearch<KeySearchRBtree<double>>},
+    {"key_search/double/btree_binary",
+     RunKeySearch<KeySearchBtreeBinary<double>>},
+    {"key_search/double/btree_simd", RunKeySearch<KeySearchBtree<double>>},
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const std::string_view filter = argc > 1 ? argv[1] : "";
+  for (const auto& [name, run] : kBenchmarks) {
+    if (name.find(filter) != std::string_view::npos) {
+      std::cout << name << ":\n";
+      run();
+    }
+  }
+}
@@ -0,0 +1,303 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <random>
+#include <ranges>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "RBtreeArena.hpp"
+#include "RBtreeValidator.hpp"
+#include "StressTestsCommon.hpp"
+
+/* The arena variant against std::map, plus its slot management. */
+
+namespace {
+
+using ArenaTree = RBtreeArena<int, int>;
+
+ArenaTree InitArenaSequence(auto start, auto stop, auto step = 1) {
+  ArenaTree result;
+  InsertSequence(result, start, stop, step);
+  return result;
+}
+
+template <typename Tree>
+void ExpectSameBounds(Tree& tree, const std::map<int, int>& expected,
+                      int key) {
+  const auto lower = tree.lower_bound(key);
+  const auto expected_lower = expected.lower_bound(key);
+  ASSERT_EQ(lower == tree.end(), expected_lower == expected.end());
+  if (lower != tree.end()) {
+    ASSERT_EQ(lower->first, expected_lower->first);
+  }
+  const auto upper = tree.upper_bound(key);
+  const auto expected_upper = expected.upper_bound(key);
+  ASSERT_EQ(upper == tree.end(), expected_upper == expected.end());
+  if (upper != tree.end()) {
+    ASSERT_EQ(upper->first, expected_upper->first);
+  }
+  ASSERT_EQ(tree.contains(key), expected.contains(key));
+}
+
+}  // namespace
+
+TEST(ARENA, EMPTY) {
+  ArenaTree tree;
+  ASSERT_TRUE(tree.empty());
+  ASSERT_EQ(tree.begin(), tree.end());
+  ASSERT_EQ(tree.find(0), tree.end());
+  ASSERT_EQ(tree.capacity(), 0);
+  ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+  tree.insert({0, 0});
+  ASSERT_FALSE(tree.empty());
+  ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+  tree.clear();
+  ASSERT_TRUE(tree.empty());
+  ASSERT_EQ(tree.begin(), tree.end());
+  ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+}
+
+TEST(ARENA, INSERT_DUPLICATE) {
+  ArenaTree tree;
+  DO_ATTEMPTS(kShuffleAttempts,
+    InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+    for (int i = 0; i < kShuffledInsertSize; ++i) {
+      auto [it, inserted] = tree.insert({i, -i});
+      ASSERT_FALSE(inserted);
+      ASSERT_EQ(it->first, i);
+      ASSERT_EQ(it->second, i);
+    }
+    ASSERT_EQ(tree.size(), kShuffledInsertSize);
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+    tree.clear();
+  )
+}
+
+TEST(ARENA, ELEMENT_ACCESS) {
+  ArenaTree tree = InitArenaSequence(1, kInsertSize, 2);
+  for (int i = 0; i < kInsertSize; ++i) {
+    if (i & 1) {
+      ASSERT_EQ(tree.at(i), i);
+    } else {
+      ASSERT_THROW(tree.at(i), std::out_of_range);
+    }
+  }
+  for (int i = 0; i < kInsertSize; i += 2) {
+    tree[i] = i;
+  }
+  for (int i = 0; i < kInsertSize; ++i) {
+    ASSERT_EQ(tree[i], i);
+  }
+  ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+}
+
+TEST(ARENA, ITERATORS) {
+  ArenaTree tree;
+  DO_ATTEMPTS(kShuffleAttempts,
+    InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+    ASSERT_TRUE(std::ranges::equal(tree | std::views::keys,
+                                   std::views::iota(0, kShuffledInsertSize)));
+    ASSERT_TRUE(std::ranges::equal(
+        std::views::reverse(tree) | std::views::keys,
+        std::views::iota(0, kShuffledInsertSize) | std::views::reverse));
+    ASSERT_EQ(std::prev(tree.end())->first, kShuffledInsertSize - 1);
+    ASSERT_EQ(tree.rbegin()->first, kShuffledInsertSize - 1);
+    ASSERT_EQ(std::distance(tree.cbegin(), tree.cend()), tree.size());
+    tree.clear();
+  )
+}
+
+TEST(ARENA, ITERATORS_SURVIVE_GROWTH) {
+  ArenaTree tree;
+  tree.insert({-1, -1});
+  const auto first = tree.begin();
+  const std::size_t capacity = tree.capacity();
+  InsertSequence(tree, 0, kShuffledInsertSize, 1);
+  ASSERT_GT(tree.capacity(), capacity);
+  ASSERT_EQ(first, tree.begin());
+  ASSERT_EQ(first->second, -1);
+}
+
+TEST(ARENA, RANDOM_OPERATIONS) {
+  ArenaTree tree;
+  std::map<int, int> expected;
+  std::mt19937 mt19937(kShuffledInsertSize);
+  std::uniform_int_distribution<int> keys(0, kShuffledInsertSize);
+  DO_ATTEMPTS(kShuffleAttempts,
+    for (int i = 0; i < kShuffledInsertSize; ++i) {
+      const int key = keys(mt19937);
+      if (mt19937() % 3 == 0) {
+        ASSERT_EQ(tree.erase(key), expected.erase(key));
+      } else {
+        ASSERT_EQ(tree.insert({key, i}).second,
+                  expected.insert({key, i}).second);
+      }
+    }
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+    ASSERT_TRUE(std::ranges::equal(tree, expected));
+    for (int i = 0; i < kShuffledInsertSize; i += 7) {
+      ExpectSameBounds(tree, expected, keys(mt19937));
+    }
+  )
+}
+
+TEST(ARENA, ERASE_RANGE) {
+  ArenaTree tree;
+  DO_ATTEMPTS(kShuffleAttempts,
+    InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+    auto last = tree.erase(tree.find(kLeftBorder), tree.find(kRightBorder));
+    ASSERT_EQ(last->first, kRightBorder);
+    ASSERT_EQ(tree.size(), kShuffledInsertSize - (kRightBorder - kLeftBorder));
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+    tree.erase(tree.begin(), tree.end());
+    ASSERT_TRUE(tree.empty());
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+  )
+}
+
+TEST(ARENA, ERASE_IF) {
+  ArenaTree tree = InitArenaSequence(0, kShuffledInsertSize, 1);
+  ASSERT_EQ(tree.erase_if([](const auto& value) noexcept {
+              return value.first % 2 == 0;
+            }),
+            kShuffledInsertSize / 2);
+  ASSERT_TRUE(std::ranges::all_of(
+      tree, [](const auto& value) { return value.first % 2 == 1; }));
+  ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+}
+
+TEST(ARENA, FREE_LIST) {
+  ArenaTree tree = InitArenaSequence(0, kShuffledInsertSize, 1);
+  const std::size_t capacity = tree.capacity();
+  const std::size_t bytes = tree.allocated_bytes();
+  DO_ATTEMPTS(kShuffleAttempts,
+    for (int i = current_attemp % 2; i < kShuffledInsertSize; i += 2) {
+      tree.erase(i);
+    }
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+    for (int i = current_attemp % 2; i < kShuffledInsertSize; i += 2) {
+      tree.insert({i, i});
+    }
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+  )
+  ASSERT_EQ(tree.capacity(), capacity);
+  ASSERT_EQ(tree.allocated_bytes(), bytes);
+  ASSERT_TRUE(std::ranges::equal(tree | std::views::keys,
+                                 std::views::iota(0, kShuffledInsertSize)));
+}
+
+TEST(ARENA, COMPACT) {
+  std::mt19937 mt19937(kShuffledInsertSize);
+  std::uniform_int_distribution<int> keys(0, kShuffledInsertSize);
+  for (const auto order :
+       {rbtree_arena_order::kInOrder, rbtree_arena_order::kBreadthFirst}) {
+    ArenaTree tree;
+    std::map<int, int> expected;
+    DO_ATTEMPTS(kShuffleAttempts,
+      for (int i = 0; i < kShuffledInsertSize / 10; ++i) {
+        const int key = keys(mt19937);
+        if (mt19937() % 2 == 0) {
+          tree.erase(key);
+          expected.erase(key);
+        } else {
+          tree.insert({key, i});
+          expected.insert({key, i});
+        }
+      }
+      tree.compact(order);
+      ASSERT_EQ(tree.capacity(), tree.size());
+      ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+      ASSERT_TRUE(std::ranges::equal(tree, expected));
+      for (int i = 0; i < kShuffledInsertSize; i += 13) {
+        ExpectSameBounds(tree, expected, keys(mt19937));
+      }
+    )
+    tree.clear();
+    tree.compact(order);
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+  }
+}
+
+TEST(ARENA, STRING_KEYS) {
+  RBtreeArena<std::string, std::string> tree;
+  for (int i = 0; i < kShuffledInsertSize; ++i) {
+    const std::string key =
+        "key/" + std::to_string(i * 7 % kShuffledInsertSize);
+    ASSERT_TRUE(tree.emplace(key, key + "/value").second);
+  }
+  ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+  ASSERT_TRUE(std::ranges::is_sorted(tree | std::views::keys));
+  for (int i = 0; i < kShuffledInsertSize; i += 2) {
+    ASSERT_EQ(tree.erase("key/" + std::to_string(i)), 1);
+  }
+  ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+  ASSERT_EQ(tree.size(), kShuffledInsertSize / 2);
+  ASSERT_EQ(tree.at("key/1"), "key/1/value");
+  tree["key/0"] = "again";
+  ASSERT_EQ(tree.try_emplace("key/0", "ignored").first->second, "again");
+  tree.compact(rbtree_arena_order::kBreadthFirst);
+  ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+  ASSERT_EQ(tree.at("key/3"), "key/3/value");
+}
+
+TEST(ARENA, COPY_MOVE_SWAP) {
+  ArenaTree tree;
+  InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+  tree.erase(tree.find(kLeftBorder), tree.find(kRightBorder));
+  ArenaTree copy(tree);
+  ASSERT_TRUE(RBtreeValidator(copy).is_valid());
+  ASSERT_TRUE(std::ranges::equal(copy, tree));
+
+  ArenaTree moved(std::move(copy));
+  ASSERT_TRUE(copy.empty());
+  ASSERT_TRUE(RBtreeValidator(copy).is_valid());
+  ASSERT_TRUE(std::ranges::equal(moved, tree));
+  copy.insert({1, 1});
+  ASSERT_TRUE(RBtreeValidator(copy).is_valid());
+
+  ArenaTree other = InitArenaSequence(0, kLeftBorder, 1);
+  swap(other, moved);
+  ASSERT_EQ(moved.size(), kLeftBorder);
+  moved = other;
+  ASSERT_TRUE(std::ranges::equal(moved, tree));
+  ASSERT_TRUE(RBtreeValidator(moved).is_valid());
+  ASSERT_TRUE(moved == tree);
+
+  /* The same keys, one mapped value apart. */
+  ++moved[kLeftBorder - 1];
+  ASSERT_FALSE(moved == tree);
+  ASSERT_TRUE((tree <=> moved) < 0);
+}
+
+TEST(ARENA, SET_MODE) {
+  RBtreeArena<std::string, void> set;
+  for (int i = 0; i < kShuffledInsertSize; ++i) {
+    set.insert(std::to_string(i));
+  }
+  ASSERT_FALSE(set.insert("0").second);
+  ASSERT_TRUE(RBtreeValidator(set).is_valid());
+  ASSERT_TRUE(std::ranges::is_sorted(set));
+  ASSERT_EQ(*set.begin(), "0");
+  set.compact();
+  ASSERT_TRUE(RBtreeValidator(set).is_valid());
+  ASSERT_EQ(set.size(), kShuffledInsertSize);
+}
+
+TEST(ARENA, VISIT) {
+  ArenaTree tree = InitArenaSequence(0, kShuffledInsertSize, 1);
+  std::vector<int> visited;
+  tree.for_each_in_range(kLeftBorder, kRightBorder, [&](const auto& value) {
+    visited.push_back(value.first);
+  });
+  ASSERT_TRUE(std::ranges::equal(visited,
+                                 std::views::iota(kLeftBorder, kRightBorder)));
+  int count = 0;
+  std::as_const(tree).visit(
+      [&](const auto& /*unused*/) { return ++count < 10; });
+  ASSERT_EQ(count, 10);
+}
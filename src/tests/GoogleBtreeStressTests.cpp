@@ -0,0 +1,600 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory_resource>
+#include <random>
+#include <ranges>
+#include <string>
+#include <utility>
+
+#include "Btree.hpp"
+#include "BtreeValidator.hpp"
+#include "RBtreeKeySearch.hpp"
+#include "StressTestsCommon.hpp"
+
+/* The RBtree stress tests run against Btree, plus checks of its structure. */
+
+namespace {
+
+Btree<int, int> InitBtreeSequence(auto start, auto stop, auto step = 1) {
+  Btree<int, int> result;
+  InsertSequence(result, start, stop, step);
+  return result;
+}
+
+template <typename Key>
+void CheckKeySearch() {
+  std::mt19937_64 mt19937(kShuffledInsertSize);
+  std::uniform_int_distribution<int> values(-kLeftBorder, kLeftBorder);
+  DO_ATTEMPTS(kShuffledInsertSize,
+    std::vector<Key> keys(mt19937() % 40);
+    for (auto& key : keys) {
+      key = static_cast<Key>(values(mt19937));
+    }
+    std::ranges::sort(keys);
+    const auto probe = static_cast<Key>(values(mt19937));
+    ASSERT_EQ(count_keys_below<false>(keys.data(), keys.size(), probe),
+              std::ranges::lower_bound(keys, probe) - keys.begin());
+    ASSERT_EQ(count_keys_below<true>(keys.data(), keys.size(), probe),
+              std::ranges::upper_bound(keys, probe) - keys.begin());
+  )
+}
+
+Btree<int, int> InitShuffledBtreeSequence(auto from, auto arrsize) {
+  Btree<int, int> result;
+  InsertShuffledSequence(result, from, arrsize);
+  return result;
+}
+
+}  // namespace
+
+TEST(BTREE, CREATE) { Btree<int, int> tree; }
+
+TEST(BTREE, INSERT_PERFORMED) {
+  Btree<int, int> tree = InitBtreeSequence(0, kInsertSize, 1);
+  ASSERT_EQ(tree.size(), kInsertSize);
+}
+
+TEST(BTREE, EMPTY) {
+  Btree<int, int> tree;
+  ASSERT_TRUE(tree.empty());
+  tree.insert({{}, {}});
+  ASSERT_FALSE(tree.empty());
+}
+
+TEST(BTREE, GETALLOCATOR) {
+  Btree<int, int> tree;
+  tree.get_allocator();
+}
+
+TEST(BTREE, INSERT_DUPLICATE) {
+  Btree<int, int> tree;
+  DO_ATTEMPTS(kShuffleAttempts,
+    InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+    for (int i = 0; i < kShuffledInsertSize; ++i) {
+      auto [it, inserted] = tree.insert({i, -i});
+      ASSERT_FALSE(inserted);
+      ASSERT_EQ(it->first, i);
+      ASSERT_EQ(it->second, i);
+    }
+    ASSERT_EQ(tree.size(), kShuffledInsertSize);
+    ASSERT_TRUE(BtreeValidator(tree).is_valid());
+    tree.clear();
+  )
+}
+
+TEST(BTREE, ELEMENT_ACCESS) {
+  Btree<int, int> tree = InitBtreeSequence(1, kInsertSize, 2);
+  for (int i = 0; i < kInsertSize; ++i) {
+    if (i & 1) {
+      ASSERT_EQ(tree.at(i), i);
+    } else {
+      ASSERT_THROW(tree.at(i), std::out_of_range);
+    }
+  }
+  InsertSequence(tree, 0, kInsertSize, 2);
+  for (int i = 0; i < kInsertSize; ++i) {
+    ASSERT_EQ(tree[i], i);
+  }
+}
+
+TEST(BTREE, INSERT_SORTING) {
+  DO_ATTEMPTS(kSortingInsertAttemps, 
+    Btree<int, int> tree = InitShuffledBtreeSequence(0, kShuffledInsertSize);
+    for (int i = 0; i < kShuffledInsertSize; ++i) {
+      ASSERT_EQ(tree[i], i);
+    }
+  )
+}
+
+TEST(BTREE, ITERATOR_BEGIN_END_EQ) {
+  Btree<int, int> tree;
+  ASSERT_EQ(tree.begin(), tree.end());
+}
+
+TEST(BTREE, ITERATOR_FOLLOW_FORWARD) {
+  Btree<int, int> tree;
+  DO_ATTEMPTS(kShuffleAttempts,
+    InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+    auto it = tree.begin();
+    for (int i = 0; i < kShuffledInsertSize; ++i) {
+      ASSERT_EQ(it->first, i);
+      ASSERT_EQ(it->second, i);
+      ++it;
+    }
+    tree.clear();
+  )
+}
+
+TEST(BTREE, ITERATOR_FOLLOW_BACKWARD) {
+  Btree<int, int> tree;
+  DO_ATTEMPTS(kShuffleAttempts,
+    InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+    auto it = tree.end();
+    for (int i = kShuffledInsertSize - 1; i > 0; --i) {
+      --it;
+      ASSERT_EQ(it->first, i);
+      ASSERT_EQ(it->second, i);
+    }
+    tree.clear();
+  )
+}
+
+TEST(BTREE, ITERATOR_FORWARD_BACKWARD) {
+  Btree<int, int> tree;
+  DO_ATTEMPTS(kShuffleAttempts,
+    InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+    auto it = tree.begin();
+    for (int i = 0; i < kShuffledInsertSize / 2; ++i) {
+      ASSERT_EQ(it->first, i);
+      ASSERT_EQ(it->second, i);
+      ++it;
+    }
+    for (int i = kShuffledInsertSize / 2; i > 0; --i) {
+      ASSERT_EQ(it->first, i);
+      ASSERT_EQ(it->second, i);
+      --it;
+    }
+    tree.clear();
+  )
+}
+
+TEST(BTREE, ITERATOR_PREV_END) {
+  Btree<int, int> tree;
+  DO_ATTEMPTS(kShuffleAttempts, 
+    InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+    ASSERT_EQ(std::prev(tree.end())->first, kShuffledInsertSize - 1);
+    ASSERT_EQ(std::prev(tree.end())->second, kShuffledInsertSize - 1);
+    tree.clear();
+  );
+}
+
+TEST(BTREE, ITERATOR_FORWARD_RANGE_LOOP) {
+  Btree<int, int> tree;
+  DO_ATTEMPTS(kShuffleAttempts, 
+    InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+    int expected_key = 0;
+    for (const auto& element : tree) {
+      ASSERT_EQ(element.first, expected_key);
+      ASSERT_EQ(element.second, expected_key);
+      ++expected_key;
+    }
+    expected_key = 0;
+    for (const auto& element : const_cast<const decltype(tree)&>(tree)) {
+      ASSERT_EQ(element.first, expected_key);
+      ASSERT_EQ(element.second, expected_key);
+      ++expected_key;
+    }
+    tree.clear();
+  );
+}
+
+TEST(BTREE, ITERATOR_BACKWARD_RANGE_LOOP) {
+  Btree<int, int> tree;
+  DO_ATTEMPTS(kShuffleAttempts, 
+    InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+    int expected_key = kShuffledInsertSize;
+    for (const auto& element : std::views::reverse(tree)) {
+      --expected_key;
+      ASSERT_EQ(element.first, expected_key);
+      ASSERT_EQ(element.second, expected_key);
+    }
+    expected_key = kShuffledInsertSize;
+    for (const auto& element : std::views::reverse(const_cast<const decltype(tree)&>(tree))) {
+      --expected_key;
+      ASSERT_EQ(element.first, expected_key);
+      ASSERT_EQ(element.second, expected_key);
+    }
+    tree.clear();
+  );
+}
+
+TEST(BTREE, ITERATOR_REVERSE) {
+  Btree<int, int> tree;
+  ASSERT_EQ(tree.rbegin(), tree.rend());
+  DO_ATTEMPTS(kShuffleAttempts,
+    InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+    ASSERT_EQ(tree.rbegin()->first, kShuffledInsertSize - 1);
+    ASSERT_EQ(std::distance(tree.rbegin(), tree.rend()), kShuffledInsertSize);
+    ASSERT_TRUE(std::ranges::equal(
+        std::ranges::subrange(tree.crbegin(), tree.crend()) | std::views::keys,
+        std::views::iota(0, kShuffledInsertSize) | std::views::reverse));
+    tree.clear();
+  )
+}
+
+TEST(BTREE, CLEAR) {
+  Btree<int, int> tree;
+  DO_ATTEMPTS(kShuffleAttempts, 
+    InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+    tree.clear();
+    ASSERT_TRUE(tree.empty());
+  );
+}
+
+TEST(BTREE, COUNT) {
+  Btree<int, int> tree = InitBtreeSequence(0, kInsertSize, 1);
+  for (int i = 0; i < kInsertSize; ++i) {
+    ASSERT_EQ(tree.count(i), 1);
+  }
+  ASSERT_EQ(tree.count(-1), 0);
+  ASSERT_EQ(tree.count(kInsertSize), 0);
+}
+
+TEST(BTREE, FIND) {
+  Btree<int, int> tree;
+  DO_ATTEMPTS(kShuffleAttempts,
+    InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+    for (int i = 0; i < kShuffledInsertSize; ++i) {
+      auto it = tree.find(i);
+      ASSERT_NE(it, tree.end());
+      ASSERT_EQ(it->second, i);
+    }
+    ASSERT_EQ(tree.find(-1), tree.end());
+    ASSERT_EQ(tree.find(kInsertSize), tree.end());
+    tree.clear();
+  )
+}
+
+TEST(BTREE, CONTAINS) {
+  Btree<int, int> tree = InitBtreeSequence(0, kInsertSize, 1);
+  for (int i = 0; i < kInsertSize; ++i) {
+    ASSERT_TRUE(tree.contains(i));
+  }
+  ASSERT_FALSE(tree.contains(-1));
+  ASSERT_FALSE(tree.contains(kInsertSize));
+}
+
+TEST(BTREE, LOWER_BOUND) {
+  Btree<int, int> tree = InitBtreeSequence(0, kInsertSize, 2);
+  for (int i = 0; i < kInsertSize - 1; ++i) {
+    auto it = tree.lower_bound(i);
+    if (i % 2 == 0) {
+      ASSERT_EQ(it->first, i);
+    } else {
+      ASSERT_EQ(it->first, i + 1);
+    }
+  }
+  ASSERT_EQ(tree.lower_bound(kInsertSize - 1), tree.end());
+  ASSERT_EQ(tree.lower_bound(kInsertSize), tree.end());
+}
+
+TEST(BTREE, UPPER_BOUND) {
+  Btree<int, int> tree = InitBtreeSequence(0, kInsertSize, 2);
+  for (int i = 0; i < kInsertSize - 2; ++i) {
+    auto it = tree.upper_bound(i);
+    if (i % 2 == 0) {
+      ASSERT_EQ(it->first, i + 2);
+    } else {
+      ASSERT_EQ(it->first, i + 1);
+    }
+  }
+  ASSERT_EQ(tree.upper_bound(kInsertSize - 2), tree.end());
+  ASSERT_EQ(tree.upper_bound(kInsertSize - 1), tree.end());
+  ASSERT_EQ(tree.upper_bound(kInsertSize), tree.end());
+}
+
+TEST(BTREE, EQUAL_RANGE) {
+  Btree<int, int> tree = InitBtreeSequence(0, kInsertSize, 1);
+  for (int i = 0; i < kInsertSize - 1; ++i) {
+    auto range = tree.equal_range(i);
+    ASSERT_EQ(range.first->first, i);
+    ASSERT_EQ(range.second->first, i + 1);
+  }
+  auto range = tree.equal_range(kInsertSize);
+  ASSERT_EQ(range.first, tree.end());
+  ASSERT_EQ(range.second, tree.end());
+}
+
+TEST(BTREE, SPACESHIP_OPERATOR) {
+  Btree<int, int> empty_tree1;
+  Btree<int, int> empty_tree2;
+  ASSERT_TRUE((empty_tree1 <=> empty_tree2) == 0);
+
+  Btree<int, int> tree1;
+  Btree<int, int> tree2;
+  InsertSequence(tree1, 0, kInsertSize, 1);
+  InsertSequence(tree2, 0, kInsertSize, 1);
+  ASSERT_TRUE((tree1 <=> tree2) == 0);
+
+  Btree<int, int> tree3;
+  InsertSequence(tree3, 0, kInsertSize / 2, 1);
+  ASSERT_TRUE((tree3 <=> tree1) < 0);
+  ASSERT_TRUE((tree1 <=> tree3) > 0);
+
+  Btree<int, int> tree4;
+  InsertSequence(tree4, kInsertSize / 2, kInsertSize, 1);
+  ASSERT_TRUE((tree4 <=> tree1) > 0);
+  ASSERT_TRUE((tree1 <=> tree4) < 0);
+
+  Btree<int, double> tree5;
+  Btree<int, double> tree6;
+  for (int i = 0; i < kInsertSize; ++i) {
+    tree5.insert({i, static_cast<double>(i)});
+    tree6.insert({i, static_cast<double>(i)});
+  }
+  ASSERT_TRUE((tree5 <=> tree6) == 0);
+
+  Btree<int, int> tree7;
+  Btree<int, int> tree8;
+  InsertSequence(tree7, 0, kInsertSize, 1);
+  InsertSequence(tree8, 1, kInsertSize + 1, 1);
+  ASSERT_TRUE((tree7 <=> tree8) < 0);
+  ASSERT_TRUE((tree8 <=> tree7) > 0);
+
+  Btree<int, int> tree9;
+  Btree<int, int> tree10;
+  InsertSequence(tree9, 0, kInsertSize, 1);
+  InsertSequence(tree10, 0, kInsertSize, 1);
+  tree10.insert({kInsertSize + 1, kInsertSize + 1});
+  ASSERT_TRUE((tree9 <=> tree10) < 0);
+  ASSERT_TRUE((tree10 <=> tree9) > 0);
+
+  Btree<int, int> tree11;
+  Btree<int, int> tree12;
+  InsertSequence(tree11, 0, kInsertSize, 3);
+  InsertSequence(tree12, 0, kInsertSize, 5);
+  ASSERT_TRUE((tree11 <=> tree12) < 0);
+  ASSERT_TRUE((tree12 <=> tree11) > 0);
+
+  /* The same keys, one mapped value apart. */
+  Btree<int, int> tree13;
+  InsertSequence(tree13, 0, kInsertSize, 3);
+  ASSERT_TRUE(tree13 == tree11);
+  tree13[3] = -1;
+  ASSERT_FALSE(tree13 == tree11);
+  ASSERT_TRUE((tree13 <=> tree11) < 0);
+}
+
+TEST(BTREE, ERASE) {
+  Btree<int, int> tree;
+  DO_ATTEMPTS(kShuffleAttempts,
+    InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+    for (int i = 0; i < kShuffledInsertSize; ++i) {
+      auto it = tree.find(i);
+      ASSERT_EQ(it, tree.begin());
+      ASSERT_NE(it, tree.end());
+      tree.erase(it);
+      ASSERT_FALSE(tree.contains(i));
+      ASSERT_EQ(tree.size(), kShuffledInsertSize - 1 - i);
+    }
+    ASSERT_TRUE(tree.empty());
+  )
+}
+
+TEST(BTREE, ERASE_MIDDLE) {
+  Btree<int, int> tree;
+  DO_ATTEMPTS(kShuffleAttempts,
+    InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+    int ctr = 0;
+    for (int i = kLeftBorder; i < kRightBorder; ++i, ++ctr) {
+      auto it = tree.find(i);
+      ASSERT_EQ(tree.begin()->first, 0);
+      ASSERT_NE(it, tree.end());
+      tree.erase(it);
+      ASSERT_FALSE(tree.contains(i));
+      ASSERT_EQ(tree.size(), kShuffledInsertSize - ctr - 1);
+    }
+    ASSERT_EQ(tree.size(), kShuffledInsertSize - ctr);
+    tree.clear();
+  )
+}
+
+TEST(BTREE, ERASE_BY_KEY) {
+  Btree<int, int> tree;
+  DO_ATTEMPTS(kShuffleAttempts,
+    InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+    for (int i = 0; i < kShuffledInsertSize; ++i) {
+      ASSERT_TRUE(tree.contains(i));
+      tree.erase(i);
+      ASSERT_FALSE(tree.contains(i));
+      ASSERT_EQ(tree.size(), kShuffledInsertSize - 1 - i);
+    }
+    ASSERT_TRUE(tree.empty());
+  )
+}
+
+TEST(BTREE, ERASE_RANGE) {
+  Btree<int, int> tree;
+  DO_ATTEMPTS(kShuffleAttempts,
+    InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+    auto first = tree.find(kLeftBorder);
+    auto last = tree.find(kRightBorder);
+    tree.erase(first, last);
+    for (int i = kLeftBorder; i < kRightBorder; ++i) {
+      ASSERT_FALSE(tree.contains(i));
+    }
+    for (int i = 0; i < kLeftBorder; ++i) {
+      ASSERT_TRUE(tree.contains(i));
+    }
+    for (int i = kRightBorder; i < kShuffledInsertSize; ++i) {
+      ASSERT_TRUE(tree.contains(i));
+    }
+    ASSERT_EQ(tree.size(), kShuffledInsertSize - kRightBorder + kLeftBorder);
+    tree.clear();
+  )
+}
+
+TEST(BTREE, ERASE_IF) {
+  const auto EvenPred = [](const Btree<int, int>::value_type& value) noexcept {
+    return !(value.first & 1);
+  };
+  const auto OddPred = [](const Btree<int, int>::value_type& value) noexcept {
+    return value.first & 1;
+  };
+  Btree<int, int> tree = InitBtreeSequence(0, kInsertSize, 1);
+  tree.erase_if(EvenPred);
+  ASSERT_EQ(tree.size(), kInsertSize / 2);
+  for (const auto& value : tree) {
+    ASSERT_TRUE(OddPred(value));
+  }
+  tree.erase_if(OddPred);
+  ASSERT_TRUE(tree.empty());
+}
+
+TEST(BTREE, VALIDATOR) {
+  Btree<int, int> tree;
+  ASSERT_TRUE(BtreeValidator(tree).is_valid());
+  InsertSequence(tree, 0, kInsertSize, 1);
+  ASSERT_TRUE(BtreeValidator(tree).is_valid());
+  tree.clear();
+  DO_ATTEMPTS(kShuffleAttempts,
+    InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+    ASSERT_TRUE(BtreeValidator(tree).is_valid());
+    tree.erase(tree.find(kLeftBorder), tree.find(kRightBorder));
+    ASSERT_TRUE(BtreeValidator(tree).is_valid());
+    tree.erase(tree.begin(), tree.end());
+    ASSERT_TRUE(BtreeValidator(tree).is_valid());
+  )
+}
+
+TEST(BTREE, RANDOM_OPERATIONS) {
+  Btree<int, int> tree;
+  std::map<int, int> expected;
+  std::mt19937 mt19937(kShuffledInsertSize);
+  std::uniform_int_distribution<int> keys(0, kShuffledInsertSize);
+  DO_ATTEMPTS(kShuffleAttempts,
+    for (int i = 0; i < kShuffledInsertSize; ++i) {
+      const int key = keys(mt19937);
+      if (mt19937() % 3 == 0) {
+        ASSERT_EQ(tree.erase(key), expected.erase(key));
+      } else {
+        ASSERT_EQ(tree.insert({key, i}).second,
+                  expected.insert({key, i}).second);
+      }
+    }
+    ASSERT_TRUE(BtreeValidator(tree).is_valid());
+    ASSERT_TRUE(std::ranges::equal(tree, expected));
+  )
+}
+
+TEST(BTREE, STRING_KEYS) {
+  Btree<std::string, std::string> tree;
+  for (int i = 0; i < kShuffledInsertSize; ++i) {
+    const std::string key =
+        "key/" + std::to_string(i * 7 % kShuffledInsertSize);
+    ASSERT_TRUE(tree.emplace(key, key + "/value").second);
+  }
+  ASSERT_TRUE(BtreeValidator(tree).is_valid());
+  ASSERT_TRUE(std::ranges::is_sorted(tree | std::views::keys));
+  for (int i = 0; i < kShuffledInsertSize; i += 2) {
+    ASSERT_EQ(tree.erase("key/" + std::to_string(i)), 1);
+  }
+  ASSERT_TRUE(BtreeValidator(tree).is_valid());
+  ASSERT_EQ(tree.size(), kShuffledInsertSize / 2);
+  ASSERT_EQ(tree.at("key/1"), "key/1/value");
+  tree["key/0"] = "again";
+  ASSERT_EQ(tree.try_emplace("key/0", "ignored").first->second, "again");
+}
+
+TEST(BTREE, COPY_MOVE_SWAP) {
+  Btree<int, int> tree = InitShuffledBtreeSequence(0, kShuffledInsertSize);
+  Btree<int, int> copy(tree);
+  ASSERT_TRUE(BtreeValidator(copy).is_valid());
+  ASSERT_TRUE(std::ranges::equal(copy, tree));
+
+  Btree<int, int> moved(std::move(copy));
+  ASSERT_TRUE(copy.empty());
+  ASSERT_TRUE(std::ranges::equal(moved, tree));
+
+  Btree<int, int> other = InitBtreeSequence(0, kLeftBorder, 1);
+  swap(other, moved);
+  ASSERT_EQ(other.size(), kShuffledInsertSize);
+  ASSERT_EQ(moved.size(), kLeftBorder);
+  moved = other;
+  ASSERT_TRUE(std::ranges::equal(moved, tree));
+  ASSERT_TRUE(BtreeValidator(moved).is_valid());
+}
+
+TEST(BTREE, ALLOCATOR) {
+  using allocator_type =
+      std::pmr::polymorphic_allocator<std::pair<const int, int>>;
+  using pmr_btree = Btree<int, int, std::less<int>, allocator_type>;
+  std::pmr::unsynchronized_pool_resource first_pool;
+  std::pmr::unsynchronized_pool_resource second_pool;
+  pmr_btree first(allocator_type{&first_pool});
+  pmr_btree second(std::less<int>(), allocator_type{&second_pool});
+  InsertShuffledSequence(first, 0, kShuffledInsertSize);
+  InsertSequence(second, 0, kLeftBorder, 1);
+
+  /* The nodes stay with the resource that allocated them. */
+  pmr_btree moved(std::move(first));
+  ASSERT_EQ(moved.get_allocator().resource(), &first_pool);
+  pmr_btree sibling(allocator_type{&first_pool});
+  swap(moved, sibling);
+  ASSERT_EQ(sibling.size(), kShuffledInsertSize);
+  ASSERT_EQ(moved.get_allocator().resource(), &first_pool);
+
+  /* Neither assignment propagates a polymorphic allocator. */
+  second = sibling;
+  ASSERT_EQ(second.get_allocator().resource(), &second_pool);
+  ASSERT_TRUE(std::ranges::equal(second, sibling));
+  moved = std::move(second);
+  ASSERT_EQ(moved.get_allocator().resource(), &first_pool);
+  ASSERT_TRUE(second.empty());
+  ASSERT_TRUE(std::ranges::equal(moved, sibling));
+  moved.erase(moved.begin(), moved.find(kLeftBorder));
+  InsertSequence(second, 0, kLeftBorder, 1);
+  ASSERT_TRUE(BtreeValidator(moved).is_valid());
+  ASSERT_TRUE(BtreeValidator(second).is_valid());
+
+  /* A copy asks the allocator, here for the default resource. */
+  const pmr_btree copy(sibling);
+  ASSERT_EQ(copy.get_allocator().resource(),
+            std::pmr::get_default_resource());
+  ASSERT_TRUE(std::ranges::equal(copy, sibling));
+}
+
+TEST(BTREE, KEY_SEARCH) {
+  CheckKeySearch<std::int32_t>();
+  CheckKeySearch<std::uint32_t>();
+  CheckKeySearch<std::int64_t>();
+  CheckKeySearch<std::uint64_t>();
+  CheckKeySearch<float>();
+  CheckKeySearch<double>();
+
+  Btree<double, int> tree;
+  std::map<double, int> expected;
+  std::mt19937 mt19937(kShuffledInsertSize);
+  std::uniform_int_distribution<int> keys(0, kShuffledInsertSize);
+  for (int i = 0; i < kInsertSize / 10; ++i) {
+    const double key = keys(mt19937) / 4.0;
+    if (i % 3 == 0) {
+      ASSERT_EQ(tree.erase(key), expected.erase(key));
+    } else {
+      ASSERT_EQ(tree.insert({key, i}).second, expected.insert({key, i}).second);
+    }
+  }
+  ASSERT_TRUE(BtreeValidator(tree).is_valid());
+  for (int i = -1; i <= kShuffledInsertSize + 1; ++i) {
+    const double key = i / 4.0 + 0.1;
+    const auto it = tree.upper_bound(key);
+    const auto expected_it = expected.upper_bound(key);
+    ASSERT_EQ(it == tree.end(), expected_it == expected.end());
+    if (it != tree.end()) {
+      ASSERT_EQ(it->first, expected_it->first);
+    }
+  }
+}
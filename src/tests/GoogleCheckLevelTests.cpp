@@ -0,0 +1,152 @@
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+#include <ranges>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include "RBtreeArena.hpp"
+#include "RBtreeTestConstructor.hpp"
+#include "StressTestsCommon.hpp"
+
+/*
+ * Built with RBTREE_CHECK_LEVEL=2: every mutation below is followed by a
+ * full RBtreeValidator pass, so the sizes are kept small.
+ */
+
+static_assert(kRBtreeCheckLevel == rbtree_check_level::kFull);
+
+namespace {
+
+constexpr int kCheckedSize = 1000;
+
+using ThreadedTree = RBtree<int, int, std::less<int>,
+                            std::allocator<std::pair<const int, int>>,
+                            rbtree_threaded_policy>;
+
+using TopDownTree = RBtree<int, int, std::less<int>,
+                           std::allocator<std::pair<const int, int>>,
+                           rbtree_top_down_policy>;
+
+template <typename Tree>
+void RandomOperations(Tree& tree) {
+  std::map<int, int> expected;
+  std::mt19937 mt19937(kCheckedSize);
+  std::uniform_int_distribution<int> keys(0, kCheckedSize);
+  for (int i = 0; i < 4 * kCheckedSize; ++i) {
+    const int key = keys(mt19937);
+    if (mt19937() % 3 == 0) {
+      ASSERT_EQ(tree.erase(key), expected.erase(key));
+    } else {
+      ASSERT_EQ(tree.insert({key, i}).second,
+                expected.insert({key, i}).second);
+    }
+  }
+  ASSERT_TRUE(std::ranges::equal(tree, expected));
+  tree.erase(tree.find(kCheckedSize / 4) == tree.end()
+                 ? tree.begin()
+                 : tree.find(kCheckedSize / 4),
+             tree.lower_bound(kCheckedSize / 2));
+  tree.erase_if(
+      [](const auto& value) noexcept { return value.first % 3 == 0; });
+  tree.clear();
+}
+
+/* A batch by finger search, then one large enough to be merged. */
+template <typename Tree>
+void InsertBatches(Tree& tree) {
+  InsertSequence(tree, 0, kCheckedSize, 2);
+  std::vector<std::pair<int, int>> batch;
+  for (int i = 1; i < kCheckedSize; i += 3) {
+    batch.emplace_back(i, i);
+  }
+  tree.insert_sorted_batch(batch.begin(), batch.end());
+  for (int i = kCheckedSize; i < 4 * kCheckedSize; ++i) {
+    batch.emplace_back(i, i);
+  }
+  tree.insert_sorted_batch(batch.begin(), batch.end());
+}
+
+}  // namespace
+
+TEST(CHECK_LEVEL, RBTREE) {
+  RBtree<int, int> tree;
+  RandomOperations(tree);
+  InsertShuffledSequence(tree, 0, kCheckedSize);
+  tree.compact(rbtree_layout::kVanEmdeBoas);
+  while (!tree.compact_step(kCheckedSize / 10)) {
+    tree.erase(tree.begin());
+  }
+  std::stringstream stream;
+  tree.serialize(stream);
+  RBtree<int, int> loaded;
+  loaded.deserialize(stream);
+  ASSERT_TRUE(loaded == tree);
+  RBtree<int, int> moved(std::move(loaded));
+  swap(moved, tree);
+  moved.insert({kCheckedSize, 0});
+  tree.erase(tree.begin());
+}
+
+TEST(CHECK_LEVEL, THREADED) {
+  ThreadedTree tree;
+  RandomOperations(tree);
+}
+
+TEST(CHECK_LEVEL, TOP_DOWN) {
+  TopDownTree tree;
+  RandomOperations(tree);
+  InsertBatches(tree);
+}
+
+TEST(CHECK_LEVEL, AVL) {
+  RBtree<int, int, std::less<int>, std::allocator<std::pair<const int, int>>,
+         rbtree_avl_policy>
+      tree;
+  RandomOperations(tree);
+  InsertBatches(tree);
+}
+
+TEST(CHECK_LEVEL, WEIGHT_BALANCED) {
+  RBtree<int, int, std::less<int>, std::allocator<std::pair<const int, int>>,
+         rbtree_weight_balanced_policy>
+      tree;
+  RandomOperations(tree);
+  InsertBatches(tree);
+}
+
+TEST(CHECK_LEVEL, DIGEST) {
+  RBtree<int, int, std::less<int>, std::allocator<std::pair<const int, int>>,
+         rbtree_digest_policy<>>
+      tree;
+  RandomOperations(tree);
+  InsertBatches(tree);
+  tree.insert_or_assign(0, -1);
+  tree.update(tree.begin(), [](int& value) { value = 1; });
+}
+
+TEST(CHECK_LEVEL, ARENA) {
+  RBtreeArena<int, int> tree;
+  RandomOperations(tree);
+  InsertShuffledSequence(tree, 0, kCheckedSize);
+  tree.compact(rbtree_arena_order::kBreadthFirst);
+}
+
+TEST(CHECK_LEVEL, CORRUPTION_ABORTS) {
+  RBtree<int, int> tree;
+  InsertSequence(tree, 0, kCheckedSize, 1);
+  EXPECT_DEATH(
+      {
+        RBtreeTestConstructor(tree).get_size() = 0;
+        tree.insert({kCheckedSize, 0});
+      },
+      "RBtree check failed");
+  EXPECT_DEATH(RBTREE_CHECK(tree.size() == 0), "tree.size\\(\\) == 0");
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
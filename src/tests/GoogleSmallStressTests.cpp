@@ -0,0 +1,210 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <ranges>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "RBtreeSmall.hpp"
+#include "StressTestsCommon.hpp"
+
+/* The small-size map against std::map, inline and after it turned a tree. */
+
+namespace {
+
+using SmallTree = RBtreeSmall<int, int>;
+constexpr int kInlineEntries = static_cast<int>(SmallTree::inline_capacity());
+
+/* std::allocator that counts its calls into a shared counter. */
+template <typename Value>
+struct CountingAllocator {
+  using value_type = Value;
+
+  explicit CountingAllocator(std::size_t* counter) noexcept
+      : allocations(counter) {}
+
+  template <typename Other>
+  CountingAllocator(const CountingAllocator<Other>& other) noexcept
+      : allocations(other.allocations) {}
+
+  Value* allocate(std::size_t count) {
+    ++*allocations;
+    return std::allocator<Value>().allocate(count);
+  }
+
+  void deallocate(Value* pointer, std::size_t count) noexcept {
+    std::allocator<Value>().deallocate(pointer, count);
+  }
+
+  template <typename Other>
+  bool operator==(const CountingAllocator<Other>& other) const noexcept {
+    return allocations == other.allocations;
+  }
+
+  std::size_t* allocations;
+};
+
+template <typename Tree>
+void ExpectSameContents(const Tree& tree, const std::map<int, int>& expected) {
+  ASSERT_EQ(tree.size(), expected.size());
+  ASSERT_TRUE(std::ranges::equal(tree, expected));
+  ASSERT_TRUE(std::ranges::equal(std::views::reverse(tree),
+                                 std::views::reverse(expected)));
+  for (int key = -1; key <= 3 * kInlineEntries; ++key) {
+    const auto lower = tree.lower_bound(key);
+    const auto expected_lower = expected.lower_bound(key);
+    ASSERT_EQ(lower == tree.end(), expected_lower == expected.end());
+    if (lower != tree.end()) {
+      ASSERT_EQ(lower->first, expected_lower->first);
+    }
+    const auto upper = tree.upper_bound(key);
+    const auto expected_upper = expected.upper_bound(key);
+    ASSERT_EQ(upper == tree.end(), expected_upper == expected.end());
+    if (upper != tree.end()) {
+      ASSERT_EQ(upper->first, expected_upper->first);
+    }
+    ASSERT_EQ(tree.contains(key), expected.contains(key));
+  }
+}
+
+}  // namespace
+
+TEST(SMALL, INLINE_WITHOUT_ALLOCATIONS) {
+  using Alloc = CountingAllocator<std::pair<const int, int>>;
+  std::size_t allocations = 0;
+  RBtreeSmall<int, int, std::less<int>, Alloc> tree{Alloc(&allocations)};
+  std::vector<int> keys(kInlineEntries);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::shuffle(keys.begin(), keys.end(), std::mt19937(kInlineEntries));
+  for (const int key : keys) {
+    ASSERT_TRUE(tree.insert({key, key}).second);
+    ASSERT_FALSE(tree.insert({key, -key}).second);
+  }
+  ASSERT_EQ(allocations, 0);
+  ASSERT_TRUE(tree.is_inline());
+  ASSERT_TRUE(std::ranges::equal(tree | std::views::keys,
+                                 std::views::iota(0, kInlineEntries)));
+
+  tree.insert({kInlineEntries, kInlineEntries});
+  ASSERT_FALSE(tree.is_inline());
+  ASSERT_NE(allocations, 0);
+  ASSERT_TRUE(std::ranges::equal(tree | std::views::keys,
+                                 std::views::iota(0, kInlineEntries + 1)));
+  tree.clear();
+  ASSERT_TRUE(tree.is_inline());
+  ASSERT_TRUE(tree.empty());
+}
+
+TEST(SMALL, RANDOM_OPERATIONS) {
+  SmallTree tree;
+  std::map<int, int> expected;
+  std::mt19937 mt19937(kShuffledInsertSize);
+  std::uniform_int_distribution<int> keys(0, 3 * kInlineEntries);
+  DO_ATTEMPTS(kShuffleAttempts,
+    for (int i = 0; i < 4 * kInlineEntries; ++i) {
+      const int key = keys(mt19937);
+      if (mt19937() % 3 != 0) {
+        ASSERT_EQ(tree.insert({key, i}).second,
+                  expected.insert({key, i}).second);
+      } else if (tree.contains(key) && mt19937() % 2 == 0) {
+        const auto next = tree.erase(tree.find(key));
+        const auto expected_next = expected.erase(expected.find(key));
+        ASSERT_EQ(next == tree.end(), expected_next == expected.end());
+        if (next != tree.end()) {
+          ASSERT_EQ(next->first, expected_next->first);
+        }
+      } else {
+        ASSERT_EQ(tree.erase(key), expected.erase(key));
+      }
+      if (tree.size() > SmallTree::inline_capacity()) {
+        ASSERT_FALSE(tree.is_inline());
+      }
+    }
+    ExpectSameContents(tree, expected);
+    tree.erase(tree.lower_bound(kInlineEntries / 2),
+               tree.upper_bound(kInlineEntries));
+    expected.erase(expected.lower_bound(kInlineEntries / 2),
+                   expected.upper_bound(kInlineEntries));
+    ExpectSameContents(tree, expected);
+    if (current_attemp % 2 == 0) {
+      tree.clear();
+      expected.clear();
+    }
+  )
+}
+
+TEST(SMALL, STRING_KEYS) {
+  RBtreeSmall<std::string, std::string, std::less<std::string>,
+              std::allocator<std::pair<const std::string, std::string>>, 4>
+      tree;
+  for (int i = 0; i < kShuffledInsertSize; ++i) {
+    const std::string key =
+        "key/" + std::to_string(i * 7 % kShuffledInsertSize);
+    ASSERT_TRUE(tree.emplace(key, key + "/value").second);
+    if (i == 3) {
+      ASSERT_TRUE(tree.is_inline());
+      ASSERT_TRUE(std::ranges::is_sorted(tree | std::views::keys));
+    }
+  }
+  ASSERT_FALSE(tree.is_inline());
+  ASSERT_TRUE(std::ranges::is_sorted(tree | std::views::keys));
+  for (int i = 0; i < kShuffledInsertSize; i += 2) {
+    ASSERT_EQ(tree.erase("key/" + std::to_string(i)), 1);
+  }
+  ASSERT_EQ(tree.size(), kShuffledInsertSize / 2);
+  ASSERT_EQ(tree.at("key/1"), "key/1/value");
+  ASSERT_THROW(tree.at("key/0"), std::out_of_range);
+  tree["key/0"] = "again";
+  ASSERT_EQ(tree.try_emplace("key/0", "ignored").first->second, "again");
+  const auto is_odd = [](const auto& value) noexcept {
+    return value.first.back() % 2 == 1;
+  };
+  tree.erase_if(is_odd);
+  ASSERT_TRUE(std::ranges::none_of(tree, is_odd));
+}
+
+TEST(SMALL, COPY_MOVE_SWAP) {
+  SmallTree small;
+  SmallTree large;
+  InsertSequence(small, 0, kInlineEntries / 2, 1);
+  InsertSequence(large, 0, kShuffledInsertSize, 1);
+  ASSERT_TRUE(small.is_inline());
+  ASSERT_FALSE(large.is_inline());
+
+  SmallTree small_copy(small);
+  SmallTree large_copy(large);
+  ASSERT_TRUE(small_copy.is_inline());
+  ASSERT_TRUE(small_copy == small);
+  ASSERT_TRUE(large_copy == large);
+
+  swap(small_copy, large_copy);
+  ASSERT_FALSE(small_copy.is_inline());
+  ASSERT_TRUE(small_copy == large);
+  ASSERT_TRUE(large_copy == small);
+
+  SmallTree moved(std::move(small_copy));
+  ASSERT_TRUE(small_copy.empty());
+  ASSERT_TRUE(small_copy.is_inline());
+  ASSERT_TRUE(moved == large);
+  moved = small;
+  ASSERT_TRUE(moved.is_inline());
+  ASSERT_TRUE(moved == small);
+  ASSERT_TRUE((small <=> large) < 0);
+
+  /* The same keys, one mapped value apart, inline and as a tree. */
+  for (SmallTree* tree : {&small_copy, &large_copy}) {
+    SmallTree changed(*tree);
+    ++changed[changed.begin()->first];
+    ASSERT_FALSE(changed == *tree);
+    ASSERT_TRUE((*tree <=> changed) < 0);
+  }
+  moved.insert({kShuffledInsertSize, 0});
+  ASSERT_EQ(std::prev(moved.end())->first, kShuffledInsertSize);
+}
@@ -1,48 +1,107 @@
 #include <gtest/gtest.h>
 
 #include <algorithm>
+#include <bit>
 #include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <memory_resource>
 #include <numeric>
 #include <random>
 #include <ranges>
+#include <span>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "RBtree.hpp"
+#include "RBtreeFlatView.hpp"
+#include "RBtreeGenerator.hpp"
+#include "RBtreeInspector.hpp"
+#include "RBtreeTestConstructor.hpp"
+#include "RBtreeValidator.hpp"
+#include "StressTestsCommon.hpp"
 
-static constexpr const int kInsertSize = 500000;
-static constexpr const int kShuffledInsertSize = 5000;
-static constexpr const int kShuffleAttempts = 50;
-static constexpr const int kSortingInsertAttemps = 500;
-static constexpr const int kLeftBorder = kShuffledInsertSize / 4 * 1;
-static constexpr const int kRightBorder = kShuffledInsertSize / 4 * 3;
+using ThreadedTree = RBtree<int, int, std::less<int>,
+                            std::allocator<std::pair<const int, int>>,
+                            rbtree_threaded_policy>;
 
-#define DO_ATTEMPTS(attemps_number, ...)                         \
-  for (auto current_attemp = 0; current_attemp < attemps_number; \
-       ++current_attemp) {                                       \
-    __VA_ARGS__                                                  \
-  }
+using TopDownTree = RBtree<int, int, std::less<int>,
+                           std::allocator<std::pair<const int, int>>,
+                           rbtree_top_down_policy>;
 
-void InsertSequence(auto& tree, auto start, auto stop, auto step = 1) {
-  for (auto i = start; i < stop; i += step) {
-    tree.insert({i, i});
-  }
-}
+using AvlTree = RBtree<int, int, std::less<int>,
+                       std::allocator<std::pair<const int, int>>,
+                       rbtree_avl_policy>;
 
-void InsertShuffledSequence(auto& tree, auto from, auto arrsize) {
-  std::vector<int> vec(static_cast<std::size_t>(arrsize));
-  std::iota(std::begin(vec), std::end(vec), from);
+using WeightBalancedTree =
+    RBtree<int, int, std::less<int>, std::allocator<std::pair<const int, int>>,
+           rbtree_weight_balanced_policy>;
 
-  auto now = std::chrono::system_clock::now();
-  auto duration = now.time_since_epoch();
-  auto millis =
-      std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+struct TopDownMultiPolicy : rbtree_multi_policy {
+  static constexpr rbtree_balancing kBalancing = rbtree_balancing::kTopDown;
+};
 
-  std::mt19937 mt19937(static_cast<std::mt19937::result_type>(millis));
+using PrefixCacheTree =
+    RBtree<std::string, int, std::less<std::string>,
+           std::allocator<std::pair<const std::string, int>>,
+           rbtree_prefix_cache_policy>;
 
-  std::shuffle(std::begin(vec), std::end(vec), mt19937);
+/* Counts the deallocate() calls that a monotonic buffer ignores. */
+class CountingMonotonicResource : public std::pmr::monotonic_buffer_resource {
+ public:
+  std::size_t deallocations() const noexcept { return deallocations_; }
 
-  for (std::size_t i = 0; i < static_cast<std::size_t>(arrsize); ++i) {
-    tree.insert({vec[i], vec[i]});
+ protected:
+  void do_deallocate(void* pointer, std::size_t bytes,
+                     std::size_t alignment) override {
+    ++deallocations_;
+    std::pmr::monotonic_buffer_resource::do_deallocate(pointer, bytes,
+                                                       alignment);
   }
+
+ private:
+  std::size_t deallocations_{};
+};
+
+/* Random inserts and erases, by key and at iterators, against std::map. */
+template <typename Tree>
+void CheckBalancing() {
+  Tree tree;
+  std::map<int, int> expected;
+  std::mt19937 mt19937(kShuffledInsertSize);
+  std::uniform_int_distribution<int> keys(0, kShuffledInsertSize);
+  DO_ATTEMPTS(kShuffleAttempts / 5,
+    for (int i = 0; i < kShuffledInsertSize; ++i) {
+      const int key = keys(mt19937);
+      if (mt19937() % 3 != 0) {
+        ASSERT_EQ(tree.insert({key, i}).second,
+                  expected.insert({key, i}).second);
+      } else if (tree.contains(key) && mt19937() % 2 == 0) {
+        tree.erase(tree.find(key));
+        expected.erase(key);
+      } else {
+        ASSERT_EQ(tree.erase(key), expected.erase(key));
+      }
+    }
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+    ASSERT_TRUE(std::ranges::equal(tree, expected));
+  )
+  tree.compact(rbtree_layout::kVanEmdeBoas);
+  ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+  std::stringstream stream;
+  tree.serialize(stream);
+  Tree loaded;
+  loaded.deserialize(stream);
+  ASSERT_TRUE(RBtreeValidator(loaded).is_valid());
+  ASSERT_TRUE(loaded == tree);
+  tree.erase_if(
+      [](const auto& value) noexcept { return value.first % 2 == 0; });
+  ASSERT_TRUE(RBtreeValidator(tree).is_valid());
 }
 
 RBtree<int, int> InitSequence(auto start, auto stop, auto step = 1) {
@@ -76,6 +135,22 @@ TEST(RBTREE, GETALLOCATOR) {
   tree.get_allocator();
 }
 
+TEST(RBTREE, INSERT_DUPLICATE) {
+  RBtree<int, int> tree;
+  DO_ATTEMPTS(kShuffleAttempts,
+    InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+    for (int i = 0; i < kShuffledInsertSize; ++i) {
+      auto [it, inserted] = tree.insert({i, -i});
+      ASSERT_FALSE(inserted);
+      ASSERT_EQ(it->first, i);
+      ASSERT_EQ(it->second, i);
+    }
+    ASSERT_EQ(tree.size(), kShuffledInsertSize);
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+    tree.clear();
+  )
+}
+
 TEST(RBTREE, ELEMENT_ACCESS) {
   RBtree<int, int> tree = InitSequence(1, kInsertSize, 2);
   for (int i = 0; i < kInsertSize; ++i) {
@@ -202,6 +277,20 @@ TEST(RBTREE, ITERATOR_BACKWARD_RANGE_LOOP) {
   );
 }
 
+TEST(RBTREE, ITERATOR_REVERSE) {
+  RBtree<int, int> tree;
+  ASSERT_EQ(tree.rbegin(), tree.rend());
+  DO_ATTEMPTS(kShuffleAttempts,
+    InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+    ASSERT_EQ(tree.rbegin()->first, kShuffledInsertSize - 1);
+    ASSERT_EQ(std::distance(tree.rbegin(), tree.rend()), kShuffledInsertSize);
+    ASSERT_TRUE(std::ranges::equal(
+        std::ranges::subrange(tree.crbegin(), tree.crend()) | std::views::keys,
+        std::views::iota(0, kShuffledInsertSize) | std::views::reverse));
+    tree.clear();
+  )
+}
+
 TEST(RBTREE, CLEAR) {
   RBtree<int, int> tree;
   DO_ATTEMPTS(kShuffleAttempts, 
@@ -424,6 +513,1264 @@ TEST(RBTREE, ERASE_IF) {
   ASSERT_TRUE(tree.empty());
 }
 
+TEST(RBTREE, SERIALIZE_ROUNDTRIP) {
+  RBtree<int, int> tree;
+  RBtree<int, int> loaded;
+  DO_ATTEMPTS(kShuffleAttempts,
+    InsertShuffledSequence(tree, 0, current_attemp * 97);
+    std::stringstream stream;
+    tree.serialize(stream);
+    loaded.deserialize(stream);
+    ASSERT_EQ(loaded.size(), tree.size());
+    ASSERT_TRUE(RBtreeValidator(loaded).is_valid());
+    ASSERT_TRUE(loaded == tree);
+    for (int i = 0; i < current_attemp * 97; ++i) {
+      ASSERT_EQ(loaded.at(i), i);
+    }
+    for (int i = 0; i < current_attemp * 97; i += 2) {
+      loaded.erase(i);
+    }
+    InsertSequence(loaded, -current_attemp, 0, 1);
+    std::vector<int> expected_keys(static_cast<std::size_t>(current_attemp));
+    std::iota(expected_keys.begin(), expected_keys.end(), -current_attemp);
+    for (int i = 1; i < current_attemp * 97; i += 2) {
+      expected_keys.push_back(i);
+    }
+    ASSERT_TRUE(std::ranges::equal(loaded | std::views::keys, expected_keys));
+    ASSERT_TRUE(RBtreeValidator(loaded).is_valid());
+    tree.clear();
+  )
+}
+
+TEST(RBTREE, SERIALIZE_STRINGS) {
+  RBtree<std::string, std::string> tree;
+  for (int i = 0; i < kShuffledInsertSize; ++i) {
+    tree.insert({std::to_string(i), std::string(static_cast<std::size_t>(i % 7), 'x')});
+  }
+  std::stringstream stream;
+  tree.serialize(stream);
+  RBtree<std::string, std::string> loaded;
+  loaded.deserialize(stream);
+  ASSERT_EQ(loaded.size(), tree.size());
+  auto it = loaded.begin();
+  for (const auto& element : tree) {
+    ASSERT_EQ(it->first, element.first);
+    ASSERT_EQ(it->second, element.second);
+    ++it;
+  }
+  ASSERT_EQ(it, loaded.end());
+}
+
+TEST(RBTREE, SERIALIZE_CORRUPTED) {
+  RBtree<int, int> tree = InitSequence(0, kShuffledInsertSize, 1);
+  std::stringstream stream;
+  tree.serialize(stream);
+  const std::string bytes = stream.str();
+
+  std::string corrupted = bytes;
+  corrupted[corrupted.size() / 2] ^= 1;
+  std::stringstream corrupted_stream(corrupted);
+  RBtree<int, int> loaded = InitSequence(0, 10, 1);
+  ASSERT_THROW(loaded.deserialize(corrupted_stream), std::runtime_error);
+  ASSERT_EQ(loaded.size(), 10);
+
+  std::stringstream truncated_stream(bytes.substr(0, bytes.size() - 1));
+  ASSERT_THROW(loaded.deserialize(truncated_stream), std::runtime_error);
+
+  RBtree<long, int> other;
+  std::stringstream mismatched_stream(bytes);
+  ASSERT_THROW(other.deserialize(mismatched_stream), std::runtime_error);
+
+  /* A count whose sections overflow, with the payload size it wraps to. */
+  rbtree_file_header header{};
+  std::memcpy(&header, bytes.data(), sizeof(header));
+  header.count = std::uint64_t{1} << 60U;
+  header.payload_bytes = rbtree_file_header::flat_payload_bytes(
+      header.count, sizeof(int), sizeof(int));
+  std::string overflowing = bytes;
+  std::memcpy(overflowing.data(), &header, sizeof(header));
+  std::stringstream overflowing_stream(overflowing);
+  ASSERT_THROW(loaded.deserialize(overflowing_stream), std::runtime_error);
+  std::vector<std::uint64_t> file((overflowing.size() + 7) / 8);
+  std::memcpy(file.data(), overflowing.data(), overflowing.size());
+  using view_type = RBtreeFlatView<int, int>;
+  ASSERT_THROW(view_type(file.data(), overflowing.size()),
+               std::runtime_error);
+
+  /* A payload larger than the stream is rejected before it is allocated. */
+  RBtree<std::string, std::string> strings;
+  strings.insert({"key", "value"});
+  std::stringstream strings_stream;
+  strings.serialize(strings_stream);
+  std::string oversized = strings_stream.str();
+  std::memcpy(&header, oversized.data(), sizeof(header));
+  header.payload_bytes = std::uint64_t{1} << 50U;
+  std::memcpy(oversized.data(), &header, sizeof(header));
+  std::stringstream oversized_stream(oversized);
+  ASSERT_THROW(strings.deserialize(oversized_stream), std::runtime_error);
+  ASSERT_EQ(strings.size(), 1);
+}
+
+TEST(RBTREE, FLAT_VIEW) {
+  RBtree<int, double> tree;
+  for (int i = 0; i < kShuffledInsertSize; i += 2) {
+    tree.insert({i, i / 2.0});
+  }
+  std::stringstream stream;
+  tree.serialize(stream);
+  const std::string bytes = stream.str();
+  std::vector<std::uint64_t> file((bytes.size() + 7) / 8);
+  std::memcpy(file.data(), bytes.data(), bytes.size());
+
+  RBtreeFlatView<int, double> view(file.data(), bytes.size());
+  ASSERT_TRUE(view.verify_checksum());
+  ASSERT_EQ(view.size(), tree.size());
+  for (int i = 0; i < kShuffledInsertSize; ++i) {
+    if (i % 2 == 0) {
+      ASSERT_EQ(view.at(i), i / 2.0);
+    } else {
+      ASSERT_FALSE(view.contains(i));
+      ASSERT_EQ(view.lower_bound(i), view.upper_bound(i));
+      ASSERT_EQ(view.key(view.lower_bound(i - 1)), i - 1);
+    }
+  }
+  ASSERT_EQ(view.lower_bound(kShuffledInsertSize), view.size());
+  using view_type = RBtreeFlatView<int, double>;
+  ASSERT_THROW(view_type(file.data(), 10), std::runtime_error);
+
+  /* A set writes only the key section, which the map view rejects. */
+  RBset<int> set;
+  for (int i = 0; i < kShuffledInsertSize; i += 2) {
+    set.insert(i);
+  }
+  std::stringstream set_stream;
+  set.serialize(set_stream);
+  const std::string set_bytes = set_stream.str();
+  std::vector<std::uint64_t> set_file((set_bytes.size() + 7) / 8);
+  std::memcpy(set_file.data(), set_bytes.data(), set_bytes.size());
+  ASSERT_THROW(view_type(set_file.data(), set_bytes.size()),
+               std::runtime_error);
+
+  RBtreeFlatView<int, void> set_view(set_file.data(), set_bytes.size());
+  ASSERT_TRUE(set_view.verify_checksum());
+  ASSERT_EQ(set_view.size(), set.size());
+  for (int i = 0; i < kShuffledInsertSize; ++i) {
+    ASSERT_EQ(set_view.contains(i), i % 2 == 0);
+  }
+  using set_view_type = RBtreeFlatView<int, void>;
+  ASSERT_THROW(set_view_type(file.data(), bytes.size()), std::runtime_error);
+}
+
+TEST(RBTREE, STATS) {
+  RBtree<int, int, std::less<int>, std::allocator<std::pair<const int, int>>,
+         rbtree_stats_policy>
+      tree;
+  static_assert(sizeof(tree) ==
+                sizeof(RBtree<int, int>) + sizeof(RBtreeStats));
+  ASSERT_EQ(tree.stats().allocations, 0);
+  InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+  RBtreeStats stats = tree.stats();
+  ASSERT_EQ(stats.allocations, kShuffledInsertSize);
+  ASSERT_EQ(stats.deallocations, 0);
+  ASSERT_GT(stats.rotations, 0);
+  ASSERT_GT(stats.insert_fixup_iterations, 0);
+  ASSERT_GT(stats.recolorings, 0);
+  ASSERT_EQ(stats.lookups, 0);
+
+  tree.reset_stats();
+  const auto max_depth = 2 * std::bit_width(static_cast<unsigned>(kShuffledInsertSize));
+  for (int i = 0; i < kShuffledInsertSize; ++i) {
+    tree.lower_bound(i);
+  }
+  stats = tree.stats();
+  ASSERT_EQ(stats.lookups, kShuffledInsertSize);
+  ASSERT_EQ(stats.comparisons, stats.lookup_depth);
+  ASSERT_LE(stats.max_lookup_depth, max_depth);
+  ASSERT_GE(stats.average_lookup_depth(), 1.0);
+
+  tree.reset_stats();
+  for (int i = 0; i < kShuffledInsertSize; ++i) {
+    tree.find(i);
+  }
+  /* A less-than comparator: the lower bound, then one equality check. */
+  const RBtreeStats find_stats = tree.stats();
+  ASSERT_EQ(find_stats.lookups, kShuffledInsertSize);
+  ASSERT_EQ(find_stats.lookup_depth, stats.lookup_depth);
+  ASSERT_EQ(find_stats.comparisons,
+            find_stats.lookup_depth + find_stats.lookups);
+
+  /* A three-way one stops at the equal node, one call per level. */
+  RBtree<std::string, int, std::less<std::string>,
+         std::allocator<std::pair<const std::string, int>>,
+         rbtree_stats_policy>
+      strings;
+  for (int i = 0; i < kShuffledInsertSize; ++i) {
+    strings.insert({std::to_string(i), i});
+  }
+  strings.reset_stats();
+  for (int i = 0; i < kShuffledInsertSize; ++i) {
+    strings.lower_bound(std::to_string(i));
+  }
+  const RBtreeStats bound_stats = strings.stats();
+  strings.reset_stats();
+  for (int i = 0; i < kShuffledInsertSize; ++i) {
+    ASSERT_NE(strings.find(std::to_string(i)), strings.end());
+  }
+  ASSERT_LT(strings.stats().lookup_depth, bound_stats.lookup_depth);
+  ASSERT_EQ(strings.stats().comparisons, strings.stats().lookup_depth);
+
+  tree.reset_stats();
+  tree.clear();
+  stats = tree.stats();
+  ASSERT_EQ(stats.deallocations, kShuffledInsertSize);
+  ASSERT_GT(stats.erase_fixup_iterations, 0);
+}
+
+TEST(RBTREE, VALIDATOR) {
+  RBtree<int, int> tree;
+  ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+  std::mt19937 mt19937(kShuffledInsertSize);
+  std::uniform_int_distribution<int> keys(0, kShuffledInsertSize);
+  DO_ATTEMPTS(kShuffleAttempts,
+    for (int i = 0; i < kShuffledInsertSize / 10; ++i) {
+      tree.insert({keys(mt19937), i});
+      tree.erase(keys(mt19937));
+    }
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid_parallel(4));
+  )
+  InsertSequence(tree, 0, kInsertSize, 1);
+  ASSERT_TRUE(RBtreeValidator(tree).is_valid_parallel());
+
+  RBtreeTestConstructor constructor(tree);
+  constructor.get_root()->color = decltype(constructor)::node_type::Color::Red;
+  ASSERT_FALSE(RBtreeValidator(tree).is_valid());
+  ASSERT_FALSE(RBtreeValidator(tree).is_valid_parallel(4));
+  constructor.get_root()->color = decltype(constructor)::node_type::Color::Black;
+  ++constructor.get_size();
+  ASSERT_FALSE(RBtreeValidator(tree).is_valid());
+  --constructor.get_size();
+  std::swap(constructor.get_root()->left, constructor.get_root()->right);
+  ASSERT_FALSE(RBtreeValidator(tree).is_valid());
+  std::swap(constructor.get_root()->left, constructor.get_root()->right);
+  ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+
+  /* The parallel pass leaves the counters alone: no thread writes them. */
+  RBtree<int, int, std::less<int>, std::allocator<std::pair<const int, int>>,
+         rbtree_stats_policy>
+      counted;
+  InsertShuffledSequence(counted, 0, kShuffledInsertSize);
+  counted.reset_stats();
+  ASSERT_TRUE(RBtreeValidator(counted).is_valid_parallel(4));
+  ASSERT_EQ(counted.stats().comparisons, 0);
+}
+
+TEST(RBTREE, INSPECTOR) {
+  RBtree<int, int> tree;
+  ASSERT_EQ(RBtreeInspector(tree).shape().height, 0);
+  ASSERT_EQ(RBtreeInspector(tree).memory().estimated_heap_bytes, 0);
+
+  constexpr int kPerfectSize = (1 << 12) - 1;
+  InsertSequence(tree, 0, kPerfectSize, 1);
+  std::stringstream stream;
+  tree.serialize(stream);
+  tree.deserialize(stream);
+  RBtreeShape shape = RBtreeInspector(tree).shape();
+  ASSERT_EQ(shape.size, kPerfectSize);
+  ASSERT_EQ(shape.height, 12);
+  ASSERT_EQ(shape.black_height, 12);
+  ASSERT_DOUBLE_EQ(shape.average_descent, 12.0);
+  for (std::size_t depth = 0; depth < shape.height; ++depth) {
+    ASSERT_EQ(shape.depth_histogram[depth], std::size_t{1} << depth);
+  }
+
+  InsertShuffledSequence(tree, kPerfectSize, kShuffledInsertSize);
+  shape = RBtreeInspector(tree).shape();
+  ASSERT_EQ(std::accumulate(shape.depth_histogram.begin(),
+                            shape.depth_histogram.end(), std::size_t{0}),
+            tree.size());
+  ASSERT_LE(shape.height, 2 * std::bit_width(tree.size() + 1));
+  ASSERT_LE(shape.average_depth, shape.average_descent);
+  ASSERT_GE(shape.cache_lines_per_lookup, shape.average_descent);
+
+  RBtreeMemory memory = RBtreeInspector(tree).memory();
+  ASSERT_GE(memory.node_size, memory.basic_node_size + sizeof(int) * 2);
+  ASSERT_EQ(memory.node_bytes, tree.size() * memory.node_size);
+  ASSERT_GT(memory.estimated_heap_bytes, memory.node_bytes);
+  constexpr std::size_t kLinksAndFlags = 3 * sizeof(void*) + 2 * sizeof(bool);
+  ASSERT_EQ(memory.node_padding,
+            memory.node_size - kLinksAndFlags - 2 * sizeof(int));
+
+  /* An interval tree also keeps the largest end point in every node. */
+  RBIntervalMap<int> intervals;
+  intervals.insert({1, 4});
+  memory = RBtreeInspector(intervals).memory();
+  ASSERT_EQ(memory.node_padding,
+            memory.node_size - kLinksAndFlags - 3 * sizeof(int));
+}
+
+TEST(RBTREE, THREE_WAY_COMPARE) {
+  struct ReverseOrder {
+    std::strong_ordering operator()(int lhs, int rhs) const {
+      return rhs <=> lhs;
+    }
+  };
+  RBtree<int, int, ReverseOrder> tree;
+  InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+  ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+  int expected_key = kShuffledInsertSize;
+  for (const auto& element : tree) {
+    ASSERT_EQ(element.first, --expected_key);
+  }
+  for (int i = 0; i < kShuffledInsertSize; ++i) {
+    ASSERT_EQ(tree.find(i)->second, i);
+    ASSERT_FALSE(tree.insert({i, -i}).second);
+  }
+  ASSERT_EQ(tree.lower_bound(kShuffledInsertSize / 2)->first, kShuffledInsertSize / 2);
+  ASSERT_EQ(tree.upper_bound(kShuffledInsertSize / 2)->first, kShuffledInsertSize / 2 - 1);
+  ASSERT_EQ(tree.find(-1), tree.end());
+  ASSERT_EQ(tree.size(), kShuffledInsertSize);
+}
+
+TEST(RBTREE, THREE_WAY_COMPARE_CALLS) {
+  RBtree<std::string, int, std::less<std::string>,
+         std::allocator<std::pair<const std::string, int>>,
+         rbtree_stats_policy>
+      tree;
+  for (int i = 0; i < kShuffledInsertSize; ++i) {
+    tree.reset_stats();
+    tree.insert({std::to_string(i), i});
+    const RBtreeStats stats = tree.stats();
+    ASSERT_LE(stats.comparisons, 2 * std::bit_width(tree.size()));
+  }
+  ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+  for (int i = 0; i < kShuffledInsertSize; ++i) {
+    tree.reset_stats();
+    ASSERT_EQ(tree.find(std::to_string(i))->second, i);
+    RBtreeStats stats = tree.stats();
+    ASSERT_EQ(stats.comparisons, stats.lookup_depth);
+
+    tree.reset_stats();
+    ASSERT_FALSE(tree.insert({std::to_string(i), -i}).second);
+    stats = tree.stats();
+    ASSERT_LE(stats.comparisons, 2 * std::bit_width(tree.size()));
+  }
+  tree.reset_stats();
+  ASSERT_EQ(tree.find("missing"), tree.end());
+  ASSERT_EQ(tree.stats().comparisons, tree.stats().lookup_depth);
+}
+
+TEST(RBTREE, THREADED_LINKS) {
+  ThreadedTree tree;
+  ASSERT_EQ(tree.begin(), tree.end());
+  ASSERT_EQ(tree.rbegin(), tree.rend());
+  std::mt19937 mt19937(kShuffledInsertSize);
+  std::uniform_int_distribution<int> keys(0, kShuffledInsertSize);
+  DO_ATTEMPTS(kShuffleAttempts,
+    InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+    ASSERT_EQ(tree.rbegin()->first, kShuffledInsertSize - 1);
+    ASSERT_EQ(std::prev(tree.end())->first, kShuffledInsertSize - 1);
+    ASSERT_TRUE(std::ranges::equal(tree | std::views::keys,
+                                   std::views::iota(0, kShuffledInsertSize)));
+    ASSERT_TRUE(std::ranges::equal(
+        std::views::reverse(tree) | std::views::keys,
+        std::views::iota(0, kShuffledInsertSize) | std::views::reverse));
+    for (int i = 0; i < kShuffledInsertSize / 2; ++i) {
+      tree.erase(keys(mt19937));
+      tree.insert({keys(mt19937) + kShuffledInsertSize, i});
+    }
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+    ASSERT_EQ(std::distance(tree.begin(), tree.end()), tree.size());
+    ASSERT_TRUE(std::ranges::is_sorted(tree | std::views::keys));
+    tree.erase(std::next(tree.begin(), kLeftBorder), std::prev(tree.end(), kLeftBorder));
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+    tree.clear();
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+  )
+
+  InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+  std::stringstream stream;
+  tree.serialize(stream);
+  ThreadedTree loaded;
+  loaded.deserialize(stream);
+  ASSERT_TRUE(RBtreeValidator(loaded).is_valid());
+  ASSERT_TRUE(loaded == tree);
+  ASSERT_EQ(loaded.rbegin()->first, kShuffledInsertSize - 1);
+}
+
+TEST(RBTREE, PREFIX_CACHE) {
+  /* Ties on the first 8 bytes, embedded zeros and high bytes that a signed
+   * comparison would put first. */
+  const std::string fixed[] = {"",
+                               std::string(1, '\0'),
+                               std::string("a\0b", 3),
+                               "a",
+                               "abcdefgh",
+                               "abcdefgh0",
+                               "abcdefgh1",
+                               "abcdefg",
+                               "\xff",
+                               "\x7f\x80"};
+  std::mt19937 mt19937(kShuffledInsertSize);
+  std::uniform_int_distribution<int> keys(0, kShuffledInsertSize);
+  DO_ATTEMPTS(kShuffleAttempts,
+    PrefixCacheTree tree;
+    std::map<std::string, int> reference;
+    for (const auto& key : fixed) {
+      tree.insert({key, 0});
+      reference.insert({key, 0});
+    }
+    for (int i = 0; i < kShuffledInsertSize; ++i) {
+      const std::string key =
+          (i % 2 == 0 ? "https://example.com/" : "") +
+          std::to_string(keys(mt19937));
+      tree.insert({key, i});
+      reference.insert({key, i});
+    }
+    for (int i = 0; i < kShuffledInsertSize / 2; ++i) {
+      const std::string key = std::to_string(keys(mt19937));
+      ASSERT_EQ(tree.erase(key), reference.erase(key));
+    }
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+    ASSERT_TRUE(std::ranges::equal(tree, reference));
+    for (int i = 0; i < kShuffledInsertSize; ++i) {
+      const std::string key = std::to_string(keys(mt19937));
+      ASSERT_EQ(tree.contains(key), reference.contains(key));
+      auto lower = tree.lower_bound(key);
+      auto expected_lower = reference.lower_bound(key);
+      ASSERT_EQ(lower == tree.end(), expected_lower == reference.end());
+      if (lower != tree.end()) {
+        ASSERT_EQ(lower->first, expected_lower->first);
+      }
+      auto upper = tree.upper_bound(key);
+      auto expected_upper = reference.upper_bound(key);
+      ASSERT_EQ(upper == tree.end(), expected_upper == reference.end());
+      if (upper != tree.end()) {
+        ASSERT_EQ(upper->first, expected_upper->first);
+      }
+    }
+  )
+}
+
+TEST(RBTREE, SET_MODE) {
+  static_assert(std::is_same_v<RBset<int>::value_type, int>);
+  static_assert(std::is_same_v<decltype(*RBset<int>().begin()), const int&>);
+
+  RBset<int> set;
+  std::mt19937 mt19937(kShuffledInsertSize);
+  std::uniform_int_distribution<int> keys(0, kShuffledInsertSize);
+  DO_ATTEMPTS(kShuffleAttempts,
+    std::vector<int> sequence(kShuffledInsertSize);
+    std::iota(sequence.begin(), sequence.end(), 0);
+    std::shuffle(sequence.begin(), sequence.end(), mt19937);
+    for (const int key : sequence) {
+      ASSERT_TRUE(set.insert(key).second);
+    }
+    ASSERT_FALSE(set.emplace(sequence.front()).second);
+    ASSERT_TRUE(RBtreeValidator(set).is_valid());
+    ASSERT_TRUE(std::ranges::equal(set, std::views::iota(0, kShuffledInsertSize)));
+    for (int i = 0; i < kShuffledInsertSize / 2; ++i) {
+      const int key = keys(mt19937);
+      set.erase(key);
+      ASSERT_FALSE(set.contains(key));
+    }
+    ASSERT_TRUE(RBtreeValidator(set).is_valid());
+    ASSERT_TRUE(std::ranges::is_sorted(set));
+
+    int visited = 0;
+    set.for_each_in_range(kLeftBorder, kRightBorder, [&](const int& key) {
+      ASSERT_GE(key, kLeftBorder);
+      ASSERT_LT(key, kRightBorder);
+      ++visited;
+    });
+    ASSERT_EQ(visited, std::distance(set.lower_bound(kLeftBorder),
+                                     set.lower_bound(kRightBorder)));
+
+    std::stringstream stream;
+    set.serialize(stream);
+    RBset<int> loaded;
+    loaded.deserialize(stream);
+    ASSERT_TRUE(RBtreeValidator(loaded).is_valid());
+    ASSERT_TRUE(loaded == set);
+    set.clear();
+  )
+
+  RBset<std::string> strings;
+  for (int i = 0; i < kShuffledInsertSize; ++i) {
+    strings.insert(std::string(static_cast<std::size_t>(i % 7), 'x') +
+                   std::to_string(i));
+  }
+  std::stringstream stream;
+  strings.serialize(stream);
+  RBset<std::string> loaded;
+  loaded.deserialize(stream);
+  ASSERT_TRUE(RBtreeValidator(loaded).is_valid());
+  ASSERT_TRUE(std::ranges::equal(loaded, strings));
+  std::size_t scanned = 0;
+  for (const auto& batch : rbtree_scan(loaded, "", "y", 100)) {
+    scanned += batch.size();
+  }
+  ASSERT_EQ(scanned, strings.size());
+
+  /* Without the mapped value a set node is smaller than a map node. */
+  struct Empty {};
+  RBset<std::uint32_t> small_set;
+  RBtree<std::uint32_t, Empty> small_map;
+  small_set.insert(1U);
+  small_map.insert({1U, Empty{}});
+  const RBtreeMemory set_memory = RBtreeInspector(small_set).memory();
+  const RBtreeMemory map_memory = RBtreeInspector(small_map).memory();
+  ASSERT_LT(set_memory.node_size, map_memory.node_size);
+  ASSERT_LE(set_memory.node_padding, map_memory.node_padding);
+}
+
+TEST(RBTREE, VISIT) {
+  RBtree<int, int> tree = InitShuffledSequence(0, kShuffledInsertSize);
+  std::vector<int> visited;
+  ASSERT_TRUE(tree.visit([&](auto& value) {
+    value.second *= 2;
+    visited.push_back(value.first);
+  }));
+  ASSERT_TRUE(std::ranges::equal(visited, tree | std::views::keys));
+  ASSERT_EQ(tree.at(kLeftBorder), kLeftBorder * 2);
+
+  visited.clear();
+  const auto& const_tree = tree;
+  ASSERT_FALSE(const_tree.visit([&](const auto& value) {
+    visited.push_back(value.first);
+    return value.first < kLeftBorder;
+  }));
+  ASSERT_EQ(visited.size(), kLeftBorder + 1);
+  ASSERT_EQ(visited.back(), kLeftBorder);
+}
+
+TEST(RBTREE, FOR_EACH_IN_RANGE) {
+  RBtree<int, int> tree;
+  InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+  tree.erase(std::next(tree.begin(), kLeftBorder),
+             std::next(tree.begin(), kRightBorder));
+  std::mt19937 mt19937(kShuffledInsertSize);
+  std::uniform_int_distribution<int> bounds(-2, kShuffledInsertSize + 2);
+  DO_ATTEMPTS(kShuffledInsertSize,
+    const int lo = bounds(mt19937);
+    const int hi = bounds(mt19937);
+    std::vector<int> visited;
+    ASSERT_TRUE(tree.for_each_in_range(lo, hi, [&](const auto& value) {
+      visited.push_back(value.first);
+    }));
+    std::vector<int> expected;
+    if (lo < hi) {
+      for (auto it = tree.lower_bound(lo); it != tree.lower_bound(hi); ++it) {
+        expected.push_back(it->first);
+      }
+    }
+    ASSERT_EQ(visited, expected);
+  )
+
+  std::vector<int> visited;
+  ASSERT_FALSE(std::as_const(tree).for_each_in_range(
+      0, kShuffledInsertSize, [&](const auto& value) {
+        visited.push_back(value.first);
+        return visited.size() < kLeftBorder + 10;
+      }));
+  ASSERT_EQ(visited.size(), kLeftBorder + 10);
+  ASSERT_EQ(visited.back(), kRightBorder + 9);
+  ASSERT_TRUE(tree.for_each_in_range(kLeftBorder, kRightBorder,
+                                     [](auto&) { return false; }));
+}
+
+TEST(RBTREE, SCAN_BATCHES) {
+  RBtree<int, int> tree = InitShuffledSequence(0, kShuffledInsertSize);
+  for (const std::size_t batch_size : {1U, 7U, 100U, 10000U}) {
+    std::vector<int> scanned;
+    for (const auto& batch :
+         rbtree_scan(tree, kLeftBorder, kRightBorder, batch_size)) {
+      ASSERT_FALSE(batch.empty());
+      ASSERT_LE(batch.size(), batch_size);
+      for (const auto& [key, value] : batch) {
+        scanned.push_back(key);
+      }
+    }
+    ASSERT_TRUE(std::ranges::equal(
+        scanned, std::views::iota(kLeftBorder, kRightBorder)));
+  }
+
+  /* One page per generator, resumed from the last key of the previous. */
+  std::vector<int> scanned;
+  auto first_page = rbtree_scan(tree, 0, kShuffledInsertSize, 100);
+  int last_key = (*first_page.begin()).back().first;
+  for (bool done = false; !done;) {
+    auto page = rbtree_scan_after(tree, last_key, kShuffledInsertSize, 100);
+    auto it = page.begin();
+    done = it == page.end();
+    if (!done) {
+      scanned.push_back((*it).front().first);
+      last_key = (*it).back().first;
+    }
+  }
+  ASSERT_EQ(scanned.size(), kShuffledInsertSize / 100 - 1);
+  ASSERT_EQ(scanned.front(), 100);
+  ASSERT_EQ(last_key, kShuffledInsertSize - 1);
+  ASSERT_EQ(rbtree_scan(tree, kRightBorder, kLeftBorder, 10).begin(),
+            std::default_sentinel);
+
+  /* Runs of three equal keys, resumed after pages of four: none is lost. */
+  RBMultimap<int, int> multimap;
+  for (int copy = 0; copy < 3; ++copy) {
+    InsertSequence(multimap, 0, kShuffledInsertSize, 1);
+  }
+  std::size_t multi_scanned = 0;
+  int multi_last_key = -1;
+  for (bool done = false; !done;) {
+    auto page =
+        rbtree_scan_after(multimap, multi_last_key, kShuffledInsertSize, 4);
+    auto it = page.begin();
+    done = it == page.end();
+    if (!done) {
+      ASSERT_EQ((*it).size(), 6);
+      ASSERT_EQ((*it).front().first, multi_last_key + 1);
+      multi_scanned += (*it).size();
+      multi_last_key = (*it).back().first;
+    }
+  }
+  ASSERT_EQ(multi_scanned, 3 * kShuffledInsertSize);
+}
+
+TEST(RBTREE, SCAN_ERASE_SAFE) {
+  RBtree<int, int> tree = InitSequence(0, kShuffledInsertSize, 1);
+  std::vector<int> scanned;
+  std::vector<bool> erased(kShuffledInsertSize + 16);
+  for (const auto& batch : rbtree_scan(tree, 0, kShuffledInsertSize, 10,
+                                       rbtree_scan_mode::kEraseSafe)) {
+    for (const auto& [key, value] : batch) {
+      ASSERT_FALSE(erased[static_cast<std::size_t>(key)]);
+      scanned.push_back(key);
+    }
+    /* The next element, the one just yielded and one further ahead. */
+    for (const int offset : {1, 0, 15}) {
+      const int key = batch.back().first + offset;
+      tree.erase(key);
+      erased[static_cast<std::size_t>(key)] = true;
+    }
+  }
+  ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+  ASSERT_TRUE(std::ranges::is_sorted(scanned));
+  ASSERT_EQ(std::ranges::adjacent_find(scanned), scanned.end());
+  ASSERT_TRUE(std::ranges::includes(scanned, tree | std::views::keys));
+
+  /* Runs of three equal keys across batches of four: none is cut short. */
+  RBMultimap<int, int> multimap;
+  for (int copy = 0; copy < 3; ++copy) {
+    InsertSequence(multimap, 0, kShuffledInsertSize, 1);
+  }
+  std::size_t multi_scanned = 0;
+  for (const auto& batch : rbtree_scan(multimap, 0, kShuffledInsertSize, 4,
+                                       rbtree_scan_mode::kEraseSafe)) {
+    ASSERT_GE(batch.size(), 4);
+    ASSERT_EQ(batch.size() % 3, 0);
+    multi_scanned += batch.size();
+    multimap.erase(multimap.find(batch.back().first));
+  }
+  ASSERT_EQ(multi_scanned, 3 * kShuffledInsertSize);
+}
+
+TEST(RBTREE, COMPACT) {
+  std::mt19937 mt19937(kShuffledInsertSize);
+  std::uniform_int_distribution<int> keys(0, kShuffledInsertSize);
+  for (const auto layout :
+       {rbtree_layout::kInOrder, rbtree_layout::kVanEmdeBoas}) {
+    ThreadedTree tree;
+    std::map<int, int> expected;
+    DO_ATTEMPTS(kShuffleAttempts / 5,
+      for (int i = 0; i < kShuffledInsertSize; ++i) {
+        const int key = keys(mt19937);
+        if (mt19937() % 2 == 0) {
+          tree.erase(key);
+          expected.erase(key);
+        } else {
+          tree.insert({key, i});
+          expected.insert({key, i});
+        }
+      }
+      tree.compact(layout);
+      ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+      ASSERT_TRUE(std::ranges::equal(tree, expected));
+    )
+    if (layout == rbtree_layout::kInOrder) {
+      /* Neighbours in key order sit one node apart. */
+      const auto* first = reinterpret_cast<const char*>(&*tree.begin());
+      const auto* second =
+          reinterpret_cast<const char*>(&*std::next(tree.begin()));
+      const std::ptrdiff_t stride = second - first;
+      ASSERT_GT(stride, 0);
+      std::ptrdiff_t offset = 0;
+      for (const auto& value : tree) {
+        ASSERT_EQ(reinterpret_cast<const char*>(&value) - first, offset);
+        offset += stride;
+      }
+    }
+    tree.erase(tree.begin(), tree.end());
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+    tree.compact(layout);
+    ASSERT_TRUE(tree.empty());
+  }
+}
+
+TEST(RBTREE, COMPACT_STEP) {
+  RBtree<std::string, int> tree;
+  std::map<std::string, int> expected;
+  std::mt19937 mt19937(kShuffledInsertSize);
+  std::uniform_int_distribution<int> keys(0, kShuffledInsertSize);
+  int passes = 0;
+  DO_ATTEMPTS(kShuffleAttempts,
+    for (int i = 0; i < kShuffledInsertSize / 10; ++i) {
+      const std::string key = std::to_string(keys(mt19937));
+      if (mt19937() % 2 == 0) {
+        ASSERT_EQ(tree.erase(key), expected.erase(key));
+      } else {
+        tree.insert({key, i});
+        expected.insert({key, i});
+      }
+    }
+    /* Erasing the element the pass stands on moves it along. */
+    for (int step = 0; step < 3; ++step) {
+      if (tree.compact_step(kShuffledInsertSize / 20)) {
+        ++passes;
+      }
+      expected.erase(expected.begin());
+      tree.erase(tree.begin());
+    }
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+    ASSERT_TRUE(std::ranges::equal(tree, expected));
+  )
+  ASSERT_GT(passes, 0);
+  tree.compact(rbtree_layout::kVanEmdeBoas);
+  ASSERT_TRUE(std::ranges::equal(tree, expected));
+  while (!tree.compact_step(1)) {
+    tree.erase(std::prev(tree.end()));
+    expected.erase(std::prev(expected.end()));
+  }
+  ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+  ASSERT_TRUE(std::ranges::equal(tree, expected));
+  tree.clear();
+  ASSERT_TRUE(tree.compact_step(1));
+}
+
+TEST(RBTREE, PMR) {
+  std::pmr::unsynchronized_pool_resource pool;
+  {
+    pmr::RBtree<int, std::pmr::string> tree(&pool);
+    ASSERT_EQ(tree.get_allocator().resource(), &pool);
+    for (int i = 0; i < kShuffledInsertSize; ++i) {
+      tree.emplace(i, std::string(64, 'x'));
+    }
+    ASSERT_TRUE(std::ranges::all_of(tree, [&](const auto& value) {
+      return value.second.get_allocator().resource() == &pool;
+    }));
+    ASSERT_EQ(tree.erase_if([](const auto& value) noexcept {
+                return value.first % 2 == 0;
+              }),
+              kShuffledInsertSize / 2);
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+  }
+
+  /* Only the values free their memory, the nodes stay in the buffer. */
+  CountingMonotonicResource buffer;
+  {
+    pmr::RBtree<std::pmr::string, std::pmr::string> tree(&buffer);
+    for (int i = 0; i < kShuffledInsertSize; ++i) {
+      tree.emplace(std::to_string(i), std::string(64, 'x'));
+    }
+  }
+  ASSERT_EQ(buffer.deallocations(), kShuffledInsertSize);
+  {
+    pmr::RBset<int> set(std::less<int>{}, &buffer);
+    for (int i = 0; i < kShuffledInsertSize; ++i) {
+      set.insert(i);
+    }
+    ASSERT_EQ(set.size(), kShuffledInsertSize);
+  }
+  ASSERT_EQ(buffer.deallocations(), kShuffledInsertSize);
+}
+
+/* Moves and swaps between trees of every size, including empty ones. */
+template <typename Tree>
+void CheckMoveSwap() {
+  static_assert(std::is_nothrow_default_constructible_v<Tree>);
+  static_assert(std::is_nothrow_move_constructible_v<Tree>);
+  static_assert(std::is_nothrow_move_assignable_v<Tree>);
+  for (const int size : {0, 1, 2, kShuffledInsertSize}) {
+    Tree tree;
+    InsertShuffledSequence(tree, 0, size);
+    Tree moved(std::move(tree));
+    ASSERT_TRUE(tree.empty());
+    ASSERT_EQ(tree.begin(), tree.end());
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+    ASSERT_TRUE(RBtreeValidator(moved).is_valid());
+    ASSERT_EQ(moved.size(), size);
+    ASSERT_TRUE(std::ranges::equal(moved | std::views::keys,
+                                   std::views::iota(0, size)));
+    ASSERT_EQ(std::distance(moved.rbegin(), moved.rend()), size);
+
+    InsertSequence(tree, -size, 0, 1);
+    swap(tree, moved);
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+    ASSERT_TRUE(RBtreeValidator(moved).is_valid());
+    ASSERT_TRUE(std::ranges::equal(tree | std::views::keys,
+                                   std::views::iota(0, size)));
+    ASSERT_TRUE(std::ranges::equal(moved | std::views::keys,
+                                   std::views::iota(-size, 0)));
+
+    moved = std::move(tree);
+    ASSERT_TRUE(tree.empty());
+    ASSERT_TRUE(RBtreeValidator(moved).is_valid());
+    ASSERT_EQ(moved.size(), size);
+    InsertSequence(tree, 0, size, 1);
+    moved.erase(moved.begin(), moved.end());
+    tree.insert({size, size});
+    ASSERT_EQ(std::prev(tree.end())->first, size);
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+
+    /* A copy is rebuilt balanced and shares nothing with the original. */
+    Tree copy(tree);
+    ASSERT_TRUE(RBtreeValidator(copy).is_valid());
+    ASSERT_TRUE(copy == tree);
+    copy.erase(copy.begin(), copy.end());
+    ASSERT_EQ(tree.size(), size + 1);
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+  }
+
+  /* A vector relocates the trees as it grows. */
+  std::vector<Tree> trees;
+  for (int i = 0; i < kShuffledInsertSize / 100; ++i) {
+    trees.emplace_back();
+    InsertSequence(trees.back(), 0, i, 1);
+  }
+  int size = 0;
+  for (auto& tree : trees) {
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+    ASSERT_EQ(std::distance(tree.begin(), tree.end()), size++);
+  }
+}
+
+TEST(RBTREE, MOVE_SWAP) {
+  CheckMoveSwap<RBtree<int, int>>();
+  CheckMoveSwap<ThreadedTree>();
+  CheckMoveSwap<TopDownTree>();
+  CheckMoveSwap<AvlTree>();
+  CheckMoveSwap<WeightBalancedTree>();
+
+  /* Nodes stay with their resource, the values move over. */
+  std::pmr::unsynchronized_pool_resource first_pool;
+  std::pmr::unsynchronized_pool_resource second_pool;
+  pmr::RBtree<int, std::pmr::string> tree(&first_pool);
+  pmr::RBtree<int, std::pmr::string> other(&second_pool);
+  for (int i = 0; i < kShuffledInsertSize; ++i) {
+    other.emplace(i, std::string(64, 'x'));
+  }
+  tree = std::move(other);
+  ASSERT_TRUE(other.empty());
+  ASSERT_EQ(tree.size(), kShuffledInsertSize);
+  ASSERT_EQ(tree.get_allocator().resource(), &first_pool);
+  ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+}
+
+TEST(RBTREE, MULTIMAP) {
+  RBMultimap<int, int> tree;
+  std::multimap<int, int> expected;
+  std::mt19937 mt19937(kShuffledInsertSize);
+  std::uniform_int_distribution<int> keys(0, kShuffledInsertSize / 50);
+  DO_ATTEMPTS(kShuffleAttempts / 5,
+    for (int i = 0; i < kShuffledInsertSize; ++i) {
+      const int key = keys(mt19937);
+      if (mt19937() % 8 == 0) {
+        ASSERT_EQ(tree.erase(key), expected.erase(key));
+      } else {
+        const auto it = tree.insert({key, i});
+        ASSERT_EQ(it->first, key);
+        ASSERT_EQ(std::next(it), tree.upper_bound(key));
+        expected.insert({key, i});
+      }
+    }
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+    /* Equal keys keep their insertion order, as in std::multimap. */
+    ASSERT_TRUE(std::ranges::equal(tree, expected));
+    for (int key = -1; key <= kShuffledInsertSize / 50 + 1; ++key) {
+      ASSERT_EQ(tree.count(key), expected.count(key));
+      const auto [first, last] = tree.equal_range(key);
+      const auto [expected_first, expected_last] = expected.equal_range(key);
+      ASSERT_TRUE(std::ranges::equal(std::ranges::subrange(first, last),
+                                     std::ranges::subrange(expected_first,
+                                                           expected_last)));
+      ASSERT_EQ(tree.contains(key), expected.contains(key));
+      if (tree.contains(key)) {
+        ASSERT_EQ(tree.find(key)->first, key);
+      }
+    }
+  )
+
+  std::stringstream stream;
+  tree.serialize(stream);
+  RBMultimap<int, int> loaded;
+  loaded.deserialize(stream);
+  ASSERT_TRUE(RBtreeValidator(loaded).is_valid());
+  ASSERT_TRUE(loaded == tree);
+}
+
+TEST(RBTREE, MULTISET) {
+  RBMultiset<std::string> tree;
+  for (int i = 0; i < kShuffledInsertSize; ++i) {
+    tree.emplace(std::to_string(i % 7));
+  }
+  ASSERT_EQ(tree.size(), kShuffledInsertSize);
+  ASSERT_EQ(tree.count("3"), (kShuffledInsertSize + 3) / 7);
+  ASSERT_EQ(tree.erase("3"), (kShuffledInsertSize + 3) / 7);
+  ASSERT_EQ(tree.count("3"), 0);
+  ASSERT_TRUE(std::ranges::is_sorted(tree));
+  ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+}
+
+TEST(RBTREE, TOP_DOWN) {
+  TopDownTree tree;
+  std::map<int, int> expected;
+  std::mt19937 mt19937(kShuffledInsertSize);
+  std::uniform_int_distribution<int> keys(0, kShuffledInsertSize);
+  DO_ATTEMPTS(kShuffleAttempts / 5,
+    for (int i = 0; i < kShuffledInsertSize; ++i) {
+      const int key = keys(mt19937);
+      switch (mt19937() % 4) {
+        case 0:
+          ASSERT_EQ(tree.erase(key), expected.erase(key));
+          break;
+        case 1:
+          /* At an iterator the fixup is the bottom-up one. */
+          if (tree.contains(key)) {
+            tree.erase(tree.find(key));
+            expected.erase(key);
+          }
+          break;
+        default:
+          ASSERT_EQ(tree.insert({key, i}).second,
+                    expected.insert({key, i}).second);
+      }
+    }
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+    ASSERT_TRUE(std::ranges::equal(tree, expected));
+    ASSERT_EQ(tree.begin()->first, expected.begin()->first);
+  )
+  while (!tree.empty()) {
+    ASSERT_EQ(tree.erase(tree.begin()->first), 1);
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+  }
+
+  RBtree<int, int, std::less<int>, std::allocator<std::pair<const int, int>>,
+         TopDownMultiPolicy>
+      multimap;
+  InsertShuffledSequence(multimap, 0, kShuffledInsertSize);
+  InsertShuffledSequence(multimap, 0, kShuffledInsertSize);
+  ASSERT_EQ(multimap.erase(kShuffledInsertSize / 2), 2);
+  ASSERT_EQ(multimap.size(), 2 * kShuffledInsertSize - 2);
+  ASSERT_TRUE(RBtreeValidator(multimap).is_valid());
+}
+
+TEST(RBTREE, AVL) {
+  CheckBalancing<AvlTree>();
+  AvlTree tree;
+  InsertSequence(tree, 0, kInsertSize, 1);
+  ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+  /* A sorted insert leaves a red-black tree about 2 log n deep. */
+  const double bound = 1.44 * std::log2(kInsertSize + 2.0);
+  ASSERT_LE(RBtreeInspector(tree).shape().height, bound);
+}
+
+TEST(RBTREE, WEIGHT_BALANCED) {
+  CheckBalancing<WeightBalancedTree>();
+  WeightBalancedTree tree;
+  InsertSequence(tree, 0, kInsertSize, 1);
+  ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+}
+
+TEST(RBTREE, FINGER_SEARCH) {
+  RBtree<int, int> tree;
+  InsertShuffledSequence(tree, 0, kShuffledInsertSize);
+  tree.erase_if([](const auto& value) noexcept { return value.first % 2; });
+  std::mt19937 mt19937(kShuffledInsertSize);
+  std::uniform_int_distribution<int> keys(-1, kShuffledInsertSize + 1);
+  for (int i = 0; i < kShuffledInsertSize; ++i) {
+    const int key = keys(mt19937);
+    auto hint = tree.lower_bound(keys(mt19937));
+    ASSERT_EQ(tree.lower_bound(hint, key), tree.lower_bound(key));
+    ASSERT_EQ(tree.find(hint, key), tree.find(key));
+  }
+  ASSERT_EQ(tree.lower_bound(tree.end(), 2)->first, 2);
+  ASSERT_EQ(tree.find(tree.begin(), kShuffledInsertSize), tree.end());
+
+  std::vector<int> probes(kShuffledInsertSize);
+  std::ranges::generate(probes, [&] { return keys(mt19937); });
+  std::ranges::sort(probes);
+  std::vector<RBtree<int, int>::iterator> found;
+  tree.find_sorted(probes, std::back_inserter(found));
+  ASSERT_EQ(found.size(), probes.size());
+  for (std::size_t i = 0; i < probes.size(); ++i) {
+    ASSERT_EQ(found[i], tree.find(probes[i]));
+  }
+  const auto& const_tree = tree;
+  std::vector<RBtree<int, int>::const_iterator> const_found(probes.size());
+  const_tree.find_sorted(std::span(probes).first(10), const_found.begin());
+  ASSERT_EQ(const_found[9], tree.find(probes[9]));
+
+  RBMultimap<int, int> multimap;
+  for (int i = 0; i < kShuffledInsertSize; ++i) {
+    multimap.insert({i / 10, i});
+  }
+  for (int i = 0; i < kShuffledInsertSize / 10; ++i) {
+    const auto hint = multimap.lower_bound(keys(mt19937) / 10);
+    ASSERT_EQ(multimap.lower_bound(hint, i), multimap.lower_bound(i));
+    ASSERT_EQ(multimap.find(hint, i)->second, i * 10);
+  }
+}
+
+TEST(RBTREE, INSERT_SORTED_BATCH) {
+  std::mt19937 mt19937(kShuffledInsertSize);
+  std::uniform_int_distribution<int> keys(0, 4 * kShuffledInsertSize);
+  /* Finger inserts into a larger tree, then merges of larger batches. */
+  for (const int batch_size : {1, 10, kShuffledInsertSize / 10,
+                               kShuffledInsertSize, 4 * kShuffledInsertSize}) {
+    RBtree<int, int> tree = InitShuffledSequence(0, kShuffledInsertSize);
+    std::map<int, int> expected(tree.begin(), tree.end());
+    std::vector<std::pair<int, int>> batch(
+        static_cast<std::size_t>(batch_size));
+    for (auto& [key, value] : batch) {
+      key = keys(mt19937) - kShuffledInsertSize;
+      value = -key;
+    }
+    std::ranges::sort(batch);
+    std::size_t inserted = 0;
+    for (const auto& value : batch) {
+      inserted += expected.insert(value).second ? 1U : 0U;
+    }
+    ASSERT_EQ(tree.insert_sorted_batch(batch.begin(), batch.end()), inserted);
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+    ASSERT_TRUE(std::ranges::equal(tree, expected));
+  }
+
+  RBtree<int, int> empty;
+  std::vector<std::pair<int, int>> batch{{1, 1}, {1, 2}, {2, 2}};
+  ASSERT_EQ(empty.insert_sorted_batch(batch.begin(), batch.begin()), 0);
+  ASSERT_EQ(empty.insert_sorted_batch(batch.begin(), batch.end()), 2);
+  ASSERT_EQ(empty.at(1), 1);
+
+  /* Input iterators always take the finger path. */
+  RBtree<int, void, std::less<int>, std::allocator<int>,
+         rbtree_threaded_policy>
+      threaded;
+  for (int i = 0; i < kShuffledInsertSize; i += 2) {
+    threaded.insert(i);
+  }
+  std::stringstream stream;
+  for (int i = 1; i < kShuffledInsertSize; i += 2) {
+    stream << i << ' ';
+  }
+  ASSERT_EQ(threaded.insert_sorted_batch(std::istream_iterator<int>(stream),
+                                         std::istream_iterator<int>()),
+            kShuffledInsertSize / 2);
+  ASSERT_TRUE(RBtreeValidator(threaded).is_valid());
+  ASSERT_TRUE(
+      std::ranges::equal(threaded, std::views::iota(0, kShuffledInsertSize)));
+
+  /* Merged into an empty tree, merged again, then by finger search. */
+  RBMultimap<int, int> multimap;
+  multimap.insert_sorted_batch(batch.begin(), batch.end());
+  multimap.insert_sorted_batch(batch.begin(), batch.end());
+  multimap.insert_sorted_batch(batch.begin(), batch.begin() + 2);
+  ASSERT_TRUE(RBtreeValidator(multimap).is_valid());
+  const auto [first, last] = multimap.equal_range(1);
+  ASSERT_TRUE(std::ranges::equal(std::ranges::subrange(first, last) |
+                                     std::views::values,
+                                 std::vector{1, 2, 1, 2, 1, 2}));
+  ASSERT_EQ(multimap.size(), 8);
+}
+
+namespace {
+
+/* Intervals [start, start + length] stored as start -> length. */
+struct EndFromLength {
+  int operator()(const std::pair<const int, int>& value) const noexcept {
+    return value.first + value.second;
+  }
+};
+
+}  // namespace
+
+TEST(RBTREE, INTERVALS) {
+  RBIntervalMap<int, int, EndFromLength> tree;
+  std::multimap<int, int> expected;
+  std::mt19937 mt19937(kShuffledInsertSize);
+  std::uniform_int_distribution<int> starts(0, kShuffledInsertSize);
+  std::uniform_int_distribution<int> lengths(0, kShuffledInsertSize / 100);
+  const auto overlapping = [&](int lo, int hi) {
+    std::vector<std::pair<int, int>> result;
+    for (const auto& [start, length] : expected) {
+      if (start <= hi && lo <= start + length) {
+        result.emplace_back(start, length);
+      }
+    }
+    return result;
+  };
+  DO_ATTEMPTS(kShuffleAttempts / 10,
+    for (int i = 0; i < kShuffledInsertSize / 5; ++i) {
+      const int start = starts(mt19937);
+      if (mt19937() % 4 == 0) {
+        ASSERT_EQ(tree.erase(start), expected.erase(start));
+      } else {
+        const int length = lengths(mt19937);
+        tree.insert({start, length});
+        expected.insert({start, length});
+      }
+    }
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+    for (int i = 0; i < kShuffledInsertSize / 50; ++i) {
+      const int lo = starts(mt19937);
+      const int hi = lo + lengths(mt19937);
+      const auto expected_points = overlapping(lo, lo);
+      const auto found = tree.find_overlapping(lo);
+      if (expected_points.empty()) {
+        ASSERT_EQ(found, tree.end());
+      } else {
+        ASSERT_EQ(found->first, expected_points.front().first);
+        ASSERT_EQ(found->second, expected_points.front().second);
+      }
+      std::vector<std::pair<int, int>> visited;
+      tree.for_each_overlapping(lo, hi, [&](const auto& value) {
+        visited.emplace_back(value);
+      });
+      ASSERT_EQ(visited, overlapping(lo, hi));
+    }
+  )
+
+  std::size_t visited = 0;
+  tree.for_each_overlapping(0, kShuffledInsertSize, [&](const auto&) {
+    return ++visited < 3;
+  });
+  ASSERT_EQ(visited, std::min<std::size_t>(tree.size(), 3));
+
+  tree.compact(rbtree_layout::kVanEmdeBoas);
+  ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+  std::stringstream stream;
+  tree.serialize(stream);
+  RBIntervalMap<int, int, EndFromLength> loaded;
+  loaded.deserialize(stream);
+  ASSERT_TRUE(RBtreeValidator(loaded).is_valid());
+  ASSERT_TRUE(loaded == tree);
+
+  RBIntervalMap<int> ends;
+  for (const auto& [start, end] : {std::pair{1, 4}, {2, 3}, {6, 9}}) {
+    ends.insert({start, end});
+  }
+  ASSERT_EQ(ends.find_overlapping(3)->first, 1);
+  ASSERT_EQ(ends.find_overlapping(5), ends.end());
+  ASSERT_EQ(ends.find_overlapping(9)->first, 6);
+
+  /* End points change only through update, which refreshes the maxima. */
+  static_assert(std::is_const_v<
+                std::remove_reference_t<decltype(*ends.begin())>>);
+  ends.update(ends.find(1), [](int& end) { end = 100; });
+  ASSERT_TRUE(RBtreeValidator(ends).is_valid());
+  std::vector<int> starts_found;
+  ends.for_each_overlapping(50, 60, [&](const auto& value) {
+    starts_found.push_back(value.first);
+    return true;
+  });
+  ASSERT_EQ(starts_found, std::vector{1});
+}
+
+TEST(RBTREE, DIGEST) {
+  using DigestTree = RBtree<int, int, std::less<int>,
+                            std::allocator<std::pair<const int, int>>,
+                            rbtree_digest_policy<>>;
+  static_assert(sizeof(DigestTree) ==
+                sizeof(RBtree<int, int>) + sizeof(std::uint64_t));
+  DigestTree tree;
+  DigestTree replica;
+  std::map<int, int> expected;
+  std::mt19937 mt19937(kShuffledInsertSize);
+  std::uniform_int_distribution<int> keys(0, kShuffledInsertSize);
+  ASSERT_EQ(tree.digest(), 0);
+  DO_ATTEMPTS(kShuffleAttempts / 10,
+    for (int i = 0; i < kShuffledInsertSize; ++i) {
+      const int key = keys(mt19937);
+      switch (mt19937() % 4) {
+        case 0:
+          ASSERT_EQ(tree.erase(key), expected.erase(key));
+          break;
+        case 1:
+          tree.insert_or_assign(key, i);
+          expected.insert_or_assign(key, i);
+          break;
+        default:
+          ASSERT_EQ(tree.insert({key, i}).second,
+                    expected.insert({key, i}).second);
+      }
+    }
+    ASSERT_TRUE(RBtreeValidator(tree).is_valid());
+    ASSERT_TRUE(std::ranges::equal(tree, expected));
+    /* The same elements in another order: the same digest. */
+    replica.clear();
+    for (const auto& value : std::views::reverse(expected)) {
+      replica.insert(value);
+    }
+    ASSERT_EQ(replica.digest(), tree.digest());
+    ASSERT_TRUE(replica == tree);
+  )
+
+  /* One mapped value apart, then written back through update. */
+  const auto first = replica.begin();
+  replica.update(first, [](int& value) { ++value; });
+  ASSERT_TRUE(RBtreeValidator(replica).is_valid());
+  ASSERT_NE(replica.digest(), tree.digest());
+  ASSERT_FALSE(replica == tree);
+  ASSERT_TRUE((tree <=> replica) < 0);
+  replica.update(first, [](int& value) { --value; });
+  ASSERT_TRUE(replica == tree);
+
+  /* Carried by moves and rebuilt by batches and deserialize. */
+  DigestTree moved(std::move(replica));
+  ASSERT_EQ(replica.digest(), 0);
+  ASSERT_EQ(moved.digest(), tree.digest());
+  std::stringstream stream;
+  tree.serialize(stream);
+  DigestTree loaded;
+  loaded.deserialize(stream);
+  ASSERT_EQ(loaded.digest(), tree.digest());
+  DigestTree merged;
+  merged.insert_sorted_batch(expected.begin(), expected.end());
+  ASSERT_EQ(merged.digest(), tree.digest());
+  tree.clear();
+  ASSERT_EQ(tree.digest(), 0);
+
+  /* Without a digest == still compares the mapped values. */
+  RBtree<int, int> plain;
+  RBtree<int, int> other;
+  InsertSequence(plain, 0, kShuffledInsertSize, 1);
+  InsertSequence(other, 0, kShuffledInsertSize, 1);
+  ASSERT_TRUE(plain == other);
+  other.update(other.find(kShuffledInsertSize / 2), [](int& value) {
+    value = -1;
+  });
+  ASSERT_FALSE(plain == other);
+  ASSERT_TRUE((other <=> plain) < 0);
+
+  /* update keeps the maxima of an interval tree. */
+  RBIntervalMap<int> ends;
+  for (const auto& [start, end] : {std::pair{1, 4}, {2, 3}, {6, 9}}) {
+    ends.insert({start, end});
+  }
+  ends.update(ends.find(2), [](int& end) { end = 12; });
+  ASSERT_TRUE(RBtreeValidator(ends).is_valid());
+  ASSERT_EQ(ends.find_overlapping(11)->first, 2);
+}
+
 int main(int argc, char** argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
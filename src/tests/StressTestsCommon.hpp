@@ -0,0 +1,47 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <numeric>
+#include <random>
+#include <vector>
+
+/* Shared by the stress tests of RBtree and Btree. */
+
+static constexpr const int kInsertSize = 500000;
+static constexpr const int kShuffledInsertSize = 5000;
+static constexpr const int kShuffleAttempts = 50;
+static constexpr const int kSortingInsertAttemps = 500;
+static constexpr const int kLeftBorder = kShuffledInsertSize / 4 * 1;
+static constexpr const int kRightBorder = kShuffledInsertSize / 4 * 3;
+
+#define DO_ATTEMPTS(attemps_number, ...)                         \
+  for (auto current_attemp = 0; current_attemp < attemps_number; \
+       ++current_attemp) {                                       \
+    __VA_ARGS__                                                  \
+  }
+
+void InsertSequence(auto& tree, auto start, auto stop, auto step = 1) {
+  for (auto i = start; i < stop; i += step) {
+    tree.insert({i, i});
+  }
+}
+
+void InsertShuffledSequence(auto& tree, auto from, auto arrsize) {
+  std::vector<int> vec(static_cast<std::size_t>(arrsize));
+  std::iota(std::begin(vec), std::end(vec), from);
+
+  auto now = std::chrono::system_clock::now();
+  auto duration = now.time_since_epoch();
+  auto millis =
+      std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+
+  std::mt19937 mt19937(static_cast<std::mt19937::result_type>(millis));
+
+  std::shuffle(std::begin(vec), std::end(vec), mt19937);
+
+  for (std::size_t i = 0; i < static_cast<std::size_t>(arrsize); ++i) {
+    tree.insert({vec[i], vec[i]});
+  }
+}